@@ -4,6 +4,7 @@ use std::env;
 fn build_cpp_gen() {
     let src = [
         "src/erfs_generator.cpp",
+        "src/codec_file.cpp",
     //    "src/gzip_file.cpp",
     ];
     let mut builder = cc::Build::new();
@@ -37,6 +38,8 @@ fn main() {
         .unwrap();
         */
     build_cpp_gen();
+    // deflate, to compress the files
+    println!("cargo:rustc-link-lib=z");
 
     // commented for crates.io, because src directory is read-only
     generate_rust_binding();
@@ -0,0 +1,378 @@
+#include "codec_file.h"
+#include "zlib.h"
+
+#if defined(ERFS_WITH_ZSTD)
+#include <zstd.h>
+#endif
+#if defined(ERFS_WITH_LZ4)
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+// bytes of a dmer, the unit the dictionary trainer counts
+#define DICT_DMER_SIZE      8
+// bytes of a segment, the unit the dictionary trainer copies
+#define DICT_SEGMENT_SIZE   256
+
+static int read_file(const char* path, std::vector<uint8_t>& buf) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        return ERFS_GZIP_SRC_NOT_FOUND;
+    }
+    buf.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    return 0;
+}
+
+static int write_file(const char* path, const uint8_t* buf, size_t size) {
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs) {
+        return ERFS_GZIP_DEST_NOT_FOUND;
+    }
+    ofs.write(reinterpret_cast<const char*>(buf), size);
+    return ofs ? 0 : ERFS_GZIP_COMPRESS_FAIL;
+}
+
+int codec_available() {
+    int codecs = ERFS_CODEC_GZIP;
+#if defined(ERFS_WITH_ZSTD)
+    codecs |= ERFS_CODEC_ZSTD;
+#endif
+#if defined(ERFS_WITH_LZ4)
+    codecs |= ERFS_CODEC_LZ4;
+#endif
+    return codecs;
+}
+
+int zstd_file(const char* source_path, const char* dest_path) {
+#if defined(ERFS_WITH_ZSTD)
+    std::vector<uint8_t> src;
+    int ret = read_file(source_path, src);
+    if (ret != 0) {
+        return ret;
+    }
+    std::vector<uint8_t> dest(ZSTD_compressBound(src.size()));
+    size_t size = ZSTD_compress(dest.data(), dest.size(), src.data(), src.size(), 19);
+    if (ZSTD_isError(size)) {
+        return ERFS_GZIP_COMPRESS_FAIL;
+    }
+    return write_file(dest_path, dest.data(), size);
+#else
+    (void)source_path;
+    (void)dest_path;
+    return ERFS_GZIP_COMPRESS_FAIL;
+#endif
+}
+
+int lz4_file(const char* source_path, const char* dest_path) {
+#if defined(ERFS_WITH_LZ4)
+    std::vector<uint8_t> src;
+    int ret = read_file(source_path, src);
+    if (ret != 0) {
+        return ret;
+    }
+    if (src.size() > LZ4_MAX_INPUT_SIZE) {
+        return ERFS_GZIP_COMPRESS_FAIL;
+    }
+    int bound = LZ4_compressBound((int)src.size());
+    std::vector<uint8_t> dest(4 + bound);
+    uint32_t n = (uint32_t)src.size();
+    dest[0] = n & 0xFF;
+    dest[1] = (n >> 8) & 0xFF;
+    dest[2] = (n >> 16) & 0xFF;
+    dest[3] = (n >> 24) & 0xFF;
+    int size = LZ4_compress_HC(reinterpret_cast<const char*>(src.data()), reinterpret_cast<char*>(dest.data() + 4),
+        (int)src.size(), bound, LZ4HC_CLEVEL_MAX);
+    if (size <= 0 && !src.empty()) {
+        return ERFS_GZIP_COMPRESS_FAIL;
+    }
+    return write_file(dest_path, dest.data(), 4 + size);
+#else
+    (void)source_path;
+    (void)dest_path;
+    return ERFS_GZIP_COMPRESS_FAIL;
+#endif
+}
+
+/// compress a block of chunk_file(), empty if it doesn't get smaller
+static bool compress_block(const uint8_t* src, size_t size, int codec, std::vector<uint8_t>& out) {
+    switch (codec) {
+    case ERFS_CODEC_GZIP: {
+        uLongf n = compressBound(size);
+        out.resize(n);
+        if (compress2(out.data(), &n, src, size, Z_BEST_COMPRESSION) != Z_OK) {
+            return false;
+        }
+        out.resize(n);
+        break;
+    }
+#if defined(ERFS_WITH_ZSTD)
+    case ERFS_CODEC_ZSTD: {
+        out.resize(ZSTD_compressBound(size));
+        size_t n = ZSTD_compress(out.data(), out.size(), src, size, 19);
+        if (ZSTD_isError(n)) {
+            return false;
+        }
+        out.resize(n);
+        break;
+    }
+#endif
+#if defined(ERFS_WITH_LZ4)
+    case ERFS_CODEC_LZ4: {
+        if (size > LZ4_MAX_INPUT_SIZE) {
+            return false;
+        }
+        out.resize(LZ4_compressBound((int)size));
+        int n = LZ4_compress_HC(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(out.data()),
+            (int)size, (int)out.size(), LZ4HC_CLEVEL_MAX);
+        if (n <= 0) {
+            return false;
+        }
+        out.resize(n);
+        break;
+    }
+#endif
+    default:
+        return false;
+    }
+    if (out.size() >= size) {
+        out.clear();
+    }
+    return true;
+}
+
+static void put_u32(std::vector<uint8_t>& buf, size_t pos, uint32_t v) {
+    buf[pos] = v & 0xFF;
+    buf[pos + 1] = (v >> 8) & 0xFF;
+    buf[pos + 2] = (v >> 16) & 0xFF;
+    buf[pos + 3] = (v >> 24) & 0xFF;
+}
+
+int chunk_file(const char* source_path, const char* dest_path, int codec, uint32_t chunk_size) {
+    std::vector<uint8_t> src;
+    int ret = read_file(source_path, src);
+    if (ret != 0) {
+        return ret;
+    }
+    if (chunk_size == 0 || src.size() > std::numeric_limits<uint32_t>::max()) {
+        return ERFS_GZIP_COMPRESS_FAIL;
+    }
+    uint32_t count = (uint32_t)((src.size() + chunk_size - 1) / chunk_size);
+    std::vector<uint8_t> dest(12 + 4 * ((size_t)count + 1));
+    put_u32(dest, 0, (uint32_t)src.size());
+    put_u32(dest, 4, chunk_size);
+    put_u32(dest, 8, count);
+
+    std::vector<uint8_t> block;
+    for (uint32_t i = 0; i < count; i++) {
+        put_u32(dest, 12 + 4 * i, (uint32_t)dest.size());
+        const uint8_t* p = src.data() + (size_t)i * chunk_size;
+        size_t n = std::min<size_t>(chunk_size, src.size() - (size_t)i * chunk_size);
+        if (!compress_block(p, n, codec, block)) {
+            return ERFS_GZIP_COMPRESS_FAIL;
+        }
+        if (block.empty()) {
+            dest.insert(dest.end(), p, p + n);
+        } else {
+            dest.insert(dest.end(), block.begin(), block.end());
+        }
+    }
+    if (dest.size() > std::numeric_limits<uint32_t>::max()) {
+        return ERFS_GZIP_COMPRESS_FAIL;
+    }
+    put_u32(dest, 12 + 4 * (size_t)count, (uint32_t)dest.size());
+    return write_file(dest_path, dest.data(), dest.size());
+}
+
+int dict_file(const char* source_path, const char* dest_path, int codec, const uint8_t* dict, size_t dict_size) {
+    std::vector<uint8_t> src;
+    int ret = read_file(source_path, src);
+    if (ret != 0) {
+        return ret;
+    }
+    std::vector<uint8_t> dest;
+    switch (codec) {
+    case ERFS_CODEC_GZIP: {
+        z_stream strm;
+        memset(&strm, 0, sizeof(strm));
+        if (deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return ERFS_GZIP_COMPRESS_FAIL;
+        }
+        if (deflateSetDictionary(&strm, dict, dict_size) != Z_OK) {
+            deflateEnd(&strm);
+            return ERFS_GZIP_COMPRESS_FAIL;
+        }
+        dest.resize(deflateBound(&strm, src.size()));
+        strm.next_in = src.data();
+        strm.avail_in = src.size();
+        strm.next_out = dest.data();
+        strm.avail_out = dest.size();
+        ret = deflate(&strm, Z_FINISH);
+        dest.resize(strm.total_out);
+        deflateEnd(&strm);
+        if (ret != Z_STREAM_END) {
+            return ERFS_GZIP_COMPRESS_FAIL;
+        }
+        break;
+    }
+#if defined(ERFS_WITH_ZSTD)
+    case ERFS_CODEC_ZSTD: {
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        if (cctx == nullptr) {
+            return ERFS_GZIP_COMPRESS_FAIL;
+        }
+        dest.resize(ZSTD_compressBound(src.size()));
+        size_t size = ZSTD_compress_usingDict(cctx, dest.data(), dest.size(), src.data(), src.size(), dict, dict_size, 19);
+        ZSTD_freeCCtx(cctx);
+        if (ZSTD_isError(size)) {
+            return ERFS_GZIP_COMPRESS_FAIL;
+        }
+        dest.resize(size);
+        break;
+    }
+#endif
+#if defined(ERFS_WITH_LZ4)
+    case ERFS_CODEC_LZ4: {
+        if (src.size() > LZ4_MAX_INPUT_SIZE) {
+            return ERFS_GZIP_COMPRESS_FAIL;
+        }
+        LZ4_streamHC_t* stream = LZ4_createStreamHC();
+        if (stream == nullptr) {
+            return ERFS_GZIP_COMPRESS_FAIL;
+        }
+        LZ4_resetStreamHC_fast(stream, LZ4HC_CLEVEL_MAX);
+        LZ4_loadDictHC(stream, reinterpret_cast<const char*>(dict), (int)dict_size);
+        int bound = LZ4_compressBound((int)src.size());
+        dest.resize(4 + bound);
+        put_u32(dest, 0, (uint32_t)src.size());
+        int size = LZ4_compress_HC_continue(stream, reinterpret_cast<const char*>(src.data()),
+            reinterpret_cast<char*>(dest.data() + 4), (int)src.size(), bound);
+        LZ4_freeStreamHC(stream);
+        if (size <= 0 && !src.empty()) {
+            return ERFS_GZIP_COMPRESS_FAIL;
+        }
+        dest.resize(4 + size);
+        break;
+    }
+#endif
+    default:
+        return ERFS_GZIP_COMPRESS_FAIL;
+    }
+    return write_file(dest_path, dest.data(), dest.size());
+}
+
+///
+/// COVER: the samples are split into epochs, and each round takes the segment of an epoch whose dmers
+/// are in the most samples, then those dmers don't count any more. the dictionary is filled from the end,
+/// so the best segments are the closest to the data and the cheapest to refer to.
+///
+size_t train_dictionary(const uint8_t* samples, const size_t* sample_sizes, size_t count, uint8_t* dict, size_t capacity) {
+    const uint32_t none = std::numeric_limits<uint32_t>::max();
+    size_t total = 0;
+    for (size_t s = 0; s < count; s++) {
+        total += sample_sizes[s];
+    }
+    if (total < DICT_DMER_SIZE || capacity == 0) {
+        return 0;
+    }
+
+    // the dmer at each position, none if it crosses the end of a sample
+    std::vector<uint32_t> dmers(total, none);
+    // number of samples with a dmer
+    std::vector<uint32_t> freqs;
+    std::vector<uint32_t> last_sample;
+    std::unordered_map<uint64_t, uint32_t> ids;
+    size_t pos = 0;
+    for (size_t s = 0; s < count; pos += sample_sizes[s], s++) {
+        for (size_t i = 0; i + DICT_DMER_SIZE <= sample_sizes[s]; i++) {
+            uint64_t key;
+            memcpy(&key, samples + pos + i, sizeof(key));
+            auto it = ids.emplace(key, (uint32_t)freqs.size()).first;
+            if (it->second == freqs.size()) {
+                freqs.push_back(0);
+                last_sample.push_back(none);
+            }
+            uint32_t id = it->second;
+            dmers[pos + i] = id;
+            if (last_sample[id] != s) {
+                last_sample[id] = s;
+                freqs[id]++;
+            }
+        }
+    }
+    // a dmer of a single sample doesn't help the others
+    for (auto& f : freqs) {
+        f = (f > 1) ? f : 0;
+    }
+
+    const size_t window = DICT_SEGMENT_SIZE - DICT_DMER_SIZE + 1;
+    const size_t epochs = std::max<size_t>(1, std::min(capacity / DICT_SEGMENT_SIZE / 4, total / DICT_SEGMENT_SIZE));
+    const size_t epoch_size = total / epochs;
+    // occurrences of the dmers in the sliding window
+    std::vector<uint32_t> active(freqs.size(), 0);
+    size_t tail = capacity;
+    size_t empty_epochs = 0;
+    for (size_t epoch = 0; tail > 0 && empty_epochs < epochs; epoch = (epoch + 1) % epochs) {
+        size_t begin = epoch * epoch_size;
+        size_t end = (epoch + 1 == epochs) ? total : begin + epoch_size;
+
+        // the window of dmers [i + 1 - window, i], scored by the frequencies of the distinct dmers
+        uint64_t score = 0;
+        uint64_t best_score = 0;
+        size_t best = begin;
+        for (size_t i = begin; i < end; i++) {
+            uint32_t id = dmers[i];
+            if (id != none && active[id]++ == 0) {
+                score += freqs[id];
+            }
+            if (i >= begin + window) {
+                uint32_t out = dmers[i - window];
+                if (out != none && --active[out] == 0) {
+                    score -= freqs[out];
+                }
+            }
+            if (score > best_score) {
+                best_score = score;
+                best = (i + 1 >= begin + window) ? i + 1 - window : begin;
+            }
+        }
+        for (size_t i = (end >= begin + window) ? end - window : begin; i < end; i++) {
+            if (dmers[i] != none) {
+                active[dmers[i]] = 0;
+            }
+        }
+        if (best_score == 0) {
+            empty_epochs++;
+            continue;
+        }
+        empty_epochs = 0;
+
+        // trim the dmers that don't count, then they don't count any more
+        size_t first = best;
+        size_t last = std::min(best + window, end);
+        while (first < last && (dmers[first] == none || freqs[dmers[first]] == 0)) {
+            first++;
+        }
+        while (last > first && (dmers[last - 1] == none || freqs[dmers[last - 1]] == 0)) {
+            last--;
+        }
+        for (size_t i = first; i < last; i++) {
+            if (dmers[i] != none) {
+                freqs[dmers[i]] = 0;
+            }
+        }
+        size_t size = std::min(last - first + DICT_DMER_SIZE - 1, tail);
+        tail -= size;
+        memcpy(dict + tail, samples + first, size);
+    }
+    memmove(dict, dict + tail, capacity - tail);
+    return capacity - tail;
+}
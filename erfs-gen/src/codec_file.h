@@ -0,0 +1,69 @@
+#pragma once
+
+#include "gzip_file.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+///
+/// codecs of packed files, must be same as the ERFSEntry flags
+///
+enum RfsCodec {
+    ERFS_CODEC_GZIP              = 2,
+    ERFS_CODEC_ZSTD              = 4,
+    ERFS_CODEC_LZ4               = 8,
+};
+
+///
+/// @return bits of the codecs built in, zstd and lz4 are optional
+///
+int codec_available();
+
+///
+/// compress a file with zstd, a single frame with the content size
+/// @return 0:success, -1:failed to open file to read; -2: failed to open file to write; -3: compress fail
+///
+int zstd_file(const char* source_path, const char* dest_path);
+
+///
+/// compress a file with lz4 hc, a block after the original size (4 bytes, little endian)
+/// @return 0:success, -1:failed to open file to read; -2: failed to open file to write; -3: compress fail
+///
+int lz4_file(const char* source_path, const char* dest_path);
+
+///
+/// compress a file by blocks of chunk_size bytes, each one on its own, after a block index:
+/// [original size][chunk_size][block count][count + 1 block offsets] (4 bytes each, little endian).
+/// a block is stored as it is if it doesn't get smaller.
+/// @param codec ERFS_CODEC_*, gzip blocks are zlib streams, lz4 blocks have no size prefix
+/// @return 0:success, -1:failed to open file to read; -2: failed to open file to write; -3: compress fail
+///
+int chunk_file(const char* source_path, const char* dest_path, int codec, uint32_t chunk_size);
+
+///
+/// compress a file with a dictionary, as if its content followed the dictionary.
+/// the same formats as gzip_file(), zstd_file() and lz4_file(), except a zlib stream with the dictionary id for gzip.
+/// @param codec ERFS_CODEC_*
+/// @param dict raw content, at most 32KB is used by gzip and 64KB by lz4
+/// @return 0:success, -1:failed to open file to read; -2: failed to open file to write; -3: compress fail
+///
+int dict_file(const char* source_path, const char* dest_path, int codec, const uint8_t* dict, size_t dict_size);
+
+///
+/// build a raw content dictionary from the segments most shared by the samples
+/// @param samples the samples, one after another
+/// @param sample_sizes size of each sample
+/// @param count number of samples
+/// @param dict [out] the dictionary, the most useful segments at the end
+/// @param capacity size of dict
+/// @return size of the dictionary, 0 if the samples share nothing
+///
+size_t train_dictionary(const uint8_t* samples, const size_t* sample_sizes, size_t count, uint8_t* dict, size_t capacity);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -1,17 +1,50 @@
 #include "erfs_generator.h"
+#include "codec_file.h"
+#include "zlib.h"
 
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <vector>
-#include <memory>
+#include <string_view>
 #include <algorithm>
+#include <map>
 #include <set>
+#include <sstream>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <fnmatch.h>
+#include <unistd.h>
+
+// compress file when size >= 512, by default
+#define GZIP_FILE_SIZE_THRESHOLD    512
+// keep the compressed file when compressed / original size <= 0.8, by default
+#define GZIP_FILE_RATIO_THRESHOLD   0.8
 
-#define ERFS_MAX_SIZE                (1024 * 1024 * 100)
+// bytes from the head of a file to guess if it's worth compressing
+#define COMPRESS_SAMPLE_SIZE        65536
+// bits per byte of the sample above which a file is stored as it is
+#define COMPRESS_MAX_ENTROPY        7.9
 
-// compress file when size > 512
-#define GZIP_FILE_SIZE_THRESHOLD    512
+// --dict: files of [64B, 16KB] are compressed with a dictionary trained on at most 8MB of them
+#define DICT_FILE_MIN_SIZE          64
+#define DICT_FILE_MAX_SIZE          16384
+#define DICT_CAPACITY               32768
+#define DICT_SAMPLES_LIMIT          (8 * 1024 * 1024)
+#define DICT_MIN_SAMPLES            4
+
+// --align: up to 64KB, the largest page size
+#define DATA_ALIGN_MAX              65536
+// an image is mapped at a page boundary, so only this is guaranteed on any host with --image
+#define IMAGE_ALIGN_MAX             4096
+
+// auto codec: the preferred decoder among the codecs within 10% of the smallest size, see decode_rank()
+#define AUTO_CODEC_SIZE_SLACK       1.1
 
 #define ERFS_GENERATED_PREFIX       "erfs_gen_"
 
@@ -23,98 +56,206 @@
 enum ErfsEntryFlags {
     ERFS_DIRECTORY       = 1,
     ERFS_GZIPPED         = 2, 
+    ERFS_ZSTD            = 4,
+    ERFS_LZ4             = 8,
+    ERFS_CHUNKED         = 16,
+    ERFS_WIDE            = 32,
+    ERFS_DICT            = 64,
+
+    ERFS_CODEC_MASK      = ERFS_GZIPPED | ERFS_ZSTD | ERFS_LZ4,
 };
-/// ================== copy  from resource.h =========================
 
-namespace fs = std::filesystem;
+#define ERFS_IMAGE_MAGIC            "ERFS"
+#define ERFS_IMAGE_VERSION          1
+#define ERFS_IMAGE_VERSION_WIDE     2
 
-class RfsGenEntry {
-private:
-    std::string name_;
-    fs::path    path_;
-    uint32_t    flags_;
-    
-    int         ordinal_;
-    int         name_offset_;
+#pragma pack(1)
+/// header of an image file, followed by the sections it points to
+typedef struct {
+    uint8_t  magic[4];
+    uint32_t version;
+    uint32_t header_size;
 
-    int         data_offset_;
-    int         size_;
-public:
-    virtual ~RfsGenEntry() {};
-    const auto& name() {return name_;}
-    auto& name(const std::string& name){
-        this->name_ = name;
-        return *this;
-    }
+    uint32_t entry_count;
+    uint64_t entries_offset;
 
-    const auto& path() {return path_;}
-    auto& path(const fs::path& path){
-        this->path_ = path;
-        return *this;
-    }
+    uint32_t data_size;
+    uint64_t data_offset;
 
-    auto flags(){return flags_;}
-    auto& flags(uint32_t flags){this->flags_ = flags; return *this;}
+    uint32_t hash_seed;
+    uint32_t hash_bucket_count;
+    uint64_t hash_buckets_offset;
+    uint32_t hash_slot_count;
+    uint64_t hash_slots_offset;
 
-    auto& size(int size) {this->size_ = size; return *this;}
-    auto size(){return size_;};
+    uint64_t lookup_offset;
 
-    auto ordinal() {return ordinal_;};
-    auto& ordinal(int ordinal) {this->ordinal_ = ordinal; return *this;}
+    uint64_t data_size64;
 
-    auto name_offset(){return name_offset_;};
-    auto& name_offset(int name_offset) {this->name_offset_ = name_offset; return *this;}
-    
-    auto data_offset(){return data_offset_;};
-    auto& data_offset(int data_offset) {this->data_offset_ = data_offset; return *this;}
+    uint64_t file_info_offset;
 
-    virtual void debug(int indent = 0) {
-        for (int i = 0; i < indent; i++) {
-            std::cout << "    ";
-        }
-        std::cout << name() << ", size: " << size() << std::endl;
-    }
-    virtual bool is_directory() = 0;
+    uint32_t dict_offset;
+    uint32_t dict_size;
+} ErfsImageHeader;
+#pragma pack()
+/// ================== copy  from resource.h =========================
+
+namespace fs = std::filesystem;
+
+///
+/// an entry of the directory tree, stored by ordinal in RfsGenTree.
+/// the entries of a directory are contiguous and sorted by name, and the directories
+/// are numbered in depth first order, which is the order of the generated entries.
+///
+struct RfsGenEntry {
+    // name in RfsGenTree.names
+    uint32_t name_pool;
+    uint32_t name_size;
+    // ordinal of the parent directory, 0 for the root
+    uint32_t parent;
+    // ERFS_DIRECTORY, or the codec of a file set by compress_files()
+    uint32_t flags;
+    // offset of the name in the .data section
+    uint32_t name_offset;
+    // directory: ordinal of the first entry and number of entries;
+    // file: offset and size of the (packed) content in the .data section
+    uint64_t data_offset;
+    uint32_t size;
+    // size of the source file, from the directory scan
+    uint64_t source_size;
+    // hash of the source content, names the compressed file in the cache if flags has a codec
+    uint64_t hash;
+    // CRC32 of the source content, set with the content by data_file_content() or compress_files()
+    uint32_t crc32;
+    // file: the content starts at a multiple of this in the .data section, set by generate_data()
+    uint32_t align;
 };
 
-class RfsGenDirectory:public RfsGenEntry{
-private:
-    std::vector<std::shared_ptr<RfsGenEntry> > entries_;
-public:
-    auto& entries(){return entries_;};
+///
+/// the directory tree in one table, with all names pooled in one buffer
+///
+struct RfsGenTree {
+    // source path of the root directory
+    fs::path root;
+    std::vector<RfsGenEntry> entries;
+    std::string names;
 
-    virtual void debug(int indent = 0) override{
-        RfsGenEntry::debug(indent);
+    bool is_directory(uint32_t i) const {return (entries[i].flags & ERFS_DIRECTORY) != 0;}
 
-        for (auto& en : entries()) {
-            en ->debug(indent + 1);
+    std::string_view name(uint32_t i) const {
+        return std::string_view(names.data() + entries[i].name_pool, entries[i].name_size);
+    }
+
+    /// path relative to the root, '/' separated
+    std::string relative_path(uint32_t i) const {
+        std::vector<uint32_t> chain;
+        for (; i != 0; i = entries[i].parent) {
+            chain.push_back(i);
+        }
+        std::string path;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            if (!path.empty()) {
+                path.push_back('/');
+            }
+            path.append(name(*it));
         }
+        return path;
+    }
+
+    /// path of the source file or directory
+    fs::path path(uint32_t i) const {
+        return (i == 0) ? root : root / relative_path(i);
     }
 
-    virtual bool is_directory() override {return true;};
+    uint32_t add(const std::string& name, uint32_t parent, uint32_t flags, uint64_t source_size) {
+        RfsGenEntry entry = {};
+        entry.name_pool = names.size();
+        entry.name_size = name.length();
+        entry.parent = parent;
+        entry.flags = flags;
+        entry.source_size = source_size;
+        names.append(name);
+        entries.push_back(entry);
+        return entries.size() - 1;
+    }
 };
 
-class RfsGenFile:public RfsGenEntry{
-public:
-    virtual bool is_directory() override {return false;};
+static int build_tree(RfsGenTree& tree, uint32_t dir, const fs::path& path);
+///
+/// a compressed file of the last run
+///
+struct ManifestEntry {
+    uintmax_t size;
+    int64_t mtime;
+    // hash and CRC32 of the source content
+    uint64_t hash;
+    uint32_t crc32;
+    // candidate codecs, and the chosen one, 0 if stored as it is; with ERFS_CHUNKED if compressed by blocks
+    int codecs;
+    int codec;
+    // ErfsGenConfig.chunk_size
+    uint32_t chunk_size;
+    // hash of the dictionary the file is compressed with, 0 if none
+    uint64_t dict;
+};
+
+///
+/// the compressed files are kept in the cache dir `erfs_<id>.cache` of the target dir,
+/// named `<content hash>.<codec>.<chunk size>[.<dictionary hash>]` by the flags they are packed with,
+/// so files of the same content share one only if they have the same codec, and listed in its manifest by relative path.
+/// a file is recompressed only if its content, the codecs or the chunk size change.
+///
+struct Manifest {
+    fs::path dir;
+    fs::path root;
+    std::map<std::string, ManifestEntry> files;
+
+    // ErfsGenConfig.threshold and ratio
+    uint32_t threshold = GZIP_FILE_SIZE_THRESHOLD;
+    double ratio = GZIP_FILE_RATIO_THRESHOLD;
+
+    // updated by compress_files()
+    std::map<std::string, ManifestEntry> next;
+    int codecs = 0;
+    uint32_t chunk_size = 0;
+    // the dictionary of the small files, trained by compress_files() with --dict
+    std::vector<uint8_t> dict;
+    uint64_t dict_hash = 0;
+    std::atomic<int> reused{0};
 };
 
-static int build_tree(std::shared_ptr<RfsGenDirectory>& dir);
-static int generate_source (std::ostream& os, std::shared_ptr<RfsGenDirectory>& dir, const std::string& id, int options);
+static int generate_source (std::ostream& os, RfsGenTree& tree, const std::string& id, const ErfsGenConfig& config,
+        Manifest& manifest, const fs::path& blob_path, std::ostream* blob);
+static int generate_image (std::ostream& os, RfsGenTree& tree, const ErfsGenConfig& config, Manifest& manifest);
+static int load_manifest(Manifest& manifest);
+static int save_manifest(Manifest& manifest);
+static void update_file(const fs::path& tmp, const fs::path& path);
 static int generate_header (std::ostream& os, const std::string& id);
 static int generate_rust (std::ostream& os, const std::string& id);
 
-enum RfsGenTravelType {
-    ERFS_GEN_TRAVEL_DIR_ENTER,
-    ERFS_GEN_TRAVEL_DIR_LEAVE,
-    ERFS_GEN_TRAVEL_ENTRY,
-};
-typedef int (*rfsgen_visit) (std::shared_ptr<RfsGenEntry>& entry, enum RfsGenTravelType type, void* ctx);
+static int rfs_compress_file(const char* source_path, uintmax_t source_size, const char* dest_path, int codecs,
+        uint32_t threshold, double ratio, const std::vector<uint8_t>* dict, int* codec);
+static bool looks_compressed(const uint8_t* sample, size_t size);
+static bool valid_align(const ErfsGenConfig& config);
+static uint32_t data_align_max(const ErfsGenConfig& config);
+static int read_content(const fs::path& path, std::vector<uint8_t>& content);
 
-static int callback_data_entry_name(std::shared_ptr<RfsGenEntry>& entry, enum RfsGenTravelType type, void* ctx);
-static int callback_data_file_content (std::shared_ptr<RfsGenEntry>& entry, enum RfsGenTravelType type, void* ctx);
-static int callback_directory_entry (std::shared_ptr<RfsGenEntry>& entry, enum RfsGenTravelType type, void* ctx);
-static int rfs_gzip_file(const char* source_path, const char* dest_path);
+///
+/// fill the config with default settings
+///@param config the config to initialize
+void erfs_gen_config_init(ErfsGenConfig *config) {
+    config->options = 0;
+    config->jobs = 1;
+    config->codec = ERFS_GEN_CODEC_GZIP;
+    config->chunk_size = 0;
+    config->threshold = GZIP_FILE_SIZE_THRESHOLD;
+    config->ratio = GZIP_FILE_RATIO_THRESHOLD;
+    config->align = 1;
+    config->align_rules = nullptr;
+    config->align_rule_count = 0;
+    config->profile = nullptr;
+    config->profile_count = 0;
+}
 
 ///
 /// generate ERFS .c source file
@@ -123,7 +264,32 @@ static int rfs_gzip_file(const char* source_path, const char* dest_path);
 ///@param option e.g. gzip text files
 ///@param target_dir target directory 
 int erfs_generate(const char *path, const char *id, int options, const char *target_dir) {
+    ErfsGenConfig config;
+    erfs_gen_config_init(&config);
+    config.options = options;
+    return erfs_generate_config(path, id, &config, target_dir);
+}
+
+///
+/// generate ERFS .c source file
+///@param path the directory or file to be embedded
+///@param id identity of the FS, format: [a-z][a-z_0-9]*
+///@param config settings, initialized by erfs_gen_config_init()
+///@param target_dir target directory 
+int erfs_generate_config(const char *path, const char *id, const ErfsGenConfig *config, const char *target_dir) {
     int result = 0;
+    if (config == nullptr || config->jobs < 0 || !(config->ratio > 0) || !valid_align(*config)
+            || (config->profile == nullptr && config->profile_count > 0)) {
+        return ERFS_INVALID_OPTION;
+    }
+    int options = config->options;
+    if ((options & ERFS_GEN_GZIPPED) != 0) {
+        // a single codec must be built in, auto picks among the ones built in
+        int codecs = config->codec & codec_available();
+        if (codecs == 0 || (config->codec != ERFS_GEN_CODEC_AUTO && codecs != config->codec)) {
+            return ERFS_INVALID_OPTION;
+        }
+    }
 
     //
     // pahse 0: check input parameters
@@ -141,134 +307,325 @@ int erfs_generate(const char *path, const char *id, int options, const char *tar
     //
     // phase 1: build the directory tree
     //
-    auto root = std::make_shared<RfsGenDirectory>();
-
-    root->path(source).name("/");
+    RfsGenTree tree;
+    tree.root = source;
+    tree.add("/", 0, ERFS_DIRECTORY, 0);
     if (!(fs::is_directory(source))) {
-        auto file = std::make_shared<RfsGenFile>();
-        file->path(source).name(source.filename());
-
-        root->path(source.parent_path());
-        root->entries().push_back(file);
+        tree.root = source.parent_path();
+        tree.entries[0].data_offset = 1;
+        tree.entries[0].size = 1;
+        tree.add(source.filename(), 0, 0, fs::file_size(source));
     } else {
-        result = build_tree(root);
+        result = build_tree(tree, 0, source);
+    }
+
+    // compressed files of the last run
+    Manifest manifest;
+    manifest.dir = target / (std::string("erfs_") + std::string(id) + std::string(".cache"));
+    manifest.root = tree.root;
+    manifest.threshold = config->threshold;
+    manifest.ratio = config->ratio;
+    if ((options & ERFS_GEN_GZIPPED) != 0) {
+        load_manifest(manifest);
     }
 
     //
     // phase 2: generate the ERFS source file
+    // outputs are written to .tmp files, and replace the old ones only if they differ,
+    // so unchanged outputs keep their mtime and don't trigger the compiler
     //
+    if ((options & ERFS_GEN_IMAGE) != 0) {
+        // image file only, mounted at runtime
+        std::string name = std::string("erfs_") + std::string(id) + std::string(".img");
+        fs::path rfsfile = target / name;
+        fs::path tmpfile = target / (name + ".tmp");
+        std::cout << "Packaging: " << source << " to " << rfsfile << std::endl;
+        if (data_align_max(*config) > IMAGE_ALIGN_MAX) {
+            std::cerr << "Warning: a mounted image is only aligned to the page size, --align above "
+                << IMAGE_ALIGN_MAX << " may not be honored, see erfs_entryalign()" << std::endl;
+        }
+        {
+            std::ofstream ofs(tmpfile, std::ios::binary);
+            result = generate_image(ofs, tree, *config, manifest);
+        }
+        if (result != 0) {
+            fs::remove(tmpfile);
+            return result;
+        }
+        update_file(tmpfile, rfsfile);
+        save_manifest(manifest);
+        return result;
+    }
     {
         // .c source file
         std::string name = std::string("erfs_") + std::string(id) + std::string(".c");
         fs::path rfsfile = target / name;
-        std::ofstream ofs(rfsfile);
+        fs::path tmpfile = target / (name + ".tmp");
         std::cout << "Packaging: " << source << " to " << rfsfile << std::endl;
-        generate_source(ofs, root, id, options);
+        fs::path blob;
+        fs::path tmpblob;
+        if ((options & ERFS_GEN_BLOB) != 0) {
+            blob = target / (std::string("erfs_") + std::string(id) + std::string(".bin"));
+            tmpblob = target / (std::string("erfs_") + std::string(id) + std::string(".bin.tmp"));
+        }
+        {
+            std::ofstream ofs(tmpfile);
+            std::ofstream blob_ofs;
+            if (!blob.empty()) {
+                blob_ofs.open(tmpblob, std::ios::binary);
+            }
+            result = generate_source(ofs, tree, id, *config, manifest, blob, blob.empty() ? nullptr : &blob_ofs);
+        }
+        if (result != 0) {
+            fs::remove(tmpfile);
+            if (!blob.empty()) {
+                fs::remove(tmpblob);
+            }
+            return result;
+        }
+        if (!blob.empty()) {
+            update_file(tmpblob, blob);
+        }
+        update_file(tmpfile, rfsfile);
+        save_manifest(manifest);
     }
     {
         // .h header file
         std::string name = std::string("erfs_") + std::string(id) + std::string(".h");
         fs::path rfsfile = target / name;
-        std::ofstream ofs(rfsfile);
+        fs::path tmpfile = target / (name + ".tmp");
         std::cout << "Generating header: " << rfsfile << std::endl;
-        generate_header(ofs, id);
+        {
+            std::ofstream ofs(tmpfile);
+            generate_header(ofs, id);
+        }
+        update_file(tmpfile, rfsfile);
     }
     if ((options & ERFS_GEN_RUST) != 0){
         // rust(.rs) file
         std::string name = std::string("erfs_") + std::string(id) + std::string(".rs");
         fs::path rfsfile = target / name;
-        std::ofstream ofs(rfsfile);
+        fs::path tmpfile = target / (name + ".tmp");
         std::cout << "Generating Ruet: " << rfsfile << std::endl;
-        generate_rust(ofs, id);
+        {
+            std::ofstream ofs(tmpfile);
+            generate_rust(ofs, id);
+        }
+        update_file(tmpfile, rfsfile);
     }
 
     return 0;
 }
 
+///
+/// replace `path` with `tmp` if their contents differ, otherwise keep `path` as it is
+///
+static void update_file(const fs::path& tmp, const fs::path& path) {
+    bool same = false;
+    std::error_code ec;
+    if (fs::exists(path, ec) && fs::file_size(path, ec) == fs::file_size(tmp, ec)) {
+        std::ifstream a(tmp, std::ios::binary);
+        std::ifstream b(path, std::ios::binary);
+        char abuf[16384];
+        char bbuf[16384];
+        same = true;
+        while (same && a) {
+            a.read(abuf, sizeof(abuf));
+            b.read(bbuf, sizeof(bbuf));
+            same = a.gcount() == b.gcount() && memcmp(abuf, bbuf, a.gcount()) == 0;
+        }
+    }
+    if (same) {
+        std::cout << "Unchanged: " << path << std::endl;
+        fs::remove(tmp);
+    } else {
+        fs::rename(tmp, path);
+    }
+}
+
 
 ///
-/// preprocess the directory tree
+/// scan a directory into the tree: its entries are appended together, sorted by name,
+/// then the subdirectories are scanned in the same order
 ///
-static int build_tree(std::shared_ptr<RfsGenDirectory>& dir) {
+static int build_tree(RfsGenTree& tree, uint32_t dir, const fs::path& path) {
     int result = 0;
-    for(auto& p: fs::directory_iterator(dir->path())) {
-        auto path = p.path();
-
-        // std::cout << p.path() << std::endl;
-        if (fs::is_directory(path)) {
-            auto subdir = std::make_shared<RfsGenDirectory>();
-            subdir->name(path.filename()).path(path);
-            result = build_tree(subdir);
-            dir->entries().push_back(subdir);
-        } else {
-            auto file = std::make_shared<RfsGenFile>();
-            file->name(path.filename()).path(path);
-            dir->entries().push_back(file);
-        }
+    struct Scanned {
+        std::string name;
+        bool directory;
+        uintmax_t size;
+    };
+    std::vector<Scanned> scanned;
+    for(auto& p: fs::directory_iterator(path)) {
+        std::error_code ec;
+        // the type comes with the directory entry, so files are stat'ed once for the size
+        bool directory = p.is_directory(ec);
+        uintmax_t size = directory ? 0 : p.file_size(ec);
+        scanned.push_back({p.path().filename(), directory, ec ? 0 : size});
     }
 
     // sort the entries
-    std::sort(dir->entries().begin(), dir->entries().end(), [](const auto& left, const auto& right){
-        return left->name() < (right->name());
+    std::sort(scanned.begin(), scanned.end(), [](const auto& left, const auto& right){
+        return left.name < right.name;
     });
-    
+
+    uint32_t first = tree.entries.size();
+    tree.entries[dir].data_offset = scanned.empty() ? 0 : first;
+    tree.entries[dir].size = scanned.size();
+    for (auto& en : scanned) {
+        tree.add(en.name, dir, en.directory ? ERFS_DIRECTORY : 0, en.size);
+    }
+    for (uint32_t i = 0; i < scanned.size(); i++) {
+        if (scanned[i].directory) {
+            result = build_tree(tree, first + i, path / scanned[i].name);
+        }
+    }
     return result;
 }
 
 
 
-static int rfsgen_travel_tree(std::shared_ptr<RfsGenEntry>& entry, rfsgen_visit callback, void* ctx) {
-    int result = 0;
+// ================== must be same as resource_fs.c =========================
+static uint64_t erfs_hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
 
-    if (entry->is_directory()) {
-        result = (*callback)(entry, ERFS_GEN_TRAVEL_DIR_ENTER, ctx);
-        if (result) {
-            return result;
+/// hash of a full path, 8 bytes a step
+static uint64_t erfs_hash_path(const uint8_t *s, uint32_t len, uint32_t seed) {
+    uint64_t h = seed ^ (len * 0x9E3779B97F4A7C15ULL);
+    uint64_t k;
+    while (len >= 8) {
+        k = (uint64_t)s[0] | ((uint64_t)s[1] << 8) | ((uint64_t)s[2] << 16) | ((uint64_t)s[3] << 24)
+            | ((uint64_t)s[4] << 32) | ((uint64_t)s[5] << 40) | ((uint64_t)s[6] << 48) | ((uint64_t)s[7] << 56);
+        h = erfs_hash_mix(h ^ k);
+        s += 8;
+        len -= 8;
+    }
+    k = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        k |= (uint64_t)s[i] << (i * 8);
+    }
+    return erfs_hash_mix(h ^ k ^ 0x2545F4914F6CDD1DULL);
+}
+
+/// slot of a key in a bucket with displacement d
+static uint32_t erfs_hash_slot(uint64_t hash, uint32_t d, uint32_t slot_count) {
+    uint32_t x = (uint32_t)hash ^ (d * 0x9E3779B1U);
+    x ^= x >> 16;
+    x *= 0x85EBCA6BU;
+    x ^= x >> 13;
+    return (uint32_t)(((uint64_t)x * slot_count) >> 32);
+}
+// ================== must be same as resource_fs.c =========================
+
+///
+/// minimal perfect hash (hash and displace): keys are grouped into buckets, and
+/// each bucket gets a displacement which moves all its keys to free slots.
+///
+struct PerfectHash {
+    uint32_t seed;
+    std::vector<uint32_t> buckets;  // displacement of each bucket
+    std::vector<uint32_t> slots;    // key index in each slot
+};
+
+static bool build_perfect_hash(const std::vector<std::string>& keys, PerfectHash& ph) {
+    const uint32_t n = keys.size();
+    const uint32_t bucket_count = n / 3 + 1;
+    std::vector<uint64_t> hashes(n);
+
+    for (uint32_t seed = 0; seed < 64; seed++) {
+        std::vector<std::vector<uint32_t> > buckets(bucket_count);
+        for (uint32_t i = 0; i < n; i++) {
+            hashes[i] = erfs_hash_path((const uint8_t*)keys[i].data(), keys[i].length(), seed);
+            buckets[(uint32_t)(hashes[i] >> 32) % bucket_count].push_back(i);
         }
 
-        // directory entries
-        std::shared_ptr<RfsGenDirectory> dir = std::dynamic_pointer_cast<RfsGenDirectory> (entry);
-        // pass 1: all entries
-        for (auto& en: dir->entries()) {
-            result = (*callback)(en, ERFS_GEN_TRAVEL_ENTRY, ctx);
-            if (result) {
-                return result;
-            }
+        // place the largest buckets first, while most slots are free
+        std::vector<uint32_t> order(bucket_count);
+        for (uint32_t b = 0; b < bucket_count; b++) {
+            order[b] = b;
         }
-        // pass 2: subdirectory
-        for (auto& en: dir->entries()) {
-            if(en->is_directory()) {
-                result = rfsgen_travel_tree(en, callback, ctx);
-                if (result) {
-                    return result;
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t left, uint32_t right){
+            return buckets[left].size() > buckets[right].size();
+        });
+
+        ph.seed = seed;
+        ph.buckets.assign(bucket_count, 0);
+        ph.slots.assign(n, 0);
+        std::vector<bool> taken(n, false);
+        std::vector<uint32_t> pos;
+        bool ok = true;
+        for (auto b : order) {
+            if (buckets[b].empty()) {
+                break;
+            }
+            const uint64_t max_d = std::max<uint64_t>(1024, (uint64_t)n * 64);
+            bool placed = false;
+            for (uint64_t d = 0; d < max_d && !placed; d++) {
+                pos.clear();
+                placed = true;
+                for (auto k : buckets[b]) {
+                    uint32_t p = erfs_hash_slot(hashes[k], (uint32_t)d, n);
+                    if (taken[p] || std::find(pos.begin(), pos.end(), p) != pos.end()) {
+                        placed = false;
+                        break;
+                    }
+                    pos.push_back(p);
+                }
+                if (placed) {
+                    ph.buckets[b] = (uint32_t)d;
+                    for (size_t i = 0; i < pos.size(); i++) {
+                        taken[pos[i]] = true;
+                        ph.slots[pos[i]] = buckets[b][i];
+                    }
                 }
             }
+            if (!placed) {
+                ok = false;
+                break;
+            }
         }
-
-        result = (*callback)(entry, ERFS_GEN_TRAVEL_DIR_LEAVE, ctx);
-        if (result) {
-            return result;
+        if (ok) {
+            return true;
         }
-    } else {
-        return -1;
     }
-    return result;
+    return false;
 }
 
-
-
 struct CodegenContext {
     // config
     std::ostream& os;
     bool gzip;
+    // raw .data section of the blob mode, nullptr for string literals
+    std::ostream* blob;
     
-    // state, updated by the callback functions.
-    int ordinal;
-    int offset;
-    int escape;
-    bool first;
+    // state, updated as the data are written
+    uint64_t offset = 0;
+    int escape = 0;
+
+    // ordinals of the packed contents by hash, to share the data of identical files
+    std::unordered_multimap<uint64_t, uint32_t> contents;
+    uint64_t duplicate_files = 0;
+    uint64_t duplicate_bytes = 0;
+    // zeros written before the aligned contents
+    uint64_t padding = 0;
+
+    CodegenContext(std::ostream& os, bool gzip, std::ostream* blob) : os(os), gzip(gzip), blob(blob) {}
 };
 
+static void output_line(std::ostream& os, const uint8_t* buf, int len, CodegenContext &ctx);
+static void output_data(CodegenContext &ctx, const uint8_t* buf, int len);
+static void data_entry_name(CodegenContext& ctx, RfsGenTree& tree, uint32_t i);
+static void data_file_content(CodegenContext& ctx, RfsGenTree& tree, const Manifest& manifest, uint32_t i);
+static void directory_entry(std::ostream& os, const RfsGenTree& tree, uint32_t i, bool wide);
+static void directory_entry_codec(std::ostream& os, uint32_t flags);
+static void file_info_record(const RfsGenTree& tree, uint32_t i, uint32_t info[2]);
+
 static int print_license(std::ostream& os) {
     os  << "/**" << std::endl
         << " automatically generated by erfs_gen." << std::endl
@@ -328,36 +685,609 @@ static int generate_rust (std::ostream& os, const std::string& id) {
     return 0;
 }
 
-static int generate_source (std::ostream& os, std::shared_ptr<RfsGenDirectory>& dir, const std::string& id, int options) {
+#define ERFS_MANIFEST_NAME          "manifest"
+#define ERFS_MANIFEST_VERSION       "erfs-manifest 6"
+
+static fs::path manifest_pack_path(const Manifest& manifest, const ManifestEntry& entry) {
+    char name[64];
+    int n = snprintf(name, sizeof(name), "%016llx.%d.%u", (unsigned long long)entry.hash, entry.codec, entry.chunk_size);
+    if (entry.dict != 0) {
+        snprintf(name + n, sizeof(name) - n, ".%016llx", (unsigned long long)entry.dict);
+    }
+    return manifest.dir / name;
+}
+
+/// the content to be packed: the compressed file in the cache, or the source file
+static fs::path content_path(const RfsGenTree& tree, const Manifest& manifest, uint32_t file) {
+    const RfsGenEntry& entry = tree.entries[file];
+    if ((entry.flags & ERFS_CODEC_MASK) == 0) {
+        return tree.path(file);
+    }
+    ManifestEntry pack = {};
+    pack.hash = entry.hash;
+    pack.codec = entry.flags & (ERFS_CODEC_MASK | ERFS_CHUNKED | ERFS_DICT);
+    pack.chunk_size = manifest.chunk_size;
+    pack.dict = ((entry.flags & ERFS_DICT) != 0) ? manifest.dict_hash : 0;
+    return manifest_pack_path(manifest, pack);
+}
+
+/// the settings of the decisions to compress, a manifest of other settings is dropped
+static std::string manifest_settings(const Manifest& manifest) {
+    std::ostringstream os;
+    os << "threshold " << manifest.threshold << " ratio " << manifest.ratio;
+    return os.str();
+}
+
+///
+/// manifest format, one file per line after the version line and the settings line:
+///   <hash> <crc32> <size> <mtime> <codecs> <codec> <chunk size> <dictionary hash> <relative path>
+///
+static int load_manifest(Manifest& manifest) {
+    std::ifstream ifs(manifest.dir / ERFS_MANIFEST_NAME);
+    std::string line;
+    if (!std::getline(ifs, line) || line != ERFS_MANIFEST_VERSION) {
+        return -1;
+    }
+    if (!std::getline(ifs, line) || line != manifest_settings(manifest)) {
+        return -1;
+    }
+    while (std::getline(ifs, line)) {
+        std::istringstream is(line);
+        ManifestEntry entry;
+        std::string path;
+        is >> std::hex >> entry.hash >> entry.crc32 >> std::dec >> entry.size >> entry.mtime >> entry.codecs >> entry.codec >> entry.chunk_size
+            >> std::hex >> entry.dict;
+        is.get();
+        if (!is || !std::getline(is, path)) {
+            continue;
+        }
+        manifest.files[path] = entry;
+    }
+    return 0;
+}
+
+///
+/// write the manifest of this run, and remove the compressed files not used any more
+///
+static int save_manifest(Manifest& manifest) {
+    if (!fs::exists(manifest.dir)) {
+        return 0;
+    }
+    std::set<fs::path> used;
+    {
+        std::ofstream ofs(manifest.dir / (ERFS_MANIFEST_NAME ".tmp"));
+        ofs << ERFS_MANIFEST_VERSION << std::endl;
+        ofs << manifest_settings(manifest) << std::endl;
+        for (auto& it : manifest.next) {
+            auto& e = it.second;
+            ofs << std::hex << e.hash << " " << e.crc32 << std::dec << " " << e.size << " " << e.mtime << " "
+                << e.codecs << " " << e.codec << " " << e.chunk_size << " " << std::hex << e.dict << std::dec
+                << " " << it.first << std::endl;
+            used.insert(manifest_pack_path(manifest, e));
+        }
+    }
+    update_file(manifest.dir / (ERFS_MANIFEST_NAME ".tmp"), manifest.dir / ERFS_MANIFEST_NAME);
+
+    std::error_code ec;
+    for (auto& p : fs::directory_iterator(manifest.dir, ec)) {
+        if (p.path().filename() != ERFS_MANIFEST_NAME && used.find(p.path()) == used.end()) {
+            fs::remove(p.path(), ec);
+        }
+    }
+    if (manifest.reused > 0) {
+        std::cout << "Reused " << manifest.reused << " compressed files of " << manifest.dir << std::endl;
+    }
+    return 0;
+}
+
+///
+/// small files are compressed with the dictionary, never by chunks
+///
+static bool dict_eligible(uintmax_t size, uint32_t chunk_size) {
+    return size >= DICT_FILE_MIN_SIZE && size <= DICT_FILE_MAX_SIZE && (chunk_size == 0 || size <= chunk_size);
+}
+
+///
+/// compress a file, or reuse the result of the last run
+///@return the codec, 0 if the file is stored as it is
+///
+static int compress_file(const RfsGenTree& tree, uint32_t file, Manifest& manifest, ManifestEntry& entry) {
+    fs::path source = tree.path(file);
+    std::error_code ec;
+    entry.size = tree.entries[file].source_size;
+    entry.mtime = fs::last_write_time(source, ec).time_since_epoch().count();
+    entry.codecs = manifest.codecs;
+    entry.chunk_size = manifest.chunk_size;
+    const std::vector<uint8_t>* dict = nullptr;
+    if (manifest.dict_hash != 0 && dict_eligible(entry.size, entry.chunk_size)) {
+        dict = &manifest.dict;
+    }
+    entry.dict = (dict != nullptr) ? manifest.dict_hash : 0;
+
+    std::string key = tree.relative_path(file);
+    auto old = manifest.files.find(key);
+    bool same_stat = old != manifest.files.end() && old->second.size == entry.size && old->second.mtime == entry.mtime;
+    if (same_stat) {
+        entry.hash = old->second.hash;
+        entry.crc32 = old->second.crc32;
+    } else {
+        std::vector<uint8_t> content;
+        if (read_content(source, content) != 0) {
+            return 0;
+        }
+        entry.hash = erfs_hash_path(content.data(), content.size(), 0);
+        entry.crc32 = crc32(0, content.data(), content.size());
+    }
+
+    if (old != manifest.files.end() && old->second.hash == entry.hash && old->second.codecs == entry.codecs
+            && old->second.chunk_size == entry.chunk_size && old->second.dict == entry.dict) {
+        entry.codec = old->second.codec;
+        if (entry.codec == 0 || fs::exists(manifest_pack_path(manifest, entry), ec)) {
+            manifest.reused++;
+            return entry.codec;
+        }
+    }
+
+    // unique per file, files with the same content may run concurrently;
+    // the pack is named after the codec chosen, which is known at the end
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx.tmp.%u", (unsigned long long)entry.hash, file);
+    fs::path tmp = manifest.dir / name;
+    entry.codec = 0;
+    if (rfs_compress_file(source.c_str(), entry.size, tmp.c_str(), entry.codecs, manifest.threshold, manifest.ratio,
+            dict, &entry.codec) == 0) {
+        if (dict != nullptr) {
+            entry.codec |= ERFS_DICT;
+        }
+        // the codec is chosen on the whole file, then it's compressed again by blocks
+        if (entry.chunk_size > 0 && entry.size > entry.chunk_size) {
+            if (chunk_file(source.c_str(), tmp.c_str(), entry.codec, entry.chunk_size) == 0) {
+                entry.codec |= ERFS_CHUNKED;
+            } else {
+                fs::remove(tmp, ec);
+                entry.codec = 0;
+                return 0;
+            }
+        }
+        // files of the same content and codec have the same pack, either one may be renamed last
+        fs::rename(tmp, manifest_pack_path(manifest, entry), ec);
+    }
+    return entry.codec;
+}
+
+///
+/// train the dictionary of the small files on an even sample of them,
+/// leaves manifest.dict empty if there are too few
+///
+static void train_files_dictionary(const RfsGenTree& tree, const std::vector<uint32_t>& files, Manifest& manifest) {
+    std::vector<uint32_t> eligible;
+    uintmax_t total = 0;
+    for (auto f : files) {
+        if (dict_eligible(tree.entries[f].source_size, manifest.chunk_size)) {
+            eligible.push_back(f);
+            total += tree.entries[f].source_size;
+        }
+    }
+    size_t stride = std::max<uintmax_t>(1, (total + DICT_SAMPLES_LIMIT - 1) / DICT_SAMPLES_LIMIT);
+
+    std::vector<uint8_t> samples;
+    std::vector<size_t> sample_sizes;
+    std::vector<uint8_t> content;
+    for (size_t i = 0; i < eligible.size(); i += stride) {
+        if (read_content(tree.path(eligible[i]), content) != 0 || looks_compressed(content.data(), content.size())) {
+            continue;
+        }
+        samples.insert(samples.end(), content.begin(), content.end());
+        sample_sizes.push_back(content.size());
+    }
+    if (sample_sizes.size() < DICT_MIN_SAMPLES) {
+        return;
+    }
+
+    manifest.dict.resize(DICT_CAPACITY);
+    size_t size = train_dictionary(samples.data(), sample_sizes.data(), sample_sizes.size(), manifest.dict.data(),
+            manifest.dict.size());
+    manifest.dict.resize(size);
+    // zstd would take it for a trained dictionary
+    static const uint8_t zstd_dict_magic[] = {0x37, 0xa4, 0x30, 0xec};
+    if (size >= 4 && memcmp(manifest.dict.data(), zstd_dict_magic, 4) == 0) {
+        manifest.dict.erase(manifest.dict.begin());
+    }
+    if (!manifest.dict.empty()) {
+        manifest.dict_hash = erfs_hash_path(manifest.dict.data(), manifest.dict.size(), 0) | 1;
+    }
+}
+
+///
+/// compress the files before emission, with `jobs` workers.
+/// each file is compressed on its own, so the result doesn't depend on the order.
+///
+static void compress_files(RfsGenTree& tree, const std::vector<uint32_t>& files, Manifest& manifest, int jobs, int codecs,
+        uint32_t chunk_size, bool dict) {
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    jobs = std::min<size_t>(jobs, std::max<size_t>(1, files.size()));
+    manifest.codecs = codecs;
+    manifest.chunk_size = chunk_size;
+    if (dict) {
+        train_files_dictionary(tree, files, manifest);
+    }
+
+    std::error_code ec;
+    fs::create_directories(manifest.dir, ec);
+
+    std::vector<ManifestEntry> results(files.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < files.size(); i = next++) {
+            int codec = compress_file(tree, files[i], manifest, results[i]);
+            if (codec != 0) {
+                tree.entries[files[i]].hash = results[i].hash;
+                tree.entries[files[i]].crc32 = results[i].crc32;
+                tree.entries[files[i]].flags = codec;
+            }
+        }
+    };
+
+    if (jobs == 1) {
+        worker();
+    } else {
+        std::vector<std::thread> workers;
+        for (int i = 0; i < jobs; i++) {
+            workers.emplace_back(worker);
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    for (size_t i = 0; i < files.size(); i++) {
+        manifest.next[tree.relative_path(files[i])] = results[i];
+    }
+}
+
+///
+/// pull the blob into the .c file: C23 #embed if the compiler has it, otherwise .incbin
+///
+static void generate_blob_include(std::ostream& os, const std::string& id, const fs::path& blob_path, uint32_t align) {
+    std::string symbol = ERFS_GENERATED_PREFIX + id + "_data";
+    std::string incbin = fs::absolute(blob_path).generic_string();
+
+    os  << "// names and contents, in " << blob_path.filename() << std::endl
+        << "#if defined(__has_embed)" << std::endl
+        << "static const uint8_t " << symbol << "[] __attribute__((aligned(" << align << "))) = {" << std::endl
+        << "#embed \"" << blob_path.filename().generic_string() << "\" if_empty(0)" << std::endl
+        << "};" << std::endl
+        << "#else // defined(__has_embed)" << std::endl
+        << "#if defined(__APPLE__)" << std::endl
+        << "#define ERFS_BLOB_SECTION \".const_data\\n\"" << std::endl
+        << "#define ERFS_BLOB_SYMBOL \"_" << symbol << "\"" << std::endl
+        << "#else" << std::endl
+        << "#define ERFS_BLOB_SECTION \".section .rodata\\n\"" << std::endl
+        << "#define ERFS_BLOB_SYMBOL \"" << symbol << "\"" << std::endl
+        << "#endif" << std::endl
+        << "__asm__(" << std::endl
+        << "  ERFS_BLOB_SECTION" << std::endl
+        << "  \".balign " << align << "\\n\"" << std::endl
+        << "  ERFS_BLOB_SYMBOL \":\\n\"" << std::endl
+        << "  \".incbin \\\"" << incbin << "\\\"\\n\"" << std::endl
+        << "  \".previous\\n\"" << std::endl
+        << ");" << std::endl
+        << "extern const uint8_t " << symbol << "[];" << std::endl
+        << "#endif // defined(__has_embed)" << std::endl
+        << std::endl;
+}
+
+///
+/// offsets of the .data section, filled by generate_data()
+///
+struct DataLayout {
+    // perfect hash index on the full paths of all entries but the root, key k is the entry k + 1
+    bool hash = false;
+    std::vector<std::string> paths;
+    std::vector<uint32_t> path_offsets;
+    PerfectHash ph;
+
+    // lookup array: {prefix, name_size, entry} by ordinal, children in Eytzinger order
+    struct Lookup {
+        uint64_t prefix;
+        uint32_t name_size;
+        uint32_t entry;
+    };
+    std::vector<Lookup> lookup;
+
+    // dictionary of the ERFS_DICT files, in data
+    uint32_t dict_offset = 0;
+    uint32_t dict_size = 0;
+};
+
+static DataLayout::Lookup lookup_record(const RfsGenTree& tree, uint32_t entry) {
+    std::string_view name = tree.name(entry);
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < 8; i++) {
+        prefix = (prefix << 8) | ((i < name.length()) ? (uint8_t)name[i] : 0);
+    }
+    return {prefix, (uint32_t)name.length(), entry};
+}
+
+/// place the sorted entries [first, first + count) in Eytzinger order, out[k - 1] for the 1-based node k
+static void eytzinger_order(const RfsGenTree& tree, uint32_t first, uint32_t count, uint32_t& i, size_t k,
+        DataLayout::Lookup* out) {
+    if (k <= count) {
+        eytzinger_order(tree, first, count, i, 2 * k, out);
+        out[k - 1] = lookup_record(tree, first + i++);
+        eytzinger_order(tree, first, count, i, 2 * k + 1, out);
+    }
+}
+
+/// lookup records of all entries, by ordinal
+static void build_lookup(const RfsGenTree& tree, DataLayout& layout) {
+    auto& lookup = layout.lookup;
+    lookup.resize(tree.entries.size());
+
+    lookup[0] = lookup_record(tree, 0);
+    for (uint32_t d = 0; d < tree.entries.size(); d++) {
+        const RfsGenEntry& dir = tree.entries[d];
+        if (tree.is_directory(d) && dir.size > 0) {
+            uint32_t i = 0;
+            eytzinger_order(tree, dir.data_offset, dir.size, i, 1, &lookup[dir.data_offset]);
+        }
+    }
+}
+
+static bool valid_align(const ErfsGenConfig& config) {
+    auto valid = [](uint32_t align) {
+        return align > 0 && align <= DATA_ALIGN_MAX && (align & (align - 1)) == 0;
+    };
+    for (uint32_t i = 0; i < config.align_rule_count; i++) {
+        if (config.align_rules[i].pattern == nullptr || !valid(config.align_rules[i].align)) {
+            return false;
+        }
+    }
+    return valid(config.align);
+}
+
+/// the alignment of the first rule matching a relative path, 0 if none
+static uint32_t align_rule(const ErfsGenConfig& config, const std::string& path) {
+    for (uint32_t i = 0; i < config.align_rule_count; i++) {
+        if (fnmatch(config.align_rules[i].pattern, path.c_str(), 0) == 0) {
+            return config.align_rules[i].align;
+        }
+    }
+    return 0;
+}
+
+/// the alignment of the .data section, so the offsets aligned in it are aligned in memory
+static uint32_t data_align_max(const ErfsGenConfig& config) {
+    uint32_t align = config.align;
+    for (uint32_t i = 0; i < config.align_rule_count; i++) {
+        align = std::max(align, config.align_rules[i].align);
+    }
+    return align;
+}
+
+/// append the files of entry `i` to `order`, the ones under a directory in tree order
+static void profile_files(const RfsGenTree& tree, uint32_t i, std::vector<bool>& placed, std::vector<uint32_t>& order) {
+    if (!tree.is_directory(i)) {
+        if (!placed[i]) {
+            placed[i] = true;
+            order.push_back(i);
+        }
+        return;
+    }
+    const RfsGenEntry& dir = tree.entries[i];
+    for (uint64_t child = dir.data_offset; child < dir.data_offset + dir.size; child++) {
+        profile_files(tree, child, placed, order);
+    }
+}
+
+/// the order of the file contents: the files of the profile first, in access order, then the others in tree order.
+/// the paths of the profile may start with '/' or "./", like the paths opened at runtime
+static std::vector<uint32_t> data_order(const RfsGenTree& tree, const ErfsGenConfig& config) {
+    const uint32_t count = tree.entries.size();
+    std::vector<uint32_t> order;
+    std::vector<bool> placed(count, false);
+    if (config.profile_count > 0) {
+        std::unordered_map<std::string, uint32_t> ordinals;
+        for (uint32_t i = 1; i < count; i++) {
+            ordinals.emplace(tree.relative_path(i), i);
+        }
+        uint32_t unknown = 0;
+        for (uint32_t p = 0; p < config.profile_count; p++) {
+            std::string_view path(config.profile[p] != nullptr ? config.profile[p] : "");
+            while (!path.empty() && (path.front() == '/' || path.substr(0, 2) == "./")) {
+                path.remove_prefix(path.front() == '/' ? 1 : 2);
+            }
+            while (!path.empty() && path.back() == '/') {
+                path.remove_suffix(1);
+            }
+            auto it = ordinals.find(std::string(path));
+            if (it == ordinals.end()) {
+                unknown += path.empty() ? 0 : 1;
+                continue;
+            }
+            profile_files(tree, it->second, placed, order);
+        }
+        std::cout << "Placed " << order.size() << " files of the profile first";
+        if (unknown > 0) {
+            std::cout << ", unknown paths in the profile: " << unknown;
+        }
+        std::cout << std::endl;
+    }
+    for (uint32_t i = 1; i < count; i++) {
+        if (!tree.is_directory(i) && !placed[i]) {
+            order.push_back(i);
+        }
+    }
+    return order;
+}
+
+///
+/// write the .data section and assign offsets to all entries.
+/// The .data section has 4 parts:
+/// 1. directory and file names 
+/// 2. full paths, if there is a perfect hash index
+/// 3. the dictionary of the small files, with --dict
+/// 4. file contents, each one aligned as configured, the files of the profile first
+///@return 0 for success; ERFS_SOURCE_TOO_LARGE if a file or the data don't fit the offsets
+///
+static int generate_data(CodegenContext& ctx, RfsGenTree& tree, const ErfsGenConfig& config,
+        Manifest& manifest, DataLayout& layout) {
+    std::ostream& os = ctx.os;
+    // comments, only if the data are string literals
+    bool text = ctx.blob == nullptr;
+    const uint32_t count = tree.entries.size();
+    const uint64_t max_offset = std::numeric_limits<uint32_t>::max();
+
+    for (uint32_t i = 1; i < count; i++) {
+        if (!tree.is_directory(i) && tree.entries[i].source_size > max_offset) {
+            std::cout << "File of 4GB or more: " << tree.path(i) << std::endl;
+            return ERFS_SOURCE_TOO_LARGE;
+        }
+    }
+    
+    if (text) {
+        os << "  // entry names" << std::endl;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        data_entry_name(ctx, tree, i);
+    }
+
+    if ((config.options & ERFS_GEN_HASH) != 0) {
+        // all entries but the root, which is opened without lookup
+        for (uint32_t i = 1; i < count; i++) {
+            layout.paths.push_back(tree.relative_path(i));
+        }
+        layout.hash = build_perfect_hash(layout.paths, layout.ph);
+        if (!layout.hash) {
+            std::cout << "Failed to build the perfect hash index, skipped." << std::endl;
+        }
+    }
+    if (layout.hash) {
+        if (text) {
+            os << "  // full paths" << std::endl;
+        }
+        for (auto& p : layout.paths) {
+            layout.path_offsets.push_back(ctx.offset);
+            ctx.offset += p.length();
+            output_data(ctx, (const uint8_t*)p.data(), p.length());
+        }
+    }
+
+    // the files matching an alignment rule are used in place, so never compressed
+    std::vector<uint32_t> files;
+    for (uint32_t i = 1; i < count; i++) {
+        if (!tree.is_directory(i)) {
+            uint32_t align = align_rule(config, tree.relative_path(i));
+            tree.entries[i].align = (align > 0) ? align : config.align;
+            if (align == 0) {
+                files.push_back(i);
+            }
+        }
+    }
+    if (ctx.gzip) {
+        compress_files(tree, files, manifest, config.jobs, config.codec & codec_available(), config.chunk_size,
+                (config.options & ERFS_GEN_DICT) != 0);
+    }
+    bool dict_used = false;
+    for (uint32_t i = 1; i < count && !dict_used; i++) {
+        dict_used = !tree.is_directory(i) && (tree.entries[i].flags & ERFS_DICT) != 0;
+    }
+    if (dict_used) {
+        if (text) {
+            os << "  // dictionary" << std::endl;
+        }
+        layout.dict_offset = ctx.offset;
+        layout.dict_size = manifest.dict.size();
+        ctx.offset += manifest.dict.size();
+        for (size_t pos = 0; pos < manifest.dict.size(); pos += 80) {
+            size_t len = std::min<size_t>(80, manifest.dict.size() - pos);
+            output_data(ctx, manifest.dict.data() + pos, len);
+        }
+    }
+    // names, paths and the dictionary come first, their offsets are 32 bits in both formats
+    if (ctx.offset > max_offset) {
+        std::cout << "More than 4GB of names and paths" << std::endl;
+        return ERFS_SOURCE_TOO_LARGE;
+    }
+
+    if (text) {
+        os << "  // file contents" << std::endl;
+    }
+    for (uint32_t i : data_order(tree, config)) {
+        data_file_content(ctx, tree, manifest, i);
+    }
+    if (ctx.padding > 0) {
+        std::cout << "Aligned the files with " << ctx.padding << " bytes of padding" << std::endl;
+    }
+    if (ctx.duplicate_files > 0) {
+        std::cout << "Deduplicated " << ctx.duplicate_files << " files, saved " << ctx.duplicate_bytes << " bytes" << std::endl;
+    }
+    if (ctx.offset > max_offset && (config.options & ERFS_GEN_WIDE) == 0) {
+        std::cout << "More than 4GB of data, --wide is required" << std::endl;
+        return ERFS_SOURCE_TOO_LARGE;
+    }
+
+    if ((config.options & ERFS_GEN_EYTZINGER) != 0) {
+        build_lookup(tree, layout);
+    }
+    return 0;
+}
+
+static int generate_source (std::ostream& os, RfsGenTree& tree, const std::string& id, const ErfsGenConfig& config,
+        Manifest& manifest, const fs::path& blob_path, std::ostream* blob) {
+    int options = config.options;
     print_license(os);
     os  << "#define  __ERFS_IMPL__" << std::endl
         << "#include \"erfs_" << id << ".h\"" << std::endl
-        << std::endl
+        << std::endl;
+
+    uint32_t align = data_align_max(config);
+    if (blob != nullptr) {
+        generate_blob_include(os, id, blob_path, std::max<uint32_t>(16, align));
+    }
+
+    os
 
         << "static const ErfsFileSystem " ERFS_GENERATED_PREFIX << id << "_;" << std::endl
         << "ErfsRoot " ERFS_GENERATED_PREFIX << id << "(){" << std::endl
         << "  return (ErfsRoot)&" ERFS_GENERATED_PREFIX << id << "_;" << std::endl
         << "}" << std::endl
-        << std::endl
-        
-        << "static const ErfsFileSystem " ERFS_GENERATED_PREFIX << id << "_ = {" << std::endl;
-
+        << std::endl;
 
-    // 
-    // The .data section has 2 parts:
-    // 1. directory and file names 
-    // 2. file contents
-    //
-    os << "  .data = (uint8_t *)" << std::endl;
-    CodegenContext ctx = {os, (options & ERFS_GEN_GZIPPED) != 0, 0, 0, 0, true};
-    std::shared_ptr<RfsGenEntry> entry = std::dynamic_pointer_cast<RfsGenEntry> (dir);
-    
-    os << "  // entry names" << std::endl;
-    callback_data_entry_name(entry, ERFS_GEN_TRAVEL_ENTRY, &ctx);
-    rfsgen_travel_tree(entry, callback_data_entry_name, &ctx);
+    CodegenContext ctx(os, (options & ERFS_GEN_GZIPPED) != 0, blob);
+    DataLayout layout;
+    int result = 0;
+    // a string literal has no alignment, the aligned data are an array initialized by it
+    bool aligned_literal = blob == nullptr && align > 1;
+    if (aligned_literal) {
+        os  << "static const char " ERFS_GENERATED_PREFIX << id << "_data[] __attribute__((aligned(" << align
+            << "))) =" << std::endl;
+        result = generate_data(ctx, tree, config, manifest, layout);
+        if (result != 0) {
+            return result;
+        }
+        os << "  ;" << std::endl << std::endl;
+    }
 
-    os << "  // file contents" << std::endl;
-    rfsgen_travel_tree(entry, callback_data_file_content, &ctx);
+    os << "static const ErfsFileSystem " ERFS_GENERATED_PREFIX << id << "_ = {" << std::endl;
+    if (blob != nullptr || aligned_literal) {
+        os << "  .data = (uint8_t *)" ERFS_GENERATED_PREFIX << id << "_data" << std::endl;
+    } else {
+        os << "  .data = (uint8_t *)" << std::endl;
+    }
+    if (!aligned_literal) {
+        result = generate_data(ctx, tree, config, manifest, layout);
+        if (result != 0) {
+            return result;
+        }
+    }
+    bool wide = (options & ERFS_GEN_WIDE) != 0;
+    auto& paths = layout.paths;
+    auto& path_offsets = layout.path_offsets;
+    auto& ph = layout.ph;
+    bool hash = layout.hash;
 
     // 
     // .data_size
@@ -372,18 +1302,93 @@ static int generate_source (std::ostream& os, std::shared_ptr<RfsGenDirectory>&
     //
     os  << "," << std::endl;
     os << "  // entry_count" << std::endl
-        << "  .entry_count = " << ctx.ordinal;
+        << "  .entry_count = " << tree.entries.size();
 
     // 
     // .entries
     //
     os  << "," << std::endl;
-    os << "  // directory tree: {name_offset, name_length, data_offset, data_size, flags}" << std::endl;
-    os << "  .entries = (ErfsEntry[]){" << std::endl;
-    callback_directory_entry(entry, ERFS_GEN_TRAVEL_ENTRY, &ctx);
-    rfsgen_travel_tree(entry, callback_directory_entry, &ctx);
+    if (wide) {
+        os << "  .entry_size = sizeof(ErfsEntry64)," << std::endl;
+        os << "  // directory tree: {{name_offset, name_length, data_offset, data_size, flags}, data_offset_hi}" << std::endl;
+        os << "  .entries = (ErfsEntry *)(ErfsEntry64[]){" << std::endl;
+    } else {
+        os << "  // directory tree: {name_offset, name_length, data_offset, data_size, flags}" << std::endl;
+        os << "  .entries = (ErfsEntry[]){" << std::endl;
+    }
+    for (uint32_t i = 0; i < tree.entries.size(); i++) {
+        if (i > 0) {
+            os << "," << std::endl;
+        }
+        directory_entry(os, tree, i, wide);
+    }
     os << std::endl << "  }";
 
+    //
+    // .hash_*
+    //
+    if (hash) {
+        os  << "," << std::endl;
+        os  << "  // perfect hash index" << std::endl
+            << "  .hash_seed = " << ph.seed << "," << std::endl
+            << "  .hash_bucket_count = " << ph.buckets.size() << "," << std::endl
+            << "  .hash_buckets = (uint32_t[]){";
+        for (size_t i = 0; i < ph.buckets.size(); i++) {
+            os << ((i % 16 == 0) ? "\n    " : " ") << ph.buckets[i] << ",";
+        }
+        os  << std::endl << "  }," << std::endl;
+
+        os  << "  .hash_slot_count = " << ph.slots.size() << "," << std::endl
+            << "  // {entry, path_offset, path_size}" << std::endl
+            << "  .hash_slots = (ErfsHashSlot[]){" << std::endl;
+        for (auto k : ph.slots) {
+            os  << "    {" << k + 1 << ", " << path_offsets[k] << ", " << paths[k].length() << "}," << std::endl;
+        }
+        os  << "  }";
+    }
+
+    //
+    // .lookup
+    //
+    if (!layout.lookup.empty()) {
+        os  << "," << std::endl;
+        os  << "  // lookup array: {prefix, name_size, entry}, children in Eytzinger order" << std::endl
+            << "  .lookup = (ErfsLookup[]){" << std::endl;
+        char prefix[32];
+        for (auto& l : layout.lookup) {
+            snprintf(prefix, sizeof(prefix), "0x%016llxULL", (unsigned long long)l.prefix);
+            os  << "    {" << prefix << ", " << l.name_size << ", " << l.entry << "}," << std::endl;
+        }
+        os  << "  }";
+    }
+
+    //
+    // .file_info
+    //
+    if ((options & ERFS_GEN_CRC) != 0) {
+        os  << "," << std::endl;
+        os  << "  // file info: {size, crc32}" << std::endl
+            << "  .file_info = (ErfsFileInfo[]){" << std::endl;
+        char crc[16];
+        for (uint32_t i = 0; i < tree.entries.size(); i++) {
+            uint32_t info[2];
+            file_info_record(tree, i, info);
+            snprintf(crc, sizeof(crc), "0x%08x", info[1]);
+            os  << "    {" << info[0] << ", " << crc << "}," << std::endl;
+        }
+        os  << "  }";
+    }
+
+    //
+    // .dict_*
+    //
+    if (layout.dict_size > 0) {
+        os  << "," << std::endl;
+        os  << "  // dictionary of the small files" << std::endl
+            << "  .dict_offset = " << layout.dict_offset << "," << std::endl
+            << "  .dict_size = " << layout.dict_size;
+    }
+
     os  << std::endl;
     os  << "};" << std::endl;
     return 0;
@@ -391,254 +1396,522 @@ static int generate_source (std::ostream& os, std::shared_ptr<RfsGenDirectory>&
 
 
 
+/// {name_offset, name_size, data_offset, data_size, flags} of an entry, and data_offset_hi if wide
+///@return number of words
+static int entry_record(const RfsGenTree& tree, uint32_t i, bool wide, uint32_t record[6]) {
+    const RfsGenEntry& entry = tree.entries[i];
+    record[0] = entry.name_offset;
+    record[1] = entry.name_size;
+    record[2] = (uint32_t)entry.data_offset;
+    record[3] = entry.size;
+    record[4] = tree.is_directory(i) ? (uint32_t)ERFS_DIRECTORY : entry.flags & (ERFS_CODEC_MASK | ERFS_CHUNKED | ERFS_DICT);
+    if (!wide) {
+        return 5;
+    }
+    record[4] |= ERFS_WIDE;
+    record[5] = (uint32_t)(entry.data_offset >> 32);
+    return 6;
+}
+
+/// {size, crc32} of the source of a file, zeros for a directory
+static void file_info_record(const RfsGenTree& tree, uint32_t i, uint32_t info[2]) {
+    const RfsGenEntry& entry = tree.entries[i];
+    bool directory = tree.is_directory(i);
+    info[0] = directory ? 0 : (uint32_t)entry.source_size;
+    info[1] = directory ? 0 : entry.crc32;
+}
+
+static void write_u32(std::ostream& os, uint32_t v) {
+    // images are in host byte order, like the header: the runtime uses the entries in place
+    os.write(reinterpret_cast<const char*>(&v), 4);
+}
+
+static void write_u64(std::ostream& os, uint64_t v) {
+    os.write(reinterpret_cast<const char*>(&v), 8);
+}
+
+static uint64_t align_stream(std::ostream& os, int align) {
+    uint64_t pos = os.tellp();
+    while (pos % align != 0) {
+        os.put(0);
+        pos++;
+    }
+    return pos;
+}
+
+///
+/// generate an image file to be mounted by erfs_mount_file() on a host of the same byte order:
+/// header | data | entries | hash buckets | hash slots | lookup | file info
+///
+static int generate_image (std::ostream& os, RfsGenTree& tree, const ErfsGenConfig& config, Manifest& manifest) {
+    ErfsImageHeader header;
+    memset(&header, 0, sizeof(header));
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    header.data_offset = align_stream(os, std::max<uint32_t>(16, data_align_max(config)));
+
+    // the data are written as they are, like the blob mode
+    CodegenContext ctx(os, (config.options & ERFS_GEN_GZIPPED) != 0, &os);
+    DataLayout layout;
+    int result = generate_data(ctx, tree, config, manifest, layout);
+    if (result != 0) {
+        return result;
+    }
+    bool wide = (config.options & ERFS_GEN_WIDE) != 0;
+
+    memcpy(header.magic, ERFS_IMAGE_MAGIC, 4);
+    header.version = wide ? ERFS_IMAGE_VERSION_WIDE : ERFS_IMAGE_VERSION;
+    header.header_size = sizeof(header);
+    header.data_size = wide ? 0 : ctx.offset;
+    header.data_size64 = wide ? ctx.offset : 0;
+    header.entry_count = tree.entries.size();
+
+    header.entries_offset = align_stream(os, 8);
+    uint32_t record[6];
+    for (uint32_t i = 0; i < tree.entries.size(); i++) {
+        int words = entry_record(tree, i, wide, record);
+        for (int w = 0; w < words; w++) {
+            write_u32(os, record[w]);
+        }
+    }
+
+    if (layout.hash) {
+        header.hash_seed = layout.ph.seed;
+        header.hash_bucket_count = layout.ph.buckets.size();
+        header.hash_buckets_offset = align_stream(os, 8);
+        for (auto d : layout.ph.buckets) {
+            write_u32(os, d);
+        }
+        header.hash_slot_count = layout.ph.slots.size();
+        header.hash_slots_offset = align_stream(os, 8);
+        for (auto k : layout.ph.slots) {
+            write_u32(os, k + 1);
+            write_u32(os, layout.path_offsets[k]);
+            write_u32(os, layout.paths[k].length());
+        }
+    }
+
+    if (!layout.lookup.empty()) {
+        header.lookup_offset = align_stream(os, 64);
+        for (auto& l : layout.lookup) {
+            write_u64(os, l.prefix);
+            write_u32(os, l.name_size);
+            write_u32(os, l.entry);
+        }
+    }
+
+    if ((config.options & ERFS_GEN_CRC) != 0) {
+        header.file_info_offset = align_stream(os, 8);
+        uint32_t info[2];
+        for (uint32_t i = 0; i < tree.entries.size(); i++) {
+            file_info_record(tree, i, info);
+            write_u32(os, info[0]);
+            write_u32(os, info[1]);
+        }
+    }
+
+    header.dict_offset = layout.dict_offset;
+    header.dict_size = layout.dict_size;
+
+    os.seekp(0);
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return os.good() ? 0 : -1;
+}
+
+
+
 /// https://en.cppreference.com/w/cpp/string/byte/isprint
 /// https://en.cppreference.com/w/cpp/language/string_literal
 /// https://en.cppreference.com/w/cpp/language/escape
-static std::string escape_char(unsigned char ch) {
+///@param out at least 4 bytes
+///@return length of the escaped char
+static int escape_char(unsigned char ch, char* out) {
+    static const char hex[] = "0123456789abcdef";
+    char simple;
     switch (ch) {
-    case '\\': return "\\\\"; 
-    case '\"': return "\\\""; 
-    case '\a': return "\\a"; 
-    case '\b': return "\\b"; 
-    case '\t': return "\\t"; 
-    case '\n': return "\\n"; 
-    case '\v': return "\\v"; 
-    case '\f': return "\\f"; 
-    case '\r': return "\\r"; 
+    case '\\': simple = '\\'; break;
+    case '\"': simple = '\"'; break;
+    case '\a': simple = 'a'; break;
+    case '\b': simple = 'b'; break;
+    case '\t': simple = 't'; break;
+    case '\n': simple = 'n'; break;
+    case '\v': simple = 'v'; break;
+    case '\f': simple = 'f'; break;
+    case '\r': simple = 'r'; break;
     default:
         if (ch >= 32 && ch <= 126) {
             // isprint
-            std::string str;
-            str.push_back(ch);
-            return str;
+            out[0] = ch;
+            return 1;
         } else {
-            char tmp[16];
-            sprintf(tmp, "\\x%02x", (ch & 0xFF));
-            return tmp; 
+            out[0] = '\\';
+            out[1] = 'x';
+            out[2] = hex[ch >> 4];
+            out[3] = hex[ch & 0x0F];
+            return 4;
         }
     }
-    return "";
+    out[0] = '\\';
+    out[1] = simple;
+    return 2;
 }
 
 static void output_line(std::ostream& os, const uint8_t* buf, int len, CodegenContext &ctx) {
-    os << "\"";
+    std::string line;
+    line.reserve(len * 4 + 16);
+    line.push_back('"');
+    char str[4];
     for (int i = 0; i < len; i++) {
-        auto str = escape_char(buf[i]);
-        int cur_escape = (str.length() < 4)? 0 : 1;
+        int str_len = escape_char(buf[i], str);
+        // a hex escape would swallow the following hex digits, so split the literal
+        int cur_escape = (str_len < 4)? 0 : 1;
         if ((ctx.escape ^ cur_escape) != 0) {
             ctx.escape ^= 1;
-            os << "\" \"";
+            line.append("\" \"");
         }
-        os << str;
+        line.append(str, str_len);
     }
-    os << "\"" << std::endl;
+    line.push_back('"');
+    line.push_back('\n');
+    os.write(line.data(), line.length());
 }
 
-static int callback_data_entry_name(std::shared_ptr<RfsGenEntry>& entry, enum RfsGenTravelType type, void* ctx) {
-    if (ERFS_GEN_TRAVEL_ENTRY == type) {
-        CodegenContext* c = reinterpret_cast<CodegenContext*>(ctx);
-        entry->ordinal(c->ordinal);
-        entry->name_offset(c->offset);
-        
-        c->ordinal++;
-        c->offset += entry->name().length();
-        
-        const char* t = entry->is_directory() ? "D" : "F";
-        c->os << "    // " << t << "[" << entry->ordinal() << "]: "  << entry->path() << std::endl;
-        c->os << "  "; 
-        output_line(c->os, (uint8_t*)(entry->name().c_str()), entry->name().length(), *c); 
+/// bytes of the .data section, a string literal line or raw bytes of the blob
+static void output_data(CodegenContext &ctx, const uint8_t* buf, int len) {
+    if (ctx.blob != nullptr) {
+        ctx.blob->write(reinterpret_cast<const char*>(buf), len);
+        return;
     }
-    return 0;
+    ctx.os << "  ";
+    output_line(ctx.os, buf, len, ctx);
 }
 
-#include "gzip_file.h"
-static int callback_data_file_content (std::shared_ptr<RfsGenEntry>& entry, enum RfsGenTravelType type, void* ctx) {
-    if (ERFS_GEN_TRAVEL_ENTRY != type || entry->is_directory()) {
-        return 0;
-    }
+/// write the name of an entry
+static void data_entry_name(CodegenContext& ctx, RfsGenTree& tree, uint32_t i) {
+    RfsGenEntry& entry = tree.entries[i];
+    entry.name_offset = ctx.offset;
+    ctx.offset += entry.name_size;
 
-    CodegenContext* c = reinterpret_cast<CodegenContext*>(ctx);
-    c->os << "  // [" << entry->ordinal() << "]: "  << entry->path() << std::endl;
+    if (ctx.blob == nullptr) {
+        const char* t = tree.is_directory(i) ? "D" : "F";
+        ctx.os << "    // " << t << "[" << i << "]: "  << tree.path(i) << std::endl;
+    }
+    output_data(ctx, (const uint8_t*)tree.names.data() + entry.name_pool, entry.name_size);
+}
 
-    fs::path pack_file;
+/// name of the codec flag of an entry
+static const char* codec_name(uint32_t flags) {
+    switch (flags & ERFS_CODEC_MASK) {
+    case ERFS_GZIPPED:
+        return "gzip";
+    case ERFS_ZSTD:
+        return "zstd";
+    case ERFS_LZ4:
+        return "lz4";
+    default:
+        return "none";
+    }
+}
 
-    fs::path source = entry->path();
-    bool gzipped = false;
+/// write the content of a file, or share the data of an identical one
+static void data_file_content(CodegenContext& ctx, RfsGenTree& tree, const Manifest& manifest, uint32_t i) {
+    RfsGenEntry& entry = tree.entries[i];
 
-    if(c->gzip) {
-        std::string gzname = source.filename();
-        gzname += ".gz";
-        fs::path dest = fs::temp_directory_path() / gzname;
+    // compressed by compress_files()
+    bool gzipped = (entry.flags & ERFS_CODEC_MASK) != 0;
+    fs::path pack_file = content_path(tree, manifest, i);
 
-        int ret = rfs_gzip_file(source.c_str(), dest.c_str());
-        if (ret == 0) {
-            gzipped = true;
-            pack_file = dest;
-            entry->flags(ERFS_GZIPPED);
-        } else {
-            pack_file = source;
-        }
+    std::vector<uint8_t> content;
+    read_content(pack_file, content);
+    if(gzipped) {
+        std::cout << "Compress file " << tree.path(i) << ", original size: " << entry.source_size << ", "
+            << codec_name(entry.flags) << " size: " << content.size() << std::endl;
     } else {
-        pack_file = source;
+        entry.crc32 = crc32(0, content.data(), content.size());
     }
 
+    // identical packed contents share the data
+    uint64_t hash = erfs_hash_path(content.data(), content.size(), 0);
+    auto range = ctx.contents.equal_range(hash);
+    for (auto it = range.first; !content.empty() && it != range.second; ++it) {
+        const RfsGenEntry& other = tree.entries[it->second];
+        std::vector<uint8_t> other_content;
+        if ((size_t)other.size == content.size() && other.data_offset % entry.align == 0
+                && read_content(content_path(tree, manifest, it->second), other_content) == 0
+                && other_content == content) {
+            if (ctx.blob == nullptr) {
+                ctx.os << "  // [" << i << "]: "  << tree.path(i) << ", same as [" << it->second << "]" << std::endl;
+            }
+            entry.data_offset = other.data_offset;
+            entry.size = other.size;
+            ctx.duplicate_files++;
+            ctx.duplicate_bytes += content.size();
+            return;
+        }
+    }
+    ctx.contents.emplace(hash, i);
 
-    entry->data_offset(c->offset);
-    entry->size(fs::file_size(pack_file));
-    c->offset += entry->size();
-
-    std::ifstream ifs(pack_file, std::ios::binary);
-    unsigned char buf[128];
-    int len;
-    while (true) {
-        ifs.read(reinterpret_cast<char*>(buf), 80);
-        len = ifs.gcount();
-        if(len <= 0) {
-            break;
+    if (ctx.blob == nullptr) {
+        ctx.os << "  // [" << i << "]: "  << tree.path(i) << std::endl;
+    }
+    // an empty file has nothing to use in place
+    uint64_t padding = content.empty() ? 0 : (entry.align - ctx.offset % entry.align) % entry.align;
+    if (padding > 0) {
+        static const uint8_t zeros[80] = {0};
+        ctx.offset += padding;
+        ctx.padding += padding;
+        for (; padding > 0; padding -= std::min<uint64_t>(80, padding)) {
+            output_data(ctx, zeros, std::min<uint64_t>(80, padding));
         }
-        c->os << "  ";
-        output_line(c->os, buf, len, *c);
     }
+    entry.data_offset = ctx.offset;
+    entry.size = content.size();
+    ctx.offset += entry.size;
 
-    if(gzipped) {
-        std::cout << "Compress file " << source << ", original size: " << fs::file_size(source) << ", gzipped size: " << entry->size() << std::endl;
-        // remove temp .gz file.
-        fs::remove(pack_file);
+    for (size_t pos = 0; pos < content.size(); pos += 80) {
+        size_t len = std::min<size_t>(80, content.size() - pos);
+        output_data(ctx, content.data() + pos, len);
     }
-    return 0;
 }
 
-static int callback_directory_entry (std::shared_ptr<RfsGenEntry>& entry, enum RfsGenTravelType type, void* ctx) {
-    if (ERFS_GEN_TRAVEL_ENTRY != type) {
-        return 0;
+/// read a whole file
+///@return 0 for success
+static int read_content(const fs::path& path, std::vector<uint8_t>& content) {
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+    if (!ifs) {
+        return -1;
     }
+    // the size of the opened file, without looking the path up again
+    content.resize(ifs.tellg());
+    ifs.seekg(0);
+    ifs.read(reinterpret_cast<char*>(content.data()), content.size());
+    return ((size_t)ifs.gcount() == content.size()) ? 0 : -1;
+}
 
-    CodegenContext* c = reinterpret_cast<CodegenContext*>(ctx);
-    if(c->first) {
-        c->first = false;
+/// write the {name_offset, name_length, data_offset, data_size, flags} initializer of an entry,
+/// in {..., data_offset_hi} if wide
+static void directory_entry(std::ostream& os, const RfsGenTree& tree, uint32_t i, bool wide) {
+    const RfsGenEntry& entry = tree.entries[i];
+    os  << "    // [" << i << "]: "  << tree.path(i) << std::endl
+        << (wide ? "    {{" : "    {")
+        // name
+        << entry.name_offset << ", " << entry.name_size
+        // directory: entries; file: content
+        << ", " << (uint32_t)entry.data_offset << ", " << entry.size;
+
+    if (tree.is_directory(i)) {
+        os  << ", ERFS_DIRECTORY";
     } else {
-        c->os << "," << std::endl;
-    }
-
-    if(entry->is_directory()) {
-        c->os << "    // [" << entry->ordinal() << "]: "  << entry->path() << std::endl
-            << "    {"
-            // name
-            <<  entry->name_offset() << ", " << entry->name().length() ;
-        // directory entries
-        auto dir = std::dynamic_pointer_cast<RfsGenDirectory>(entry);
-        if (dir->entries().size() > 0) {
-            c->os << ", " << dir->entries()[0]->ordinal() << ", " << dir->entries().size();
-        } else {
-            c->os << ", 0, 0";
+        directory_entry_codec(os, entry.flags);
+    }
+    if (wide) {
+        os << " | ERFS_WIDE}, " << (uint32_t)(entry.data_offset >> 32);
+    }
+    os << "}";
+}
+
+/// the flags of a file initializer
+static void directory_entry_codec(std::ostream& os, uint32_t flags) {
+    switch (flags & ERFS_CODEC_MASK) {
+    case ERFS_GZIPPED:
+        os << ", ERFS_GZIPPED";
+        break;
+    case ERFS_ZSTD:
+        os << ", ERFS_ZSTD";
+        break;
+    case ERFS_LZ4:
+        os << ", ERFS_LZ4";
+        break;
+    default:
+        os << ", 0";
+        break;
+    }
+    if ((flags & ERFS_CHUNKED) != 0) {
+        os << " | ERFS_CHUNKED";
+    }
+    if ((flags & ERFS_DICT) != 0) {
+        os << " | ERFS_DICT";
+    }
+}
+
+/// magic numbers of compressed formats: archives, images, audio, video and fonts
+struct CompressedMagic {
+    size_t offset;
+    const char* bytes;
+    size_t size;
+};
+static const CompressedMagic compressed_magics[] = {
+    {0, "\x1f\x8b", 2},                     // gzip, tgz
+    {0, "PK\x03\x04", 4},                   // zip, jar, apk, epub, docx
+    {0, "\x28\xb5\x2f\xfd", 4},             // zstd
+    {0, "\x04\x22\x4d\x18", 4},             // lz4 frame
+    {0, "\xfd" "7zXZ\0", 6},                // xz
+    {0, "BZh", 3},                          // bzip2
+    {0, "7z\xbc\xaf\x27\x1c", 6},           // 7z
+    {0, "Rar!\x1a\x07", 6},                 // rar
+    {0, "\x89PNG", 4},
+    {0, "\xff\xd8\xff", 3},                 // jpeg
+    {0, "GIF8", 4},
+    {8, "WEBP", 4},                         // RIFF container
+    {4, "ftyp", 4},                         // mp4, mov, heic, 3gp
+    {0, "\x1a\x45\xdf\xa3", 4},             // mkv, webm
+    {0, "OggS", 4},
+    {0, "fLaC", 4},
+    {0, "ID3", 3},                          // mp3
+    {0, "wOFF", 4},
+    {0, "wOF2", 4},
+};
+
+/// the sample has the magic number of a compressed format, or bytes of too high an entropy to compress
+static bool looks_compressed(const uint8_t* sample, size_t size) {
+    for (auto& m : compressed_magics) {
+        if (size >= m.offset + m.size && memcmp(sample + m.offset, m.bytes, m.size) == 0) {
+            return true;
         }
-        // FLAGS
-        c->os  << ", ERFS_DIRECTORY";
-        c->os  << "}";
-    } else {
-        c->os  << "    // [" << entry->ordinal() << "]: " << entry->path() << std::endl
-            << "    {"
-            // name
-            << entry->name_offset() << ", " << entry->name().length()
-            // content
-            << ", " << entry->data_offset() << ", " << entry->size();
-        // flags
-        if ((entry->flags() & ERFS_GZIPPED) != 0) {
-            c->os<< ", ERFS_GZIPPED";
-        } else {
-            c->os<< ", 0";
+    }
+
+    // order 0 entropy, in bits per byte
+    uint32_t counts[256] = {0};
+    for (size_t i = 0; i < size; i++) {
+        counts[sample[i]]++;
+    }
+    double entropy = 0;
+    for (auto c : counts) {
+        if (c > 0) {
+            double p = (double)c / size;
+            entropy -= p * std::log2(p);
         }
-        c->os<< "}";
     }
-    return 0;
+    return entropy > COMPRESS_MAX_ENTROPY;
+}
+
+///
+/// guess from the head of a file if it's worth compressing, cheaper than compressing it to find out:
+/// the magic number of a compressed format, the entropy of the bytes, then a trial compression.
+///@param source_size size of source
+///@param ratio the compressed size / original size a file must reach
+///@return false if the file should be stored as it is
+///
+static bool worth_compressing(const fs::path& source, uintmax_t source_size, double ratio) {
+    std::vector<uint8_t> sample(std::min<uintmax_t>(source_size, COMPRESS_SAMPLE_SIZE));
+    std::ifstream ifs(source, std::ios::binary);
+    ifs.read(reinterpret_cast<char*>(sample.data()), sample.size());
+    sample.resize(ifs.gcount());
+    if (sample.empty()) {
+        // the compression reports the error
+        return true;
+    }
+    if (looks_compressed(sample.data(), sample.size())) {
+        return false;
+    }
+
+    // a file no larger than the sample is compressed as fast as the trial
+    if (source_size <= sample.size()) {
+        return true;
+    }
+    uLongf size = compressBound(sample.size());
+    std::vector<uint8_t> trial(size);
+    if (compress2(trial.data(), &size, sample.data(), sample.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+        return true;
+    }
+    return (double)size / sample.size() <= ratio;
 }
 
-/// http://www.iana.org/assignments/media-types/media-types.xhtml
-static const std::set<std::string> gzip_blacklist = {
-    // compressed file
-    "arc",
-    "bz",
-    "bz2",
-    "epub",
-    "zip",
-    "jar",
-    "war",
-    "gz",
-    "tgz",
-    "rar",
-    "7z",
-    "apk",
-    
-    // media audio
-    "aac",
-    "flac",
-    "mp3",
-    "ogg",
-    "oga",
-    "weba",
-    
-    // media video
-    "avi",
-    "mpeg",
-    "webm",
-    "3gp",
-    "3g2",
-    "mp4",
-    "mkv",
-    
-    // media image
-    "bmp",
-    "jpg",
-    "jpeg",
-    "heic",
-    "ogv",
-    "ogx",
-    "png",
-    "tif",
-    "tiff",
-    "webp",
-    "gif"
-};
 
+///
+/// preference of --codec=auto among the codecs of about the same size, the lower the better:
+/// the decoders from the fastest, lz4 then zstd then gzip. a fixed order, not a measured time,
+/// so the choice, and the output, depend only on the content.
+///
+static int decode_rank(int codec) {
+    switch (codec) {
+    case ERFS_CODEC_LZ4:
+        return 0;
+    case ERFS_CODEC_ZSTD:
+        return 1;
+    default:
+        return 2;
+    }
+}
 
 ///
+/// compress a file with one of the codecs, see AUTO_CODEC_SIZE_SLACK if there are more than one.
+/// @param source_size size of source_path
+/// @param codecs ERFS_CODEC_* bits to choose from
+/// @param threshold files smaller than this are not compressed
+/// @param ratio the compressed size / original size to keep a compressed file
+/// @param codec [out] the codec of dest_path
 /// @return 0:success, -1:failed to open file to read; -2: failed to open file to write; -3: compress fail; -4: needn't compress
 ///
-static int rfs_gzip_file(const char* source_path, const char* dest_path) {
+static int rfs_compress_file(const char* source_path, uintmax_t source_size, const char* dest_path, int codecs,
+        uint32_t threshold, double ratio, const std::vector<uint8_t>* dict, int* codec) {
     int ret = 0;
 
     fs::path source(source_path);
     fs::path dest(dest_path);
-    int source_size = fs::file_size(source);
 
-    if (source_size < GZIP_FILE_SIZE_THRESHOLD) {
+    // with the dictionary, small files are worth it too
+    if ((dict == nullptr && source_size < threshold) || !worth_compressing(source, source_size, ratio)) {
         ret = ERFS_GZIP_COMPRESS_RATIO;
         return ret;
     }
 
-    auto ext = source.extension().string();
-    if (ext.length() > 0) {
-        // remove the leading '.'
-        ext = ext.substr(1);
+    struct Candidate {
+        int codec;
+        fs::path path;
+        uintmax_t size;
+    };
+    std::vector<Candidate> candidates;
+    for (int c : {ERFS_CODEC_GZIP, ERFS_CODEC_ZSTD, ERFS_CODEC_LZ4}) {
+        if ((codecs & c) == 0) {
+            continue;
+        }
+        fs::path path = dest;
+        path += "." + std::to_string(c);
+        if (dict != nullptr) {
+            ret = dict_file(source_path, path.c_str(), c, dict->data(), dict->size());
+        } else if (c == ERFS_CODEC_GZIP) {
+            ret = gzip_file(source_path, path.c_str());
+        } else if (c == ERFS_CODEC_ZSTD) {
+            ret = zstd_file(source_path, path.c_str());
+        } else {
+            ret = lz4_file(source_path, path.c_str());
+        }
+        if (ret != 0) {
+            fs::remove(path);
+            continue;
+        }
+        auto size = fs::file_size(path);
+        if ((double)size / source_size > ratio) {
+            fs::remove(path);
+            continue;
+        }
+        candidates.push_back({c, path, size});
+    }
+    if (candidates.empty()) {
+        return (ret != 0) ? ret : ERFS_GZIP_COMPRESS_RATIO;
     }
 
-    if (gzip_blacklist.find(ext) != gzip_blacklist.end()) {
-        ret = ERFS_GZIP_COMPRESS_RATIO;
-        return ret;
-    } 
-
-    ret = gzip_file(source_path, dest_path);
-    if (ret != 0) {
-        return ret;
+    size_t best = 0;
+    if (candidates.size() > 1) {
+        uintmax_t smallest = candidates[0].size;
+        for (const auto& c : candidates) {
+            smallest = std::min(smallest, c.size);
+        }
+        best = candidates.size();
+        for (size_t i = 0; i < candidates.size(); i++) {
+            if (candidates[i].size <= smallest * AUTO_CODEC_SIZE_SLACK && (best == candidates.size()
+                    || decode_rank(candidates[i].codec) < decode_rank(candidates[best].codec))) {
+                best = i;
+            }
+        }
     }
-    
-    int dest_size = fs::file_size(dest);
-    if (((float)dest_size) / ((float)source_size) > 0.8) {
-        ret = ERFS_GZIP_COMPRESS_RATIO;
-        fs::remove(dest);
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (i == best) {
+            fs::rename(candidates[i].path, dest);
+        } else {
+            fs::remove(candidates[i].path);
+        }
     }
-
-    return ret;
+    *codec = candidates[best].codec;
+    return 0;
 }
-
-
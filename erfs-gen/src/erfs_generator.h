@@ -1,15 +1,35 @@
 #pragma once
 
+#include <stdint.h>
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
 enum ErfsGenOption {
-    ERFS_GEN_GZIPPED          = 2,   // must be same as ERFS_GZIPPED
+    ERFS_GEN_GZIPPED          = 2,   // compress files with ErfsGenConfig.codec
     ERFS_GEN_RUST             = 4,
+    ERFS_GEN_HASH             = 8,   // perfect hash index on full paths
+    ERFS_GEN_BLOB             = 16,  // names and contents in a .bin file
+    ERFS_GEN_IMAGE            = 32,  // an image file for erfs_mount_file(), no source files
+    ERFS_GEN_EYTZINGER        = 64,  // hot lookup array, children in Eytzinger order
+    ERFS_GEN_WIDE             = 128, // 64-bit data offsets (ErfsEntry64), for more than 4GB of data
+    ERFS_GEN_CRC              = 256, // original size and CRC32 of files, see erfs_entryinfo()
+    ERFS_GEN_DICT             = 512, // compress small files with a dictionary trained on them
 };
 
 
+///
+/// codecs to compress files, must be same as the ERFSEntry flags
+///
+enum ErfsGenCodec {
+    ERFS_GEN_CODEC_GZIP       = 2,   // ERFS_GZIPPED
+    ERFS_GEN_CODEC_ZSTD       = 4,   // ERFS_ZSTD, if erfs_gen is built with zstd
+    ERFS_GEN_CODEC_LZ4        = 8,   // ERFS_LZ4, if erfs_gen is built with lz4
+    // per file, the fastest to decode among the smallest ones
+    ERFS_GEN_CODEC_AUTO       = ERFS_GEN_CODEC_GZIP | ERFS_GEN_CODEC_ZSTD | ERFS_GEN_CODEC_LZ4,
+};
+
 ///
 /// status code of access api
 ///
@@ -27,6 +47,48 @@ enum ErfsGenStatusCode {
     ERFS_INVALID_OPTION          = -103,
 };
 
+///
+/// alignment of the files matching a pattern
+///
+typedef struct {
+    // fnmatch() pattern on the path relative to the source, '*' matches '/' too, e.g. "*.bin" or "tables/*"
+    const char *pattern;
+    // power of two, up to 65536
+    uint32_t align;
+} ErfsGenAlign;
+
+///
+/// settings of the generator
+///
+typedef struct {
+    // ErfsGenOption bits
+    int options;
+    // number of compression workers, 0 for one per hardware thread
+    int jobs;
+    // ErfsGenCodec, used with ERFS_GEN_GZIPPED
+    int codec;
+    // compress files larger than this by independent blocks of this size, for erfs_pread(); 0 for whole files
+    uint32_t chunk_size;
+    // files smaller than this are stored as they are (512 by default)
+    uint32_t threshold;
+    // a compressed file is kept if compressed size / original size <= ratio (0.8 by default)
+    double ratio;
+    // the data of each file starts at a multiple of this, power of two up to 65536 (1 by default)
+    uint32_t align;
+    // files matching a rule are aligned to the first one, and stored as they are to be used in place
+    const ErfsGenAlign *align_rules;
+    uint32_t align_rule_count;
+    // paths relative to the source in the order they are accessed, e.g. at startup: their files, or the files
+    // under a directory, are placed first in the .data section in this order, the others follow in tree order
+    const char *const *profile;
+    uint32_t profile_count;
+} ErfsGenConfig;
+
+///
+/// fill the config with default settings
+///@param config the config to initialize
+void erfs_gen_config_init(ErfsGenConfig *config);
+
 ///
 /// generate ERFS source file
 ///@param path the directory or file to be embedded
@@ -35,6 +97,14 @@ enum ErfsGenStatusCode {
 ///@param target_dir target directory 
 int erfs_generate(const char *path, const char *id, int options, const char *target_dir);
 
+///
+/// generate ERFS source file
+///@param path the directory or file to be embedded
+///@param id identity of the FS, format: [a-z][a-z_0-9]*
+///@param config settings, initialized by erfs_gen_config_init()
+///@param target_dir target directory 
+int erfs_generate_config(const char *path, const char *id, const ErfsGenConfig *config, const char *target_dir);
+
 
 #if defined(__cplusplus)
 }
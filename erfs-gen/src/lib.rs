@@ -21,4 +21,30 @@ pub fn erfs_generate(path: &str, id: &str, options: i32, target_dir: &str) -> i3
     unsafe {
         erfs_gen_binding::erfs_generate(cpath.as_ptr(), cid.as_ptr(), options, ctarget.as_ptr())
     }
-}
\ No newline at end of file
+}
+
+/// settings of the generator, see `erfs_generator.h`
+pub use erfs_gen_binding::ErfsGenConfig;
+
+/// alignment of the files matching a pattern, see `ErfsGenConfig.align_rules`
+pub use erfs_gen_binding::ErfsGenAlign;
+
+/// default settings of the generator
+pub fn erfs_gen_config() -> ErfsGenConfig {
+    unsafe {
+        let mut config: ErfsGenConfig = std::mem::zeroed();
+        erfs_gen_binding::erfs_gen_config_init(&mut config);
+        config
+    }
+}
+
+/// generate c/rust code from a directory with the given settings
+pub fn erfs_generate_config(path: &str, id: &str, config: &ErfsGenConfig, target_dir: &str) -> i32 {
+    let cpath = CString::new(path.as_bytes()).expect("CString::new failed");
+    let cid = CString::new(id.as_bytes()).expect("CString::new failed");
+    let ctarget = CString::new(target_dir.as_bytes()).expect("CString::new failed");
+
+    unsafe {
+        erfs_gen_binding::erfs_generate_config(cpath.as_ptr(), cid.as_ptr(), config, ctarget.as_ptr())
+    }
+}
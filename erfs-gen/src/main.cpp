@@ -1,12 +1,32 @@
 #include "erfs_generator.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 void usage(const char* prog) {
     std::cout << "Usage: " << prog << " [options] <src_dir> <id> <dest_dir>" << std::endl;
     std::cout << "Options:" << std::endl;
     std::cout << "  --gzip      compress file if needed." << std::endl;   
+    std::cout << "  --codec=C   compress file if needed, with codec C: gzip|zstd|lz4|auto (default gzip)." << std::endl; 
     std::cout << "  --rust      generate rust binding codes." << std::endl; 
+    std::cout << "  --hash      generate perfect hash index for full path lookup." << std::endl; 
+    std::cout << "  --chunk N   compress files larger than N bytes by blocks of N bytes, for random access." << std::endl; 
+    std::cout << "  --jobs N    compress files with N workers, 0 for one per CPU (default 1)." << std::endl; 
+    std::cout << "  --threshold N  don't compress files smaller than N bytes (default 512)." << std::endl; 
+    std::cout << "  --ratio R   keep a compressed file if compressed / original size <= R (default 0.8)." << std::endl; 
+    std::cout << "  --blob      write names and contents to erfs_<id>.bin, included by .incbin or #embed." << std::endl; 
+    std::cout << "  --image     write an image file erfs_<id>.img to be mounted at runtime, instead of source files." << std::endl; 
+    std::cout << "  --eytzinger generate cache friendly lookup array for large directories." << std::endl; 
+    std::cout << "  --wide      use 64-bit data offsets, for more than 4GB of names and contents." << std::endl; 
+    std::cout << "  --crc       store original size and CRC32 of files, read by erfs_entryinfo()." << std::endl; 
+    std::cout << "  --dict      compress small files with a dictionary trained on them, with --gzip/--codec." << std::endl; 
+    std::cout << "  --align N   start the data of each file at a multiple of N bytes, a power of two up to 65536, 4096 with --image." << std::endl; 
+    std::cout << "  --align P=N align the files matching the pattern P (e.g. '*.bin') to N, and store them uncompressed." << std::endl; 
+    std::cout << "  --profile F place the files listed in F first, one path per line in access order, e.g. at startup." << std::endl; 
 }
 
 int main(int argc, char** argv) {
@@ -17,7 +37,13 @@ int main(int argc, char** argv) {
     }
     const char* real_args[3] = {0};
     int pos = 0;
+    ErfsGenConfig config;
+    erfs_gen_config_init(&config);
     int option = 0;
+    // --align P=N, in order; the first matching pattern wins
+    std::vector<std::pair<std::string, uint32_t> > align_patterns;
+    // --profile F, paths in access order
+    std::vector<std::string> profile_paths;
     for(int i = 1; i < argc; i++) {
         char* arg = argv[i];
         if(*arg == '-') {
@@ -26,6 +52,73 @@ int main(int argc, char** argv) {
                 option |= ERFS_GEN_GZIPPED;
             } else if (strcmp("--rust", arg) == 0) {
                 option |= ERFS_GEN_RUST;            
+            } else if (strcmp("--hash", arg) == 0) {
+                option |= ERFS_GEN_HASH;
+            } else if (strcmp("--blob", arg) == 0) {
+                option |= ERFS_GEN_BLOB;
+            } else if (strcmp("--image", arg) == 0) {
+                option |= ERFS_GEN_IMAGE;
+            } else if (strcmp("--eytzinger", arg) == 0) {
+                option |= ERFS_GEN_EYTZINGER;
+            } else if (strcmp("--wide", arg) == 0) {
+                option |= ERFS_GEN_WIDE;
+            } else if (strcmp("--crc", arg) == 0) {
+                option |= ERFS_GEN_CRC;
+            } else if (strcmp("--dict", arg) == 0) {
+                option |= ERFS_GEN_DICT;
+            } else if (strncmp("--codec=", arg, 8) == 0) {
+                const char* codec = arg + 8;
+                option |= ERFS_GEN_GZIPPED;
+                if (strcmp("gzip", codec) == 0) {
+                    config.codec = ERFS_GEN_CODEC_GZIP;
+                } else if (strcmp("zstd", codec) == 0) {
+                    config.codec = ERFS_GEN_CODEC_ZSTD;
+                } else if (strcmp("lz4", codec) == 0) {
+                    config.codec = ERFS_GEN_CODEC_LZ4;
+                } else if (strcmp("auto", codec) == 0) {
+                    config.codec = ERFS_GEN_CODEC_AUTO;
+                } else {
+                    std::cout << "Unknown codec: " << codec << std::endl << std::endl;
+                    usage(argv[0]);
+                    return 2;
+                }
+            } else if (strcmp("--chunk", arg) == 0 && i + 1 < argc) {
+                i++;
+                config.chunk_size = strtoul(argv[i], nullptr, 10);
+            } else if (strcmp("--jobs", arg) == 0 && i + 1 < argc) {
+                i++;
+                config.jobs = atoi(argv[i]);
+            } else if (strcmp("--threshold", arg) == 0 && i + 1 < argc) {
+                i++;
+                config.threshold = strtoul(argv[i], nullptr, 10);
+            } else if (strcmp("--ratio", arg) == 0 && i + 1 < argc) {
+                i++;
+                config.ratio = strtod(argv[i], nullptr);
+            } else if (strcmp("--align", arg) == 0 && i + 1 < argc) {
+                i++;
+                const char* eq = strrchr(argv[i], '=');
+                if (eq != nullptr) {
+                    align_patterns.emplace_back(std::string(argv[i], eq - argv[i]), strtoul(eq + 1, nullptr, 10));
+                } else {
+                    config.align = strtoul(argv[i], nullptr, 10);
+                }
+            } else if (strcmp("--profile", arg) == 0 && i + 1 < argc) {
+                i++;
+                std::ifstream ifs(argv[i]);
+                if (!ifs) {
+                    std::cout << "Can't read the profile: " << argv[i] << std::endl;
+                    return 2;
+                }
+                // blank lines and '#' comments are skipped
+                std::string line;
+                while (std::getline(ifs, line)) {
+                    if (!line.empty() && line.back() == '\r') {
+                        line.pop_back();
+                    }
+                    if (!line.empty() && line[0] != '#') {
+                        profile_paths.push_back(line);
+                    }
+                }
             } else {
                 std::cout << "Unknown option: " << arg << std::endl << std::endl;
                 usage(argv[0]);
@@ -40,6 +133,24 @@ int main(int argc, char** argv) {
         usage(argv[0]);
         return 3;
     }
-    result = erfs_generate(real_args[0], real_args[1], option, real_args[2]);
+    config.options = option;
+    std::vector<ErfsGenAlign> align_rules;
+    for (auto& p : align_patterns) {
+        align_rules.push_back({p.first.c_str(), p.second});
+    }
+    config.align_rules = align_rules.data();
+    config.align_rule_count = align_rules.size();
+    std::vector<const char*> profile;
+    for (auto& p : profile_paths) {
+        profile.push_back(p.c_str());
+    }
+    config.profile = profile.data();
+    config.profile_count = profile.size();
+    result = erfs_generate_config(real_args[0], real_args[1], &config, real_args[2]);
+    if (result == ERFS_INVALID_OPTION) {
+        std::cout << "Invalid options, is the codec built in? is the ratio positive? is the alignment a power of two?" << std::endl;
+    } else if (result == ERFS_SOURCE_TOO_LARGE) {
+        std::cout << "Too large: a file of 4GB or more, or more than 4GB of data without --wide." << std::endl;
+    }
     return result;
 }
\ No newline at end of file
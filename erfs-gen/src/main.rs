@@ -1,13 +1,30 @@
 use std::env;
+use std::ffi::CString;
+use std::os::raw::c_char;
 
-use erfs_gen::erfs_generate;
+use erfs_gen::{erfs_gen_config, erfs_generate_config, ErfsGenAlign};
 
 fn usage () {
     let args: Vec<String> = env::args().collect();
     println!("Usage: {} [options] <src_dir> <id> <dest_dir>", args[0]);
     println!("Options:");
     println!("  --gzip      compress file if needed.");   
+    println!("  --codec=C   compress file if needed, with codec C: gzip|zstd|lz4|auto (default gzip).");
     println!("  --rust      generate rust binding codes.");     
+    println!("  --hash      generate perfect hash index for full path lookup.");
+    println!("  --chunk N   compress files larger than N bytes by blocks of N bytes, for random access.");
+    println!("  --jobs N    compress files with N workers, 0 for one per CPU (default 1).");
+    println!("  --threshold N  don't compress files smaller than N bytes (default 512).");
+    println!("  --ratio R   keep a compressed file if compressed / original size <= R (default 0.8).");
+    println!("  --blob      write names and contents to erfs_<id>.bin, included by .incbin or #embed.");
+    println!("  --image     write an image file erfs_<id>.img to be mounted at runtime, instead of source files.");
+    println!("  --eytzinger generate cache friendly lookup array for large directories.");
+    println!("  --wide      use 64-bit data offsets, for more than 4GB of names and contents.");
+    println!("  --crc       store original size and CRC32 of files, read by erfs_entryinfo().");
+    println!("  --dict      compress small files with a dictionary trained on them, with --gzip/--codec.");
+    println!("  --align N   start the data of each file at a multiple of N bytes, a power of two up to 65536.");
+    println!("  --align P=N align the files matching the pattern P (e.g. '*.bin') to N, and store them uncompressed.");
+    println!("  --profile F place the files listed in F first, one path per line in access order, e.g. at startup.");
 }
 
 
@@ -21,6 +38,11 @@ fn main() {
     let mut real_args: Vec<String> = Vec::new();
     let mut index = 1;
     let mut option = 0;
+    let mut config = erfs_gen_config();
+    // --align P=N, in order; the first matching pattern wins
+    let mut align_patterns: Vec<(CString, u32)> = Vec::new();
+    // --profile F, paths in access order
+    let mut profile_paths: Vec<CString> = Vec::new();
 
     while index < args.len() {
         let arg = &args[index];
@@ -29,6 +51,68 @@ fn main() {
                 option |= 2;
             } else if arg == ("--rust") {
                 option |= 4;
+            } else if arg == ("--hash") {
+                option |= 8;
+            } else if arg == ("--blob") {
+                option |= 16;
+            } else if arg == ("--image") {
+                option |= 32;
+            } else if arg == ("--eytzinger") {
+                option |= 64;
+            } else if arg == ("--wide") {
+                option |= 128;
+            } else if arg == ("--crc") {
+                option |= 256;
+            } else if arg == ("--dict") {
+                option |= 512;
+            } else if arg.starts_with("--codec=") {
+                option |= 2;
+                config.codec = match &arg[8..] {
+                    "gzip" => 2,
+                    "zstd" => 4,
+                    "lz4" => 8,
+                    "auto" => 14,
+                    codec => {
+                        println!("Unknown codec: {}", codec);
+                        usage();
+                        return;
+                    }
+                };
+            } else if arg == ("--chunk") && index + 1 < args.len() {
+                index = index + 1;
+                config.chunk_size = args[index].parse().unwrap_or(0);
+            } else if arg == ("--jobs") && index + 1 < args.len() {
+                index = index + 1;
+                config.jobs = args[index].parse().unwrap_or(1);
+            } else if arg == ("--threshold") && index + 1 < args.len() {
+                index = index + 1;
+                config.threshold = args[index].parse().unwrap_or(512);
+            } else if arg == ("--ratio") && index + 1 < args.len() {
+                index = index + 1;
+                config.ratio = args[index].parse().unwrap_or(0.8);
+            } else if arg == ("--align") && index + 1 < args.len() {
+                index = index + 1;
+                let value = &args[index];
+                match value.rfind('=') {
+                    Some(eq) => align_patterns.push((CString::new(&value[..eq]).expect("CString::new failed"),
+                        value[eq + 1..].parse().unwrap_or(0))),
+                    None => config.align = value.parse().unwrap_or(0),
+                }
+            } else if arg == ("--profile") && index + 1 < args.len() {
+                index = index + 1;
+                let text = match std::fs::read_to_string(&args[index]) {
+                    Ok(text) => text,
+                    Err(_) => {
+                        println!("Can't read the profile: {}", args[index]);
+                        return;
+                    }
+                };
+                // blank lines and '#' comments are skipped
+                for line in text.lines() {
+                    if !line.is_empty() && !line.starts_with('#') {
+                        profile_paths.push(CString::new(line).expect("CString::new failed"));
+                    }
+                }
             } else {
                 println!("Unknown option: {}", arg);
                 usage();
@@ -47,6 +131,15 @@ fn main() {
     }
 
     println!("{:?}, option: {}", real_args, option);
-    erfs_generate(&real_args[0], &real_args[1], option, &real_args[2]);
+    config.options = option;
+    let align_rules: Vec<ErfsGenAlign> = align_patterns.iter()
+        .map(|(pattern, align)| ErfsGenAlign { pattern: pattern.as_ptr(), align: *align })
+        .collect();
+    config.align_rules = align_rules.as_ptr();
+    config.align_rule_count = align_rules.len() as u32;
+    let profile: Vec<*const c_char> = profile_paths.iter().map(|p| p.as_ptr()).collect();
+    config.profile = profile.as_ptr();
+    config.profile_count = profile.len() as u32;
+    erfs_generate_config(&real_args[0], &real_args[1], &config, &real_args[2]);
     
 }
@@ -0,0 +1,353 @@
+#include "benchmark/benchmark.h"
+#include "resource_fs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+//
+// synthetic trees, generated into images by erfs_gen (ERFS_GEN_PATH) and mounted with erfs_mount_file().
+// Args: {tree, layout}
+//
+namespace {
+namespace fs = std::filesystem;
+
+enum BenchTree {
+    FLAT_1K,
+    FLAT_10K,
+    FLAT_100K,
+    DEEP,
+    LONG_NAMES,
+    LONG_PATHS,
+    TREE_COUNT,
+};
+
+enum BenchLayout {
+    LAYOUT_SORTED,      // binary search
+    LAYOUT_EYTZINGER,   // --eytzinger
+    LAYOUT_HASH,        // --hash
+    LAYOUT_COUNT,
+};
+
+const char* tree_names[] = {"flat1k", "flat10k", "flat100k", "deep", "longnames", "longpaths"};
+const char* layout_names[] = {"sorted", "eytzinger", "hash"};
+const char* layout_options[] = {"", "--eytzinger", "--hash"};
+
+// depth of the DEEP tree, each level has DEEP_FILES files and the next level
+#define DEEP_LEVELS         32
+#define DEEP_FILES          8
+// paths per erfs_open_many() call
+#define OPEN_MANY_BATCH     256
+// files in the LONG_NAMES tree
+#define LONG_NAME_FILES     10000
+#define LONG_NAME_SIZE      200
+// LONG_PATHS: paths of 90-100 bytes sharing long prefixes, LONG_PATH_DIRS directories of LONG_PATH_FILES files
+#define LONG_PATH_PREFIX    "/resources/application_bundle_assets/textures"
+#define LONG_PATH_DIRS      20
+#define LONG_PATH_FILES     500
+
+/// a mounted image, with its paths in random order
+struct BenchImage {
+    ErfsRoot root = nullptr;
+    std::vector<std::string> files;
+    std::vector<std::string> missing;
+    // the directory with most entries
+    std::string big_dir;
+};
+
+fs::path bench_dir() {
+    static fs::path dir;
+    if (dir.empty()) {
+        std::string tmpl = (fs::temp_directory_path() / "erfs_bench_XXXXXX").string();
+        if (mkdtemp(&tmpl[0]) == nullptr) {
+            perror("mkdtemp");
+            exit(1);
+        }
+        dir = tmpl;
+        atexit([]() {
+            std::error_code ec;
+            fs::remove_all(dir, ec);
+        });
+    }
+    return dir;
+}
+
+void write_file(const fs::path& path, std::vector<std::string>& files, const std::string& rel) {
+    std::ofstream ofs(path, std::ios::binary);
+    ofs << "content of " << rel << std::endl;
+    files.push_back(rel);
+}
+
+/// create the source tree, and list its files
+void build_tree(int tree, BenchImage& image) {
+    fs::path dir = bench_dir() / tree_names[tree];
+    fs::create_directories(dir);
+
+    switch (tree) {
+    case FLAT_1K:
+    case FLAT_10K:
+    case FLAT_100K: {
+        int n = (tree == FLAT_1K) ? 1000 : (tree == FLAT_10K) ? 10000 : 100000;
+        fs::create_directories(dir / "d");
+        for (int i = 0; i < n; i++) {
+            std::string name = "file_" + std::to_string(i) + ".txt";
+            write_file(dir / "d" / name, image.files, "/d/" + name);
+            image.missing.push_back("/d/file_" + std::to_string(i) + ".tx");
+        }
+        image.big_dir = "/d";
+        break;
+    }
+    case DEEP: {
+        fs::path level = dir;
+        std::string rel;
+        for (int l = 0; l < DEEP_LEVELS; l++) {
+            for (int i = 0; i < DEEP_FILES; i++) {
+                std::string name = "f" + std::to_string(i);
+                write_file(level / name, image.files, rel + "/" + name);
+                image.missing.push_back(rel + "/g" + std::to_string(i));
+            }
+            level /= "level" + std::to_string(l);
+            rel += "/level" + std::to_string(l);
+            fs::create_directories(level);
+        }
+        image.big_dir = "/";
+        break;
+    }
+    case LONG_NAMES: {
+        // names only differ at the end
+        std::string prefix(LONG_NAME_SIZE - 8, 'n');
+        for (int i = 0; i < LONG_NAME_FILES; i++) {
+            char suffix[16];
+            snprintf(suffix, sizeof(suffix), "%08d", i);
+            write_file(dir / (prefix + suffix), image.files, "/" + prefix + suffix);
+            image.missing.push_back("/" + prefix + suffix + "x");
+        }
+        image.big_dir = "/";
+        break;
+    }
+    case LONG_PATHS: {
+        for (int d = 0; d < LONG_PATH_DIRS; d++) {
+            std::string rel = LONG_PATH_PREFIX "/level_" + std::to_string(d);
+            fs::create_directories(dir / rel.substr(1));
+            for (int i = 0; i < LONG_PATH_FILES; i++) {
+                std::string name = "character_model_variant_" + std::to_string(i) + "_diffuse.png";
+                write_file(dir / rel.substr(1) / name, image.files, rel + "/" + name);
+                image.missing.push_back(rel + "/character_model_variant_" + std::to_string(i) + "_diffuse.jpg");
+            }
+        }
+        image.big_dir = LONG_PATH_PREFIX "/level_0";
+        break;
+    }
+    }
+}
+
+BenchImage& get_image(int tree, int layout) {
+    static std::map<std::pair<int, int>, std::unique_ptr<BenchImage> > images;
+    auto& image = images[{tree, layout}];
+    if (image) {
+        return *image;
+    }
+    image.reset(new BenchImage());
+
+    // the tree is created once for all layouts
+    static std::map<int, BenchImage> trees;
+    if (trees.find(tree) == trees.end()) {
+        build_tree(tree, trees[tree]);
+    }
+    BenchImage& source = trees[tree];
+    image->files = source.files;
+    image->missing = source.missing;
+    image->big_dir = source.big_dir;
+    std::mt19937 rng(tree);
+    std::shuffle(image->files.begin(), image->files.end(), rng);
+    std::shuffle(image->missing.begin(), image->missing.end(), rng);
+
+    std::string id = std::string(tree_names[tree]) + "_" + layout_names[layout];
+    fs::path src = bench_dir() / tree_names[tree];
+    std::string command = std::string(ERFS_GEN_PATH) + " --image " + layout_options[layout] + " "
+        + src.string() + " " + id + " " + bench_dir().string() + " > /dev/null";
+    if (std::system(command.c_str()) != 0) {
+        fprintf(stderr, "erfs_gen failed: %s\n", command.c_str());
+        exit(1);
+    }
+    fs::path img = bench_dir() / ("erfs_" + id + ".img");
+    if (erfs_mount_file(img.c_str(), &image->root) != ERFS_OK) {
+        fprintf(stderr, "mount failed: %s\n", img.c_str());
+        exit(1);
+    }
+    return *image;
+}
+
+void set_label(benchmark::State& state) {
+    state.SetLabel(std::string(tree_names[state.range(0)]) + "/" + layout_names[state.range(1)]);
+}
+
+void BM_open_hit(benchmark::State& state) {
+    BenchImage& image = get_image(state.range(0), state.range(1));
+    size_t i = 0;
+    for (auto _ : state) {
+        const std::string& path = image.files[i];
+        ErfsHandle handle;
+        uint32_t size;
+        int result = erfs_open(image.root, (const uint8_t *)path.data(), path.length(), &handle, &size);
+        benchmark::DoNotOptimize(result);
+        benchmark::DoNotOptimize(handle);
+        i = (i + 1 == image.files.size()) ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+    set_label(state);
+}
+
+void BM_open_miss(benchmark::State& state) {
+    BenchImage& image = get_image(state.range(0), state.range(1));
+    size_t i = 0;
+    for (auto _ : state) {
+        const std::string& path = image.missing[i];
+        ErfsHandle handle;
+        uint32_t size;
+        int result = erfs_open(image.root, (const uint8_t *)path.data(), path.length(), &handle, &size);
+        benchmark::DoNotOptimize(result);
+        i = (i + 1 == image.missing.size()) ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+    set_label(state);
+}
+
+void BM_open_many(benchmark::State& state) {
+    BenchImage& image = get_image(state.range(0), state.range(1));
+    std::vector<const uint8_t *> paths;
+    std::vector<uint32_t> lens;
+    for (auto& path : image.files) {
+        paths.push_back((const uint8_t *)path.data());
+        lens.push_back(path.length());
+    }
+    std::vector<ErfsHandle> handles(OPEN_MANY_BATCH);
+    std::vector<uint32_t> sizes(OPEN_MANY_BATCH);
+    std::vector<int> status(OPEN_MANY_BATCH);
+    size_t i = 0;
+    int64_t opened = 0;
+    for (auto _ : state) {
+        uint32_t n = std::min<size_t>(OPEN_MANY_BATCH, paths.size() - i);
+        int result = erfs_open_many(image.root, paths.data() + i, lens.data() + i, n, handles.data(), sizes.data(), status.data());
+        benchmark::DoNotOptimize(result);
+        benchmark::DoNotOptimize(handles.data());
+        opened += n;
+        i = (i + n == paths.size()) ? 0 : i + n;
+    }
+    // paths per second, to compare with BM_open_hit
+    state.SetItemsProcessed(opened);
+    set_label(state);
+}
+
+void BM_read(benchmark::State& state) {
+    BenchImage& image = get_image(state.range(0), state.range(1));
+    size_t i = 0;
+    uint64_t bytes = 0;
+    for (auto _ : state) {
+        const std::string& path = image.files[i];
+        const uint8_t *data;
+        uint32_t size;
+        erfs_read(image.root, (const uint8_t *)path.data(), path.length(), &data, &size);
+        // touch the content, it's paged in on demand
+        benchmark::DoNotOptimize(data[0]);
+        bytes += size;
+        i = (i + 1 == image.files.size()) ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(bytes);
+    set_label(state);
+}
+
+void BM_readdir(benchmark::State& state) {
+    BenchImage& image = get_image(state.range(0), state.range(1));
+    ErfsHandle dir;
+    uint32_t count;
+    erfs_open(image.root, (const uint8_t *)image.big_dir.data(), image.big_dir.length(), &dir, &count);
+    uint32_t i = 0;
+    for (auto _ : state) {
+        ErfsHandle entry;
+        int result = erfs_readdir(image.root, dir, i, &entry);
+        benchmark::DoNotOptimize(result);
+        benchmark::DoNotOptimize(entry);
+        i = (i + 1 == count) ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+    set_label(state);
+}
+
+extern "C" int count_callback(const ErfsRoot, const ErfsHandle, enum ErfsTravelType, void* ctx) {
+    (*reinterpret_cast<uint64_t*>(ctx))++;
+    return 0;
+}
+
+extern "C" int atomic_count_callback(const ErfsRoot, const ErfsHandle, enum ErfsTravelType, void* ctx) {
+    reinterpret_cast<std::atomic<uint64_t>*>(ctx)->fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+void BM_travel(benchmark::State& state) {
+    BenchImage& image = get_image(state.range(0), state.range(1));
+    uint64_t visited = 0;
+    for (auto _ : state) {
+        erfs_travel(image.root, count_callback, &visited);
+    }
+    // entries per second
+    state.SetItemsProcessed(visited);
+    set_label(state);
+}
+
+void BM_travel_parallel(benchmark::State& state) {
+    BenchImage& image = get_image(state.range(0), LAYOUT_SORTED);
+    std::atomic<uint64_t> visited(0);
+    for (auto _ : state) {
+        erfs_travel_parallel(image.root, state.range(1), atomic_count_callback, &visited);
+    }
+    state.SetItemsProcessed(visited.load());
+    state.SetLabel(std::string(tree_names[state.range(0)]) + "/" + std::to_string(state.range(1)) + " threads");
+}
+
+void tree_args(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"tree", "layout"});
+    for (int tree = 0; tree < TREE_COUNT; tree++) {
+        for (int layout = 0; layout < LAYOUT_COUNT; layout++) {
+            b->Args({tree, layout});
+        }
+    }
+}
+
+void sorted_args(benchmark::internal::Benchmark* b) {
+    // readdir and travel don't depend on the lookup layout
+    b->ArgNames({"tree", "layout"});
+    for (int tree = 0; tree < TREE_COUNT; tree++) {
+        b->Args({tree, LAYOUT_SORTED});
+    }
+}
+
+void thread_args(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"tree", "threads"});
+    for (int tree = 0; tree < TREE_COUNT; tree++) {
+        for (int threads : {1, 2, 4}) {
+            b->Args({tree, threads});
+        }
+    }
+}
+
+BENCHMARK(BM_open_hit)->Apply(tree_args);
+BENCHMARK(BM_open_miss)->Apply(tree_args);
+BENCHMARK(BM_open_many)->Apply(tree_args);
+BENCHMARK(BM_read)->Apply(tree_args);
+BENCHMARK(BM_readdir)->Apply(sorted_args);
+BENCHMARK(BM_travel)->Apply(sorted_args);
+BENCHMARK(BM_travel_parallel)->Apply(thread_args);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -4,13 +4,26 @@ use std::env;
 fn build_c_rt() {
     let src = [
         "src/resource_fs.c",
+        "src/resource_decode.c",
+        "src/resource_mount.c",
+        "src/resource_stream.c",
+        "src/resource_travel.c",
+        "src/resource_file.c",
+        "src/resource_stats.c",
     ];
     let mut builder = cc::Build::new();
     let build = builder
         .files(src.iter())
         .include("src")
         ;
+    // access statistics, see erfs_stats_dump()
+    if env::var("CARGO_FEATURE_STATS").is_ok() {
+        build.define("ERFS_STATS", None);
+    }
     build.compile("erfs_c_rt");  
+
+    // inflate of ERFS_GZIPPED entries
+    println!("cargo:rustc-link-lib=z");
 }
 
 #[allow(dead_code)]
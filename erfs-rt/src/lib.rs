@@ -8,6 +8,7 @@
 #[allow(non_upper_case_globals)]
 mod erfs_binding;
 
+use std::io;
 use std::slice;
 
 /// handle of a ERFS instance, returned by the generated codes.
@@ -54,6 +55,26 @@ pub fn open(fs: ErfsRoot, path: &str) -> Result<(ErfsHandle, u32), i32> {
     }  
 }
 
+/// get directory entry handles of many pathnames at once, the same results as `open` on each one.
+pub fn open_many(fs: ErfsRoot, paths: &[&str]) -> Result<Vec<Result<(ErfsHandle, u32), i32>>, i32> {
+    let n = paths.len();
+    let ptrs: Vec<*const u8> = paths.iter().map(|p| p.as_ptr()).collect();
+    let lens: Vec<u32> = paths.iter().map(|p| p.len() as u32).collect();
+    let mut handles: Vec<ErfsHandle> = vec![0 as ErfsHandle; n];
+    let mut sizes: Vec<u32> = vec![0; n];
+    let mut status: Vec<i32> = vec![0; n];
+
+    let ret :i32;
+    unsafe { 
+        ret = erfs_binding::erfs_open_many(fs, ptrs.as_ptr(), lens.as_ptr(), n as u32,
+            handles.as_mut_ptr(), sizes.as_mut_ptr(), status.as_mut_ptr());
+    }
+    if ret != 0 {
+        return Err(ret);
+    }
+    Ok((0..n).map(|i| if status[i] == 0 { Ok((handles[i], sizes[i])) } else { Err(status[i]) }).collect())
+}
+
 /// get flags of the specified directory entry.
 pub fn entry_flags(entry: ErfsHandle) -> Result<u32, i32> {
     let mut flags :u32 = 0;
@@ -69,6 +90,53 @@ pub fn entry_flags(entry: ErfsHandle) -> Result<u32, i32> {
     }
 }
 
+/// get codec of the specified file: ERFS_GZIPPED, ERFS_ZSTD, ERFS_LZ4 or 0.
+pub fn entry_codec(entry: ErfsHandle) -> Result<u32, i32> {
+    let mut codec :u32 = 0;
+    let pcodec = &mut codec as *mut u32;
+    let ret:i32;
+    unsafe { 
+        ret = erfs_binding::erfs_entrycodec(entry, pcodec);
+    }
+    if ret == 0 {
+        Ok(codec)
+    } else {
+        Err(ret as i32)
+    }
+}
+
+/// get the decoded size and CRC32 of the specified file, if generated with `--crc`.
+pub fn entry_info(fs: ErfsRoot, entry: ErfsHandle) -> Result<(u32, u32), i32> {
+    let mut size :u32 = 0;
+    let mut crc :u32 = 0;
+    let psize = &mut size as *mut u32;
+    let pcrc = &mut crc as *mut u32;
+    let ret:i32;
+    unsafe { 
+        ret = erfs_binding::erfs_entryinfo(fs, entry, psize, pcrc);
+    }
+    if ret == 0 {
+        Ok((size, crc))
+    } else {
+        Err(ret as i32)
+    }
+}
+
+/// get the alignment of the data of the specified file, see `--align`.
+pub fn entry_align(fs: ErfsRoot, entry: ErfsHandle) -> Result<u32, i32> {
+    let mut align :u32 = 0;
+    let palign = &mut align as *mut u32;
+    let ret:i32;
+    unsafe { 
+        ret = erfs_binding::erfs_entryalign(fs, entry, palign);
+    }
+    if ret == 0 {
+        Ok(align)
+    } else {
+        Err(ret as i32)
+    }
+}
+
 /// get size of the specified directory entry.
 pub fn entry_size(entry: ErfsHandle) -> Result<u32, i32> {
     let mut size :u32 = 0;
@@ -140,6 +208,170 @@ pub fn read_dir(fs: ErfsRoot, dir: ErfsHandle, index: u32) -> Result<ErfsHandle,
     } 
 }
 
+/// find the entries of a directory whose names start with `prefix`: (index of the first one for `read_dir`, count).
+pub fn find_prefix(fs: ErfsRoot, dir: ErfsHandle, prefix: &[u8]) -> Result<(u32, u32), i32> {
+    let mut first: u32 = 0;
+    let mut count: u32 = 0;
+    let ret :i32;
+    unsafe {
+        ret = erfs_binding::erfs_find_prefix(fs, dir, prefix.as_ptr(), prefix.len() as u32, &mut first, &mut count);
+    }
+    if ret == 0 {
+        Ok((first, count))
+    } else {
+        Err(ret)
+    }
+}
+
+extern "C" fn glob_collect(_fs: ErfsRoot, entry: ErfsHandle, path: *const u8, path_len: u32,
+        ctx: *mut ::std::os::raw::c_void) -> i32 {
+    unsafe {
+        let found = &mut *(ctx as *mut Vec<(ErfsHandle, Vec<u8>)>);
+        found.push((entry, slice::from_raw_parts(path, path_len as usize).to_vec()));
+    }
+    0
+}
+
+/// find the entries matching a pattern like "/templates/**/*.html": (handle, path from the root).
+pub fn glob(fs: ErfsRoot, pattern: &str) -> Result<Vec<(ErfsHandle, Vec<u8>)>, i32> {
+    let mut found: Vec<(ErfsHandle, Vec<u8>)> = Vec::new();
+    let ret :i32;
+    unsafe {
+        ret = erfs_binding::erfs_glob(fs, pattern.as_ptr(), pattern.len() as u32, Some(glob_collect),
+            &mut found as *mut Vec<(ErfsHandle, Vec<u8>)> as *mut ::std::os::raw::c_void);
+    }
+    if ret == 0 {
+        Ok(found)
+    } else {
+        Err(ret)
+    }
+}
+
+/// mount an image file generated by `erfs_gen --image`.
+pub fn mount_file(path: &str) -> Result<ErfsRoot, i32> {
+    let cpath = match std::ffi::CString::new(path.as_bytes()) {
+        Ok(p) => p,
+        Err(_) => return Err(-1),
+    };
+    let mut root: ErfsRoot = 0 as ErfsRoot;
+    let proot = &mut root as *mut ErfsRoot;
+
+    let ret :i32;
+    unsafe { 
+        ret = erfs_binding::erfs_mount_file(cpath.as_ptr(), proot);
+    }
+    if ret == 0 {
+        Ok(root)
+    } else {
+        Err(ret)
+    } 
+}
+
+/// unmount a file system mounted by `mount_file`, contents read from it must not be used anymore.
+pub fn unmount(fs: ErfsRoot) -> Result<(), i32> {
+    let ret :i32;
+    unsafe { 
+        ret = erfs_binding::erfs_unmount(fs);
+    }
+    if ret == 0 {
+        Ok(())
+    } else {
+        Err(ret)
+    } 
+}
+
+/// copy the decoded content of a file to a sealed memfd (Linux), for the libraries taking a file only.
+pub fn memfd(fs: ErfsRoot, path: &str) -> Result<std::fs::File, i32> {
+    use std::os::unix::io::FromRawFd;
+    let mut fd: i32 = -1;
+    let pfd = &mut fd as *mut i32;
+    let ret :i32;
+    unsafe {
+        ret = erfs_binding::erfs_memfd(fs, path.as_ptr(), path.len() as u32, pfd);
+    }
+    if ret == 0 {
+        unsafe {
+            Ok(std::fs::File::from_raw_fd(fd))
+        }
+    } else {
+        Err(ret)
+    }
+}
+
+/// set the access statistics of a file system to zero, if the C runtime is built with the `stats` feature.
+pub fn stats_reset(fs: ErfsRoot) -> Result<(), i32> {
+    let ret :i32;
+    unsafe {
+        ret = erfs_binding::erfs_stats_reset(fs);
+    }
+    if ret == 0 {
+        Ok(())
+    } else {
+        Err(ret)
+    }
+}
+
+/// read a part of a file at `offset`, decoded if it has a codec.
+/// only the blocks needed are decoded for files generated with `--chunk`.
+pub fn pread(fs: ErfsRoot, entry: ErfsHandle, offset: u32, buf: &mut [u8]) -> Result<usize, i32> {
+    let len = std::cmp::min(buf.len(), u32::max_value() as usize) as u32;
+    let mut read: u32 = 0;
+    let ret :i32;
+    unsafe { 
+        ret = erfs_binding::erfs_pread(fs, entry, offset, buf.as_mut_ptr(), len, &mut read);
+    }
+    if ret == 0 {
+        Ok(read as usize)
+    } else {
+        Err(ret)
+    } 
+}
+
+/// a file read by pieces, decoded if it has a codec
+pub struct Stream {
+    stream: *mut erfs_binding::ErfsStream,
+}
+
+impl Stream {
+    /// open a file to be read by pieces
+    pub fn open(fs: ErfsRoot, entry: ErfsHandle) -> Result<Stream, i32> {
+        let mut stream: *mut erfs_binding::ErfsStream = std::ptr::null_mut();
+        let ret :i32;
+        unsafe { 
+            ret = erfs_binding::erfs_stream_open(fs, entry, &mut stream);
+        }
+        if ret == 0 {
+            Ok(Stream { stream })
+        } else {
+            Err(ret)
+        } 
+    }
+}
+
+impl io::Read for Stream {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        let size = std::cmp::min(buf.len(), u32::max_value() as usize) as u32;
+        let mut read: u32 = 0;
+        let ret :i32;
+        unsafe { 
+            ret = erfs_binding::erfs_stream_read(self.stream, buf.as_mut_ptr(), size, &mut read);
+        }
+        if ret == 0 {
+            Ok(read as usize)
+        } else {
+            Err(io::Error::new(io::ErrorKind::InvalidData, format!("erfs_stream_read: {}", ret)))
+        }
+    }
+}
+
+impl Drop for Stream {
+    fn drop(&mut self) {
+        unsafe { 
+            erfs_binding::erfs_stream_close(self.stream);
+        }
+    }
+}
+
 /*
 use erfs_binding::ErfsVisitFn;
 pub fn erfs_travel(fs: ErfsRoot, func: ErfsVisitFn, ctx: *mut ::std::os::raw::c_void) -> i32 {
@@ -0,0 +1,666 @@
+#define __ERFS_IMPL__
+#include "resource_fs.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zlib.h"
+#if defined(ERFS_WITH_ZSTD)
+#include <zstd.h>
+#endif
+#if defined(ERFS_WITH_LZ4)
+#include <lz4.h>
+#endif
+
+#define CHECK_NULL(V)       if(V == 0) {return ERFS_INVALID_INPUT;}
+
+// the cache is set associative: an entry can only live in one of the ways of its set,
+// so a lookup probes at most ERFS_CACHE_WAYS slots.
+#define ERFS_CACHE_WAYS             8
+#define ERFS_CACHE_SETS             512
+#define ERFS_CACHE_SLOTS            (ERFS_CACHE_WAYS * ERFS_CACHE_SETS)
+
+// default memory budget of the decoded contents
+#define ERFS_CACHE_DEFAULT_BUDGET   (1024 * 1024 * 64)
+
+// deflate doesn't expand a stream more than this, 258 bytes from a 2-bit code at best
+#define DEFLATE_MAX_EXPANSION       1032
+
+///
+/// a decoded file kept in the cache.
+///
+/// `pins` is the number of readers holding `data`, or -1 while the slot is
+/// filled/evicted by a writer. readers pin the slot with a CAS and never take
+/// the lock; writers hold `cache_lock` and only touch a slot after moving
+/// `pins` from 0 to -1.
+///
+typedef struct {
+    _Atomic(ErfsHandle) entry;
+    atomic_int pins;
+    atomic_int referenced;
+    // atomic only because erfs_release_decoded() compares it without pinning
+    _Atomic(uint8_t *) data;
+    uint32_t size;
+} ErfsCacheSlot;
+
+static ErfsCacheSlot cache_slots[ERFS_CACHE_SLOTS];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// guarded by cache_lock
+static uint64_t cache_budget = ERFS_CACHE_DEFAULT_BUDGET;
+static uint64_t cache_used = 0;
+static uint32_t cache_hand = 0;
+
+static uint32_t cache_set(ErfsHandle entry) {
+    uint64_t h = (uint64_t)(uintptr_t)entry;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(h >> 32) % ERFS_CACHE_SETS;
+}
+
+/// pin the slot caching `entry`, lock free.
+///@return the pinned slot, 0 if the entry isn't cached
+static ErfsCacheSlot* cache_pin(ErfsHandle entry) {
+    ErfsCacheSlot* set = cache_slots + cache_set(entry) * ERFS_CACHE_WAYS;
+    for (int i = 0; i < ERFS_CACHE_WAYS; i++) {
+        ErfsCacheSlot* slot = set + i;
+        if (atomic_load_explicit(&slot->entry, memory_order_relaxed) != entry) {
+            continue;
+        }
+        int pins = atomic_load_explicit(&slot->pins, memory_order_relaxed);
+        do {
+            if (pins < 0) {
+                // a writer owns the slot
+                return 0;
+            }
+        } while (!atomic_compare_exchange_weak_explicit(&slot->pins, &pins, pins + 1,
+                    memory_order_acquire, memory_order_relaxed));
+
+        // the slot may have been reused between the check and the pin
+        if (atomic_load_explicit(&slot->entry, memory_order_relaxed) == entry) {
+            atomic_store_explicit(&slot->referenced, 1, memory_order_relaxed);
+            return slot;
+        }
+        atomic_fetch_sub_explicit(&slot->pins, 1, memory_order_release);
+        return 0;
+    }
+    return 0;
+}
+
+/// take exclusive ownership of an unpinned slot, cache_lock must be held.
+static int cache_lock_slot(ErfsCacheSlot* slot) {
+    int pins = 0;
+    return atomic_compare_exchange_strong_explicit(&slot->pins, &pins, -1,
+                memory_order_acquire, memory_order_relaxed);
+}
+
+/// drop the content of a slot locked by cache_lock_slot, cache_lock must be held.
+static void cache_evict_locked(ErfsCacheSlot* slot) {
+    if (atomic_load_explicit(&slot->entry, memory_order_relaxed) != 0) {
+        cache_used -= slot->size;
+        free(atomic_load_explicit(&slot->data, memory_order_relaxed));
+        atomic_store_explicit(&slot->data, 0, memory_order_relaxed);
+        slot->size = 0;
+        atomic_store_explicit(&slot->entry, 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&slot->referenced, 0, memory_order_relaxed);
+}
+
+/// CLOCK eviction until `need` more bytes fit into the budget, cache_lock must be held.
+///@return 0 if there is enough room
+static int cache_reserve_locked(uint64_t need) {
+    // two rounds: the first one may only clear the referenced bits
+    for (int i = 0; i < 2 * ERFS_CACHE_SLOTS && cache_used + need > cache_budget; i++) {
+        ErfsCacheSlot* slot = cache_slots + cache_hand;
+        cache_hand = (cache_hand + 1) % ERFS_CACHE_SLOTS;
+
+        if (atomic_load_explicit(&slot->entry, memory_order_relaxed) == 0) {
+            continue;
+        }
+        if (atomic_exchange_explicit(&slot->referenced, 0, memory_order_relaxed) != 0) {
+            continue;
+        }
+        if (cache_lock_slot(slot)) {
+            cache_evict_locked(slot);
+            atomic_store_explicit(&slot->pins, 0, memory_order_release);
+        }
+    }
+    return (cache_used + need > cache_budget) ? -1 : 0;
+}
+
+/// insert decoded content of `entry` and pin it for the caller.
+///@return the pinned slot, 0 if it can't be cached (the caller keeps ownership of data)
+static ErfsCacheSlot* cache_insert(ErfsHandle entry, uint8_t **data, uint32_t size) {
+    ErfsCacheSlot* result = 0;
+
+    pthread_mutex_lock(&cache_lock);
+    // another thread may have decoded the same entry meanwhile
+    result = cache_pin(entry);
+    if (result != 0) {
+        free(*data);
+        *data = atomic_load_explicit(&result->data, memory_order_relaxed);
+        pthread_mutex_unlock(&cache_lock);
+        return result;
+    }
+
+    if (size > cache_budget || cache_reserve_locked(size) != 0) {
+        pthread_mutex_unlock(&cache_lock);
+        return 0;
+    }
+
+    ErfsCacheSlot* set = cache_slots + cache_set(entry) * ERFS_CACHE_WAYS;
+    // prefer an empty way, otherwise replace any unpinned one
+    for (int i = 0; i < ERFS_CACHE_WAYS && result == 0; i++) {
+        if (atomic_load_explicit(&set[i].entry, memory_order_relaxed) == 0 && cache_lock_slot(set + i)) {
+            result = set + i;
+        }
+    }
+    for (int i = 0; i < ERFS_CACHE_WAYS && result == 0; i++) {
+        if (cache_lock_slot(set + i)) {
+            result = set + i;
+            cache_evict_locked(result);
+        }
+    }
+
+    if (result != 0) {
+        atomic_store_explicit(&result->data, *data, memory_order_relaxed);
+        result->size = size;
+        cache_used += size;
+        atomic_store_explicit(&result->entry, entry, memory_order_relaxed);
+        atomic_store_explicit(&result->referenced, 1, memory_order_relaxed);
+        // publish, pinned once for the caller
+        atomic_store_explicit(&result->pins, 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return result;
+}
+
+///
+/// inflate a gzip or zlib stream.
+///@param dict preset dictionary of a zlib stream, 0 if none
+///@param out [out] malloc-ed buffer, owned by the caller
+///@return ERFS_OK for success
+///
+static int erfs_inflate(const uint8_t *src, uint32_t src_size, const uint8_t *dict, uint32_t dict_size,
+        uint8_t **out, uint32_t *out_size) {
+    uint64_t capacity;
+    if (src_size >= 18 && src[0] == 0x1f && src[1] == 0x8b) {
+        // gzip trailer: ISIZE, the original size modulo 2^32
+        const uint8_t *t = src + src_size - 4;
+        capacity = (uint32_t)t[0] | ((uint32_t)t[1] << 8) | ((uint32_t)t[2] << 16) | ((uint32_t)t[3] << 24);
+        // a corrupted trailer can't allocate more than deflate can expand to, the buffer grows if needed
+        if (capacity > (uint64_t)src_size * DEFLATE_MAX_EXPANSION) {
+            capacity = (uint64_t)src_size * DEFLATE_MAX_EXPANSION;
+        }
+    } else {
+        capacity = (uint64_t)src_size * 4;
+    }
+    if (capacity == 0) {
+        capacity = 1;
+    }
+
+    uint8_t *buf = (uint8_t *)malloc(capacity);
+    if (buf == 0) {
+        return ERFS_NO_MEMORY;
+    }
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    // 32: detect gzip or zlib header automatically
+    if (inflateInit2(&strm, 32 + MAX_WBITS) != Z_OK) {
+        free(buf);
+        return ERFS_DECODE_FAIL;
+    }
+    strm.next_in = (Bytef *)src;
+    strm.avail_in = src_size;
+
+    int ret;
+    for (;;) {
+        strm.next_out = buf + strm.total_out;
+        strm.avail_out = (uInt)(capacity - strm.total_out);
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+        if (ret == Z_NEED_DICT) {
+            // fails if the dictionary doesn't match the id in the header
+            ret = (dict != 0) ? inflateSetDictionary(&strm, dict, dict_size) : Z_DATA_ERROR;
+            if (ret == Z_OK) {
+                continue;
+            }
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            break;
+        }
+        if (strm.avail_out != 0) {
+            // no progress possible, truncated input
+            ret = Z_DATA_ERROR;
+            break;
+        }
+        uint64_t grow = capacity * 2;
+        if (grow > 0xFFFFFFFFULL) {
+            ret = Z_MEM_ERROR;
+            break;
+        }
+        uint8_t *tmp = (uint8_t *)realloc(buf, grow);
+        if (tmp == 0) {
+            ret = Z_MEM_ERROR;
+            break;
+        }
+        buf = tmp;
+        capacity = grow;
+    }
+    inflateEnd(&strm);
+
+    if (ret != Z_STREAM_END) {
+        free(buf);
+        return (ret == Z_MEM_ERROR) ? ERFS_NO_MEMORY : ERFS_DECODE_FAIL;
+    }
+    *out = buf;
+    *out_size = (uint32_t)strm.total_out;
+    return ERFS_OK;
+}
+
+#if defined(ERFS_WITH_ZSTD)
+///
+/// decode a zstd frame with the content size.
+///@param dict raw content dictionary, 0 if none
+///@param out [out] malloc-ed buffer, owned by the caller
+///@return ERFS_OK for success
+///
+static int erfs_unzstd(const uint8_t *src, uint32_t src_size, const uint8_t *dict, uint32_t dict_size,
+        uint8_t **out, uint32_t *out_size) {
+    unsigned long long size = ZSTD_getFrameContentSize(src, src_size);
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN || size > 0xFFFFFFFFULL) {
+        return ERFS_DECODE_FAIL;
+    }
+    uint8_t *buf = (uint8_t *)malloc((size > 0) ? size : 1);
+    if (buf == 0) {
+        return ERFS_NO_MEMORY;
+    }
+    size_t ret;
+    if (dict != 0) {
+        ZSTD_DCtx *dctx = ZSTD_createDCtx();
+        if (dctx == 0) {
+            free(buf);
+            return ERFS_NO_MEMORY;
+        }
+        ret = ZSTD_decompress_usingDict(dctx, buf, size, src, src_size, dict, dict_size);
+        ZSTD_freeDCtx(dctx);
+    } else {
+        ret = ZSTD_decompress(buf, size, src, src_size);
+    }
+    if (ZSTD_isError(ret) || ret != size) {
+        free(buf);
+        return ERFS_DECODE_FAIL;
+    }
+    *out = buf;
+    *out_size = (uint32_t)size;
+    return ERFS_OK;
+}
+#endif
+
+#if defined(ERFS_WITH_LZ4)
+///
+/// decode a lz4 block after the original size (4 bytes, little endian).
+///@param dict dictionary, 0 if none
+///@param out [out] malloc-ed buffer, owned by the caller
+///@return ERFS_OK for success
+///
+static int erfs_unlz4(const uint8_t *src, uint32_t src_size, const uint8_t *dict, uint32_t dict_size,
+        uint8_t **out, uint32_t *out_size) {
+    if (src_size < 4 || src_size - 4 > LZ4_MAX_INPUT_SIZE) {
+        return ERFS_DECODE_FAIL;
+    }
+    uint32_t size = (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+    if (size > 0x7FFFFFFF) {
+        return ERFS_DECODE_FAIL;
+    }
+    uint8_t *buf = (uint8_t *)malloc((size > 0) ? size : 1);
+    if (buf == 0) {
+        return ERFS_NO_MEMORY;
+    }
+    int ret = (dict != 0)
+        ? LZ4_decompress_safe_usingDict((const char *)src + 4, (char *)buf, (int)(src_size - 4), (int)size,
+            (const char *)dict, (int)dict_size)
+        : LZ4_decompress_safe((const char *)src + 4, (char *)buf, (int)(src_size - 4), (int)size);
+    if (ret != (int)size) {
+        free(buf);
+        return ERFS_DECODE_FAIL;
+    }
+    *out = buf;
+    *out_size = size;
+    return ERFS_OK;
+}
+#endif
+
+static uint32_t erfs_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+///
+/// decode a block of an ERFS_CHUNKED file, it must fill `dst` exactly.
+/// a block as large as its content is stored as it is.
+///@return ERFS_OK for success
+///
+static int erfs_decode_block(uint32_t codec, const uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size) {
+    if (src_size == dst_size) {
+        memcpy(dst, src, dst_size);
+        return ERFS_OK;
+    }
+    switch (codec) {
+    case ERFS_GZIPPED: {
+        z_stream strm;
+        memset(&strm, 0, sizeof(strm));
+        if (inflateInit2(&strm, 32 + MAX_WBITS) != Z_OK) {
+            return ERFS_NO_MEMORY;
+        }
+        strm.next_in = (Bytef *)src;
+        strm.avail_in = src_size;
+        strm.next_out = dst;
+        strm.avail_out = dst_size;
+        int ret = inflate(&strm, Z_FINISH);
+        inflateEnd(&strm);
+        return (ret == Z_STREAM_END && strm.total_out == dst_size) ? ERFS_OK : ERFS_DECODE_FAIL;
+    }
+#if defined(ERFS_WITH_ZSTD)
+    case ERFS_ZSTD:
+        return (ZSTD_decompress(dst, dst_size, src, src_size) == dst_size) ? ERFS_OK : ERFS_DECODE_FAIL;
+#endif
+#if defined(ERFS_WITH_LZ4)
+    case ERFS_LZ4:
+        // the size of a block is known, there is no size prefix
+        if (src_size > LZ4_MAX_INPUT_SIZE || dst_size > 0x7FFFFFFF) {
+            return ERFS_DECODE_FAIL;
+        }
+        return (LZ4_decompress_safe((const char *)src, (char *)dst, (int)src_size, (int)dst_size) == (int)dst_size)
+            ? ERFS_OK : ERFS_DECODE_FAIL;
+#endif
+    default:
+        return ERFS_UNSUPPORTED_CODEC;
+    }
+}
+
+///
+/// the block index of an ERFS_CHUNKED file
+///
+typedef struct {
+    uint32_t size;
+    uint32_t chunk_size;
+    uint32_t count;
+    const uint8_t *data;
+    uint32_t data_size;
+} ErfsChunks;
+
+static int erfs_chunks(const ErfsRoot fs, const ErfsHandle handle, ErfsChunks *chunks) {
+    const uint8_t *data = fs->data + erfs_data_offset(handle);
+    if (handle->data_size < 12) {
+        return ERFS_DECODE_FAIL;
+    }
+    chunks->size = erfs_le32(data);
+    chunks->chunk_size = erfs_le32(data + 4);
+    chunks->count = erfs_le32(data + 8);
+    chunks->data = data;
+    chunks->data_size = handle->data_size;
+    if (chunks->chunk_size == 0
+            || chunks->count != chunks->size / chunks->chunk_size + (chunks->size % chunks->chunk_size != 0)
+            || (handle->data_size - 12) / 4 < (uint64_t)chunks->count + 1) {
+        return ERFS_DECODE_FAIL;
+    }
+    return ERFS_OK;
+}
+
+/// decode block `i` into `dst`, of min(chunk_size, rest of the file) bytes
+static int erfs_chunk_decode(uint32_t codec, const ErfsChunks *chunks, uint32_t i, uint8_t *dst) {
+    const uint8_t *offsets = chunks->data + 12;
+    uint32_t begin = erfs_le32(offsets + 4 * i);
+    uint32_t end = erfs_le32(offsets + 4 * (i + 1));
+    if (begin < 12 + 4 * (chunks->count + 1) || begin > end || end > chunks->data_size) {
+        return ERFS_DECODE_FAIL;
+    }
+    uint32_t rest = chunks->size - i * chunks->chunk_size;
+    uint32_t size = (rest < chunks->chunk_size) ? rest : chunks->chunk_size;
+    return erfs_decode_block(codec, chunks->data + begin, end - begin, dst, size);
+}
+
+/// decode a whole ERFS_CHUNKED file
+static int erfs_decode_chunked(const ErfsRoot fs, const ErfsHandle handle, uint8_t **out, uint32_t *out_size) {
+    ErfsChunks chunks;
+    int result = erfs_chunks(fs, handle, &chunks);
+    if (result != ERFS_OK) {
+        return result;
+    }
+    uint8_t *buf = (uint8_t *)malloc((chunks.size > 0) ? chunks.size : 1);
+    if (buf == 0) {
+        return ERFS_NO_MEMORY;
+    }
+    for (uint32_t i = 0; i < chunks.count && result == ERFS_OK; i++) {
+        result = erfs_chunk_decode(handle->flags & ERFS_CODEC_MASK, &chunks, i, buf + i * chunks.chunk_size);
+    }
+    if (result != ERFS_OK) {
+        free(buf);
+        return result;
+    }
+    *out = buf;
+    *out_size = chunks.size;
+    return ERFS_OK;
+}
+
+///
+/// decode a file with the codec in its flags.
+///@param out [out] malloc-ed buffer, owned by the caller
+///@return ERFS_OK for success; ERFS_UNSUPPORTED_CODEC if the codec is not built in
+///
+static int erfs_decode(const ErfsRoot fs, const ErfsHandle handle, uint8_t **out, uint32_t *out_size) {
+    uint32_t flags = handle->flags;
+    const uint8_t *src = fs->data + erfs_data_offset(handle);
+    uint32_t src_size = handle->data_size;
+    if ((flags & ERFS_CHUNKED) != 0) {
+        return erfs_decode_chunked(fs, handle, out, out_size);
+    }
+    const uint8_t *dict = 0;
+    if ((flags & ERFS_DICT) != 0) {
+        if (fs->dict_size == 0) {
+            return ERFS_DECODE_FAIL;
+        }
+        dict = fs->data + fs->dict_offset;
+    }
+    switch (flags & ERFS_CODEC_MASK) {
+    case ERFS_GZIPPED:
+        return erfs_inflate(src, src_size, dict, fs->dict_size, out, out_size);
+#if defined(ERFS_WITH_ZSTD)
+    case ERFS_ZSTD:
+        return erfs_unzstd(src, src_size, dict, fs->dict_size, out, out_size);
+#endif
+#if defined(ERFS_WITH_LZ4)
+    case ERFS_LZ4:
+        return erfs_unlz4(src, src_size, dict, fs->dict_size, out, out_size);
+#endif
+    default:
+        return ERFS_UNSUPPORTED_CODEC;
+    }
+}
+
+/// read a regular file, decompressed if it has a codec
+///@param fs the file system
+///@param handle the file
+///@param out pointer to the decoded content, valid until erfs_release_decoded()
+///@param size decoded size
+///@return ERFS_OK for success
+int erfs_read_decoded(const ErfsRoot fs, const ErfsHandle handle, const uint8_t **out, uint32_t *size) {
+    CHECK_NULL(fs);
+    CHECK_NULL(handle);
+    CHECK_NULL(out);
+    CHECK_NULL(size);
+    if ((handle->flags & ERFS_DIRECTORY) != 0) {
+        return ERFS_NOT_FILE;
+    }
+    if ((handle->flags & ERFS_CODEC_MASK) == 0) {
+        *out = fs->data + erfs_data_offset(handle);
+        *size = handle->data_size;
+        return ERFS_OK;
+    }
+
+    // fast path, lock free
+    ErfsCacheSlot* slot = cache_pin(handle);
+    if (slot != 0) {
+        *out = atomic_load_explicit(&slot->data, memory_order_relaxed);
+        *size = slot->size;
+        return ERFS_OK;
+    }
+
+    uint8_t *data;
+    uint32_t data_size;
+    int result = erfs_decode(fs, handle, &data, &data_size);
+    if (result != ERFS_OK) {
+        return result;
+    }
+
+    // if the content can't be cached, the caller gets a private copy which
+    // is freed by erfs_release_decoded()
+    slot = cache_insert(handle, &data, data_size);
+    *out = data;
+    *size = (slot != 0) ? slot->size : data_size;
+    return ERFS_OK;
+}
+
+/// release the content returned by erfs_read_decoded
+///@param fs the file system
+///@param handle the file
+///@param data the content returned by erfs_read_decoded
+///@return ERFS_OK for success
+int erfs_release_decoded(const ErfsRoot fs, const ErfsHandle handle, const uint8_t *data) {
+    CHECK_NULL(fs);
+    CHECK_NULL(handle);
+    CHECK_NULL(data);
+    if ((handle->flags & ERFS_CODEC_MASK) == 0) {
+        return ERFS_OK;
+    }
+
+    // the slot can't change while it's pinned by the caller, and a private
+    // copy never matches the data of any slot
+    ErfsCacheSlot* set = cache_slots + cache_set(handle) * ERFS_CACHE_WAYS;
+    for (int i = 0; i < ERFS_CACHE_WAYS; i++) {
+        ErfsCacheSlot* slot = set + i;
+        if (atomic_load_explicit(&slot->data, memory_order_relaxed) == data) {
+            atomic_fetch_sub_explicit(&slot->pins, 1, memory_order_release);
+            return ERFS_OK;
+        }
+    }
+
+    // private copy
+    free((void *)data);
+    return ERFS_OK;
+}
+
+/// read a part of a regular file, decoded if it has a codec.
+///@param fs the file system
+///@param handle the file
+///@param offset offset in the decoded content
+///@param buf buffer of the caller
+///@param len bytes to read
+///@param read [out] bytes read, less than len at the end of the file
+///@return ERFS_OK for success
+int erfs_pread(const ErfsRoot fs, const ErfsHandle handle, uint32_t offset, uint8_t *buf, uint32_t len, uint32_t *read) {
+    CHECK_NULL(fs);
+    CHECK_NULL(handle);
+    CHECK_NULL(buf);
+    CHECK_NULL(read);
+    *read = 0;
+    if ((handle->flags & ERFS_DIRECTORY) != 0) {
+        return ERFS_NOT_FILE;
+    }
+
+    if ((handle->flags & ERFS_CHUNKED) == 0) {
+        // stored, or decoded as a whole
+        const uint8_t *data;
+        uint32_t size;
+        int result = erfs_read_decoded(fs, handle, &data, &size);
+        if (result != ERFS_OK) {
+            return result;
+        }
+        if (offset < size) {
+            *read = (len < size - offset) ? len : size - offset;
+            memcpy(buf, data + offset, *read);
+        }
+        erfs_release_decoded(fs, handle, data);
+        return ERFS_OK;
+    }
+
+    ErfsChunks chunks;
+    int result = erfs_chunks(fs, handle, &chunks);
+    if (result != ERFS_OK || offset >= chunks.size) {
+        return result;
+    }
+    uint32_t end = (len < chunks.size - offset) ? offset + len : chunks.size;
+
+    // only the blocks read partially are decoded to a scratch buffer
+    uint8_t *scratch = 0;
+    uint32_t codec = handle->flags & ERFS_CODEC_MASK;
+    uint32_t pos = offset;
+    while (pos < end && result == ERFS_OK) {
+        uint32_t i = pos / chunks.chunk_size;
+        uint32_t block_begin = i * chunks.chunk_size;
+        uint32_t block_end = (chunks.size - block_begin < chunks.chunk_size) ? chunks.size : block_begin + chunks.chunk_size;
+        uint32_t n = ((end < block_end) ? end : block_end) - pos;
+        if (pos == block_begin && n == block_end - block_begin) {
+            result = erfs_chunk_decode(codec, &chunks, i, buf + (pos - offset));
+        } else {
+            if (scratch == 0) {
+                scratch = (uint8_t *)malloc(chunks.chunk_size);
+                if (scratch == 0) {
+                    result = ERFS_NO_MEMORY;
+                    break;
+                }
+            }
+            result = erfs_chunk_decode(codec, &chunks, i, scratch);
+            memcpy(buf + (pos - offset), scratch + (pos - block_begin), n);
+        }
+        pos += n;
+    }
+    free(scratch);
+    if (result == ERFS_OK) {
+        *read = end - offset;
+    }
+    return result;
+}
+
+/// set the memory budget of the decoded content cache
+///@param budget max bytes of decoded contents, 0 disables the cache
+///@return ERFS_OK for success
+int erfs_cache_config(uint32_t budget) {
+    pthread_mutex_lock(&cache_lock);
+    cache_budget = budget;
+    cache_reserve_locked(0);
+    pthread_mutex_unlock(&cache_lock);
+    return ERFS_OK;
+}
+
+/// drop the decoded contents of a file system from the cache
+///@param fs the file system
+///@return ERFS_OK for success; ERFS_BUSY if some contents are still held by erfs_read_decoded() callers
+int erfs_cache_purge(const ErfsRoot fs) {
+    CHECK_NULL(fs);
+    int result = ERFS_OK;
+    ErfsHandle begin = fs->entries;
+    ErfsHandle end = erfs_entry_at(fs, fs->entry_count);
+
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < ERFS_CACHE_SLOTS; i++) {
+        ErfsCacheSlot* slot = cache_slots + i;
+        ErfsHandle entry = atomic_load_explicit(&slot->entry, memory_order_relaxed);
+        if (entry < begin || entry >= end) {
+            continue;
+        }
+        if (cache_lock_slot(slot)) {
+            cache_evict_locked(slot);
+            atomic_store_explicit(&slot->pins, 0, memory_order_release);
+        } else {
+            result = ERFS_BUSY;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return result;
+}
@@ -0,0 +1,325 @@
+// fopencookie(), memfd_create()
+#define _GNU_SOURCE
+#define __ERFS_IMPL__
+#include "resource_fs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#define CHECK_NULL(V)       if(V == 0) {return ERFS_INVALID_INPUT;}
+
+// bytes decoded at a time to fill a memfd, or to find the size of a compressed file
+#define ERFS_FILE_PIECE     65536
+// bytes skipped at a time by a forward seek in a stream, on the stack
+#define ERFS_FILE_SKIP      4096
+
+#if defined(__GLIBC__)
+///
+/// a FILE of a compressed file: ERFS_CHUNKED files are read at any offset by erfs_pread(),
+/// the others are decoded by a stream, opened again to seek backward.
+///
+typedef struct {
+    const ErfsFileSystem *fs;
+    ErfsHandle entry;
+    ErfsStream *stream;
+    // position of the FILE, and of the stream
+    uint64_t pos;
+    uint64_t stream_pos;
+    // decoded size, found by the first SEEK_END; -1 until then
+    int64_t size;
+} ErfsFileCookie;
+
+/// move the stream to cookie->pos, or to the end of the file if it is beyond
+static int cookie_stream_seek(ErfsFileCookie *cookie) {
+    if (cookie->stream == 0 || cookie->stream_pos > cookie->pos) {
+        if (cookie->stream != 0) {
+            erfs_stream_close(cookie->stream);
+            cookie->stream = 0;
+        }
+        cookie->stream_pos = 0;
+        int result = erfs_stream_open(cookie->fs, cookie->entry, &cookie->stream);
+        if (result != ERFS_OK) {
+            return result;
+        }
+    }
+
+    uint8_t skip[ERFS_FILE_SKIP];
+    while (cookie->stream_pos < cookie->pos) {
+        uint64_t n = cookie->pos - cookie->stream_pos;
+        uint32_t read;
+        int result = erfs_stream_read(cookie->stream, skip, (n < sizeof(skip)) ? (uint32_t)n : sizeof(skip), &read);
+        if (result != ERFS_OK) {
+            return result;
+        }
+        if (read == 0) {
+            break;
+        }
+        cookie->stream_pos += read;
+    }
+    return ERFS_OK;
+}
+
+/// the decoded size: from the file info (erfs_gen --crc), or by decoding the file once
+static int cookie_size(ErfsFileCookie *cookie) {
+    uint32_t size;
+    uint32_t crc;
+    if (erfs_entryinfo(cookie->fs, cookie->entry, &size, &crc) == ERFS_OK) {
+        cookie->size = size;
+        return ERFS_OK;
+    }
+
+    ErfsStream *stream;
+    int result = erfs_stream_open(cookie->fs, cookie->entry, &stream);
+    if (result != ERFS_OK) {
+        return result;
+    }
+    uint8_t *buf = (uint8_t *)malloc(ERFS_FILE_PIECE);
+    int64_t total = 0;
+    uint32_t read = 0;
+    if (buf == 0) {
+        result = ERFS_NO_MEMORY;
+    }
+    do {
+        result = (result == ERFS_OK) ? erfs_stream_read(stream, buf, ERFS_FILE_PIECE, &read) : result;
+        total += read;
+    } while (result == ERFS_OK && read == ERFS_FILE_PIECE);
+    free(buf);
+    erfs_stream_close(stream);
+    if (result == ERFS_OK) {
+        cookie->size = total;
+    }
+    return result;
+}
+
+static ssize_t cookie_read(void *c, char *buf, size_t size) {
+    ErfsFileCookie *cookie = (ErfsFileCookie *)c;
+    // the offsets and sizes of the runtime are 32 bits
+    if (size > 0x40000000) {
+        size = 0x40000000;
+    }
+    uint32_t read = 0;
+    int result = ERFS_OK;
+    if ((cookie->entry->flags & ERFS_CHUNKED) != 0) {
+        // past the 32-bit offsets is past the end
+        if (cookie->pos <= 0xFFFFFFFF) {
+            result = erfs_pread(cookie->fs, cookie->entry, (uint32_t)cookie->pos, (uint8_t *)buf, (uint32_t)size, &read);
+        }
+    } else {
+        result = cookie_stream_seek(cookie);
+        if (result == ERFS_OK && cookie->stream_pos == cookie->pos) {
+            result = erfs_stream_read(cookie->stream, (uint8_t *)buf, (uint32_t)size, &read);
+            cookie->stream_pos += read;
+        }
+    }
+    if (result != ERFS_OK) {
+        errno = (result == ERFS_NO_MEMORY) ? ENOMEM : EIO;
+        return -1;
+    }
+    cookie->pos += read;
+    return read;
+}
+
+static int cookie_seek(void *c, off64_t *offset, int whence) {
+    ErfsFileCookie *cookie = (ErfsFileCookie *)c;
+    int64_t base;
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = (int64_t)cookie->pos;
+        break;
+    case SEEK_END:
+        if (cookie->size < 0 && cookie_size(cookie) != ERFS_OK) {
+            errno = EIO;
+            return -1;
+        }
+        base = cookie->size;
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+    if (*offset < -base) {
+        errno = EINVAL;
+        return -1;
+    }
+    cookie->pos = base + *offset;
+    *offset = (off64_t)cookie->pos;
+    return 0;
+}
+
+static int cookie_close(void *c) {
+    ErfsFileCookie *cookie = (ErfsFileCookie *)c;
+    if (cookie->stream != 0) {
+        erfs_stream_close(cookie->stream);
+    }
+    free(cookie);
+    return 0;
+}
+#endif // defined(__GLIBC__)
+
+/// open a file as a read-only FILE, see resource_fs.h
+///@param fs the file system
+///@param path the file name
+///@param path_len length of the file name
+///@param file [out] the FILE, to be closed by fclose()
+///@return ERFS_OK for success; ERFS_UNSUPPORTED for a compressed file without fopencookie() (glibc)
+int erfs_fopen(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, FILE **file) {
+    CHECK_NULL(fs);
+    CHECK_NULL(path);
+    CHECK_NULL(file);
+    ErfsHandle entry;
+    uint32_t size;
+    int result = erfs_open(fs, path, path_len, &entry, &size);
+    if (result != ERFS_OK) {
+        return result;
+    }
+    if ((entry->flags & ERFS_DIRECTORY) != 0) {
+        return ERFS_NOT_FILE;
+    }
+
+    // fmemopen() may refuse an empty buffer
+    if ((entry->flags & ERFS_CODEC_MASK) == 0 && size > 0) {
+        const uint8_t *data;
+        erfs_readfile(fs, entry, &data, &size);
+        // "r" never writes to the buffer
+        FILE *f = fmemopen((void *)data, size, "r");
+        if (f == 0) {
+            return ERFS_NO_MEMORY;
+        }
+        *file = f;
+        return ERFS_OK;
+    }
+
+#if defined(__GLIBC__)
+    ErfsFileCookie *cookie = (ErfsFileCookie *)calloc(1, sizeof(ErfsFileCookie));
+    if (cookie == 0) {
+        return ERFS_NO_MEMORY;
+    }
+    cookie->fs = fs;
+    cookie->entry = entry;
+    cookie->size = -1;
+    cookie_io_functions_t io = {cookie_read, 0, cookie_seek, cookie_close};
+    FILE *f = fopencookie(cookie, "r", io);
+    if (f == 0) {
+        free(cookie);
+        return ERFS_NO_MEMORY;
+    }
+    *file = f;
+    return ERFS_OK;
+#else
+    return ERFS_UNSUPPORTED;
+#endif
+}
+
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+/// write all the bytes, retrying short writes
+static int write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return ERFS_IO_ERROR;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return ERFS_OK;
+}
+
+/// write the decoded content of a file to fd
+static int write_decoded(const ErfsFileSystem *fs, ErfsHandle entry, int fd) {
+    if ((entry->flags & ERFS_CODEC_MASK) == 0) {
+        const uint8_t *data;
+        uint32_t size;
+        erfs_readfile(fs, entry, &data, &size);
+        return write_all(fd, data, size);
+    }
+
+    ErfsStream *stream;
+    int result = erfs_stream_open(fs, entry, &stream);
+    if (result != ERFS_OK) {
+        return result;
+    }
+    uint8_t *buf = (uint8_t *)malloc(ERFS_FILE_PIECE);
+    uint32_t read = 0;
+    if (buf == 0) {
+        result = ERFS_NO_MEMORY;
+    }
+    while (result == ERFS_OK) {
+        result = erfs_stream_read(stream, buf, ERFS_FILE_PIECE, &read);
+        if (result != ERFS_OK || read == 0) {
+            break;
+        }
+        result = write_all(fd, buf, read);
+    }
+    free(buf);
+    erfs_stream_close(stream);
+    return result;
+}
+#endif
+
+/// copy the decoded content of a file to a sealed memfd, see resource_fs.h
+///@param fs the file system
+///@param path the file name
+///@param path_len length of the file name
+///@param fd [out] the file descriptor at offset 0, to be closed by close()
+///@return ERFS_OK for success; ERFS_IO_ERROR if the memfd can't be created; ERFS_UNSUPPORTED if not on Linux
+int erfs_memfd(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, int *fd) {
+    CHECK_NULL(fs);
+    CHECK_NULL(path);
+    CHECK_NULL(fd);
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+    ErfsHandle entry;
+    uint32_t size;
+    int result = erfs_open(fs, path, path_len, &entry, &size);
+    if (result != ERFS_OK) {
+        return result;
+    }
+    if ((entry->flags & ERFS_DIRECTORY) != 0) {
+        return ERFS_NOT_FILE;
+    }
+
+    // named after the file, as shown in /proc/<pid>/fd
+    char name[64] = "erfs:";
+    const uint8_t *entry_name;
+    uint32_t name_size;
+    erfs_entryname(fs, entry, &entry_name, &name_size);
+    size_t prefix = strlen(name);
+    if (name_size > sizeof(name) - prefix - 1) {
+        name_size = sizeof(name) - prefix - 1;
+    }
+    memcpy(name + prefix, entry_name, name_size);
+    name[prefix + name_size] = 0;
+
+    int memfd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0) {
+        return ERFS_IO_ERROR;
+    }
+    result = write_decoded(fs, entry, memfd);
+    if (result == ERFS_OK && (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0
+            || lseek(memfd, 0, SEEK_SET) != 0)) {
+        result = ERFS_IO_ERROR;
+    }
+    if (result != ERFS_OK) {
+        close(memfd);
+        return result;
+    }
+    *fd = memfd;
+    return ERFS_OK;
+#else
+    (void)path_len;
+    return ERFS_UNSUPPORTED;
+#endif
+}
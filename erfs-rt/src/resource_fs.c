@@ -1,7 +1,20 @@
 #define __ERFS_IMPL__
 #include "resource_fs.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #define CHECK_NULL(V)       if(V == 0) {return ERFS_INVALID_INPUT;}
+// upper bound of erfs_entryalign()
+#define ERFS_ALIGN_MAX      65536
+
+#if defined(__GNUC__)
+#define ERFS_PREFETCH(P)    __builtin_prefetch(P)
+#else
+#define ERFS_PREFETCH(P)
+#endif
+
+static int erfs_open_path(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, ErfsHandle *out, uint32_t *size);
 
 /// read a regular file
 ///@param fs the file system
@@ -10,41 +23,42 @@
 ///@param size file size
 ///@return ERFS_OK for success; other for notfound
 int erfs_read(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, const uint8_t **out, uint32_t *size) {
+#if defined(ERFS_STATS)
+    uint64_t start = erfs_stats_now();
+#endif
     ErfsHandle handle;
-    int result = erfs_open (fs, path, path_len, &handle, size);
+    int result = erfs_open_path(fs, path, path_len, &handle, size);
+#if defined(ERFS_STATS)
+    erfs_stats_record(fs, ERFS_STATS_READ, (result == ERFS_OK) ? handle : 0, start);
+#endif
     if (result != 0) {
         return result;
     }
     if ((handle->flags & ERFS_DIRECTORY) != 0) {
         return ERFS_NOT_FILE;
     }
-    *out = fs->data + handle->data_offset;
+    *out = fs->data + erfs_data_offset(handle);
     // *size = handle->data_size;
     return ERFS_OK;
 }
 
 
-static int strcmp_withlength (const int8_t *s1, int l1, const int8_t *s2, int l2) {
-    int minlen = (l1 < l2)? l1 : l2;
-    for(int i = 0; i < minlen; i++, s1++, s2++){
-        if(*s1 < *s2) {
-            return -1;
-        } else if(*s1 > *s2){
-            return 1;
-        }
+/// compare names as unsigned bytes, the shorter first if one is a prefix of the other,
+/// the same order as std::string in the generator. memcmp() of libc compares by vectors.
+static int erfs_namecmp (const uint8_t *s1, uint32_t l1, const uint8_t *s2, uint32_t l2) {
+    uint32_t minlen = (l1 < l2)? l1 : l2;
+    int cmp = memcmp(s1, s2, minlen);
+    if (cmp != 0) {
+        return cmp;
     }
-    if(l1 < l2) {
-        return -1;
-    } else if (l1 > l2) {
-        return 1;
-    }
-    return 0;
+    return (l1 < l2) ? -1 : (l1 > l2);
 }
 
-static int erfs_binarysearch(const ErfsRoot fs, const ErfsHandle handle, const uint8_t *name, int len, ErfsHandle *out) {
-    ErfsHandle A = fs->entries + handle->data_offset;
+/// entries [0, n) from A, `stride` bytes each: inlined with a constant for each entry format
+static inline int erfs_binarysearch_entries(const ErfsRoot fs, const uint8_t *A, size_t stride, int n,
+        const uint8_t *name, int len, ErfsHandle *out) {
     int L = 0;
-    int R = (handle->data_size - 1);
+    int R = n - 1;
     int m;
 
     ErfsHandle mentry;
@@ -53,11 +67,11 @@ static int erfs_binarysearch(const ErfsRoot fs, const ErfsHandle handle, const u
     int cmp;
     while (L <= R) {
         m = (L + R) / 2;
-        mentry = A + m;
+        mentry = (ErfsHandle)(A + m * stride);
         mname = fs->data + mentry->name_offset;
         mlen = mentry->name_size;
 
-        cmp = strcmp_withlength((const int8_t *)mname, mlen, (const int8_t *)name, len);
+        cmp = erfs_namecmp(mname, mlen, name, len);
         if (cmp < 0) {
             L = m + 1;
         } else if (cmp > 0) {
@@ -71,15 +85,132 @@ static int erfs_binarysearch(const ErfsRoot fs, const ErfsHandle handle, const u
     return ERFS_NOT_FOUND;
 }
 
+static int erfs_binarysearch(const ErfsRoot fs, const ErfsHandle handle, const uint8_t *name, int len, ErfsHandle *out) {
+    const uint8_t *A = (const uint8_t *)erfs_entry_at(fs, handle->data_offset);
+    if (fs->entry_size == 0) {
+        return erfs_binarysearch_entries(fs, A, sizeof(ErfsEntry), handle->data_size, name, len, out);
+    }
+    return erfs_binarysearch_entries(fs, A, sizeof(ErfsEntry64), handle->data_size, name, len, out);
+}
 
-/// open a FS entry
-/// don't support "/../" or "/./"
-///@param fs the file system
-///@param path the file name to read
-///@param out handle
-///@param size file size or entries in the directory
-///@return ERFS_OK for success; other for notfound
-int erfs_open(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, ErfsHandle *out, uint32_t *size) {
+
+// ================== must be same as erfs_generator.cpp =========================
+static uint64_t erfs_hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/// hash of a full path, 8 bytes a step
+static uint64_t erfs_hash_path(const uint8_t *s, uint32_t len, uint32_t seed) {
+    uint64_t h = seed ^ (len * 0x9E3779B97F4A7C15ULL);
+    uint64_t k;
+    while (len >= 8) {
+        k = (uint64_t)s[0] | ((uint64_t)s[1] << 8) | ((uint64_t)s[2] << 16) | ((uint64_t)s[3] << 24)
+            | ((uint64_t)s[4] << 32) | ((uint64_t)s[5] << 40) | ((uint64_t)s[6] << 48) | ((uint64_t)s[7] << 56);
+        h = erfs_hash_mix(h ^ k);
+        s += 8;
+        len -= 8;
+    }
+    k = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        k |= (uint64_t)s[i] << (i * 8);
+    }
+    return erfs_hash_mix(h ^ k ^ 0x2545F4914F6CDD1DULL);
+}
+
+/// slot of a key in a bucket with displacement d
+static uint32_t erfs_hash_slot(uint64_t hash, uint32_t d, uint32_t slot_count) {
+    uint32_t x = (uint32_t)hash ^ (d * 0x9E3779B1U);
+    x ^= x >> 16;
+    x *= 0x85EBCA6BU;
+    x ^= x >> 13;
+    return (uint32_t)(((uint64_t)x * slot_count) >> 32);
+}
+// ================== must be same as erfs_generator.cpp =========================
+
+/// lookup a full path in the perfect hash index
+///@return ERFS_OK if found; ERFS_NOT_FOUND if it isn't an entry
+static int erfs_hash_open(const ErfsRoot fs, const uint8_t *path, uint32_t len, ErfsHandle *out) {
+    uint64_t hash = erfs_hash_path(path, len, fs->hash_seed);
+    uint32_t bucket = (uint32_t)(hash >> 32) % fs->hash_bucket_count;
+    const ErfsHashSlot *slot = fs->hash_slots + erfs_hash_slot(hash, fs->hash_buckets[bucket], fs->hash_slot_count);
+
+    // every path hashes to some slot, confirm it's the same one
+    if (slot->path_size != len || memcmp(fs->data + slot->path_offset, path, len) != 0) {
+        return ERFS_NOT_FOUND;
+    }
+    *out = erfs_entry_at(fs, slot->entry);
+    return ERFS_OK;
+}
+
+/// big endian, zero padded first 8 bytes of a name
+static uint64_t erfs_name_prefix(const uint8_t *name, int len) {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (len >= 8) {
+        uint64_t word;
+        memcpy(&word, name, 8);
+        return __builtin_bswap64(word);
+    }
+#endif
+    uint64_t prefix = 0;
+    for (int i = 0; i < 8; i++) {
+        prefix <<= 8;
+        if (i < len) {
+            prefix |= name[i];
+        }
+    }
+    return prefix;
+}
+
+/// compare the name of a lookup node with `name`, whose prefix is `prefix`
+static int erfs_lookup_cmp(const ErfsRoot fs, const ErfsLookup *node, const uint8_t *name, int len, uint64_t prefix) {
+    if (node->prefix != prefix) {
+        return (node->prefix < prefix) ? -1 : 1;
+    }
+    if (node->name_size <= 8 || len <= 8) {
+        // the whole shorter name is in the prefix
+        return (int)node->name_size - len;
+    }
+    // cold: compare the rest of the name
+    ErfsHandle entry = erfs_entry_at(fs, node->entry);
+    uint32_t minlen = (entry->name_size < (uint32_t)len) ? entry->name_size : (uint32_t)len;
+    int cmp = memcmp(fs->data + entry->name_offset + 8, name + 8, minlen - 8);
+    if (cmp == 0) {
+        cmp = (int)entry->name_size - len;
+    }
+    return cmp;
+}
+
+/// search a directory in its Eytzinger ordered lookup array
+static int erfs_eytzinger_search(const ErfsRoot fs, const ErfsHandle handle, const uint8_t *name, int len, ErfsHandle *out) {
+    // 1-based
+    const ErfsLookup *A = fs->lookup + handle->data_offset - 1;
+    const uint32_t n = handle->data_size;
+    const uint64_t prefix = erfs_name_prefix(name, len);
+
+    uint32_t k = 1;
+    int cmp;
+    while (k <= n) {
+        // the 16 descendants 4 levels down are contiguous
+        ERFS_PREFETCH(A + 16 * k);
+
+        const ErfsLookup *node = A + k;
+        cmp = erfs_lookup_cmp(fs, node, name, len, prefix);
+        if (cmp == 0) {
+            *out = erfs_entry_at(fs, node->entry);
+            return ERFS_OK;
+        }
+        k = 2 * k + (cmp < 0);
+    }
+    return ERFS_NOT_FOUND;
+}
+
+/// erfs_open() without the statistics
+static int erfs_open_path(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, ErfsHandle *out, uint32_t *size) {
     CHECK_NULL(fs);
     CHECK_NULL(path);
     CHECK_NULL(out);
@@ -102,13 +233,34 @@ int erfs_open(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, ErfsHan
 
     int result;
     ErfsHandle entry = 0;
+
+    // fast path: full paths are in the perfect hash index, only a trailing '/'
+    // needs the walk below
+    if (fs->hash_slot_count > 0 && *(path_end - 1) != '/') {
+        result = erfs_hash_open(fs, pos, path_end - pos, &entry);
+        if (result != ERFS_OK) {
+            return result;
+        }
+        *out = entry;
+        *size = entry->data_size;
+        return ERFS_OK;
+    }
+
     const uint8_t *start = pos;
     int len;
     while (pos != path_end) {
-        while(*pos != '/' && pos != path_end) pos++;
+        // memchr() of libc scans by vectors
+        pos = (const uint8_t *)memchr(start, '/', path_end - start);
+        if (pos == 0) {
+            pos = path_end;
+        }
         len = pos - start;
 
-        result = erfs_binarysearch(fs, dir, start, len, &entry);
+        if (fs->lookup != 0) {
+            result = erfs_eytzinger_search(fs, dir, start, len, &entry);
+        } else {
+            result = erfs_binarysearch(fs, dir, start, len, &entry);
+        }
         if (result != ERFS_OK) {
             return result;
         }
@@ -130,6 +282,325 @@ int erfs_open(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, ErfsHan
     return ERFS_OK;
 }
 
+/// open a FS entry
+/// don't support "/../" or "/./"
+///@param fs the file system
+///@param path the file name to read
+///@param out handle
+///@param size file size or entries in the directory
+///@return ERFS_OK for success; other for notfound
+int erfs_open(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, ErfsHandle *out, uint32_t *size) {
+#if defined(ERFS_STATS)
+    uint64_t start = erfs_stats_now();
+    int result = erfs_open_path(fs, path, path_len, out, size);
+    erfs_stats_record(fs, ERFS_STATS_OPEN, (result == ERFS_OK) ? *out : 0, start);
+    return result;
+#else
+    return erfs_open_path(fs, path, path_len, out, size);
+#endif
+}
+
+// searches interleaved by erfs_open_many(), a probe of each in turn
+#define ERFS_OPEN_MANY_WAYS     16
+// status of an item not resolved yet
+#define ERFS_OPEN_PENDING       1
+
+///
+/// a path of erfs_open_many()
+///
+typedef struct {
+    const uint8_t *path;
+    uint32_t len;
+    uint32_t index;
+    // the component being searched: [pos, end)
+    uint32_t pos;
+    uint32_t end;
+    // the directory being searched, then the entry found
+    ErfsHandle entry;
+    int status;
+    // result of the search of the current component
+    int found;
+    // end of the directory part, at the last '/'; pos - 1 if in the root directory
+    uint32_t dir_end;
+    // 1 + index of the item walking the same directory, 0 if it walks its own
+    uint32_t shared;
+    // Eytzinger: the node
+    uint32_t node;
+    // Eytzinger: prefix of the name; hash index: hash of the path
+    uint64_t key;
+} ErfsOpenItem;
+
+/// start the search of the current component of `item` in the directory item->entry
+static void erfs_open_start(const ErfsRoot fs, ErfsOpenItem *item) {
+    const uint8_t *name = item->path + item->pos;
+    item->found = ERFS_OPEN_PENDING;
+    if (fs->lookup != 0) {
+        item->node = 1;
+        item->key = erfs_name_prefix(name, item->end - item->pos);
+        ERFS_PREFETCH(fs->lookup + item->entry->data_offset);
+    }
+    if (item->entry->data_size == 0) {
+        item->found = ERFS_NOT_FOUND;
+    }
+}
+
+/// one probe of the Eytzinger search of `item`, and prefetch the next one
+///@return 1 if the search is done: item->found is ERFS_OK with item->entry, or ERFS_NOT_FOUND
+static int erfs_open_step(const ErfsRoot fs, ErfsOpenItem *item) {
+    ErfsHandle dir = item->entry;
+    const ErfsLookup *A = fs->lookup + dir->data_offset - 1;
+    const ErfsLookup *node = A + item->node;
+    int cmp = erfs_lookup_cmp(fs, node, item->path + item->pos, item->end - item->pos, item->key);
+    if (cmp == 0) {
+        item->entry = erfs_entry_at(fs, node->entry);
+        item->found = ERFS_OK;
+        return 1;
+    }
+    item->node = 2 * item->node + (cmp < 0);
+    if (item->node > dir->data_size) {
+        item->found = ERFS_NOT_FOUND;
+        return 1;
+    }
+    ERFS_PREFETCH(A + item->node);
+    return 0;
+}
+
+/// run the searches of `todo` by groups of ERFS_OPEN_MANY_WAYS, a probe of each in turn
+static void erfs_open_search(const ErfsRoot fs, ErfsOpenItem *items, const uint32_t *todo, uint32_t count) {
+    if (fs->lookup == 0) {
+        // a probe of a binary search needs the name of the entry it just loaded, so
+        // the interleaved searches were slower than one after another in erfs_bench
+        for (uint32_t i = 0; i < count; i++) {
+            ErfsOpenItem *item = items + todo[i];
+            if (item->found == ERFS_OPEN_PENDING) {
+                item->found = erfs_binarysearch(fs, item->entry, item->path + item->pos, item->end - item->pos, &item->entry);
+            }
+        }
+        return;
+    }
+    for (uint32_t base = 0; base < count; base += ERFS_OPEN_MANY_WAYS) {
+        uint32_t ways = (count - base < ERFS_OPEN_MANY_WAYS) ? count - base : ERFS_OPEN_MANY_WAYS;
+        uint32_t active = 0;
+        for (uint32_t w = 0; w < ways; w++) {
+            active += items[todo[base + w]].found == ERFS_OPEN_PENDING;
+        }
+        while (active > 0) {
+            for (uint32_t w = 0; w < ways; w++) {
+                ErfsOpenItem *item = items + todo[base + w];
+                if (item->found == ERFS_OPEN_PENDING && erfs_open_step(fs, item)) {
+                    active--;
+                }
+            }
+        }
+    }
+}
+
+/// lookup the full paths of `todo` in the perfect hash index, by groups of ERFS_OPEN_MANY_WAYS
+static void erfs_open_hash(const ErfsRoot fs, ErfsOpenItem *items, const uint32_t *todo, uint32_t count) {
+    for (uint32_t base = 0; base < count; base += ERFS_OPEN_MANY_WAYS) {
+        uint32_t ways = (count - base < ERFS_OPEN_MANY_WAYS) ? count - base : ERFS_OPEN_MANY_WAYS;
+        const ErfsHashSlot *slots[ERFS_OPEN_MANY_WAYS];
+        for (uint32_t w = 0; w < ways; w++) {
+            ErfsOpenItem *item = items + todo[base + w];
+            item->key = erfs_hash_path(item->path + item->pos, item->len - item->pos, fs->hash_seed);
+            ERFS_PREFETCH(fs->hash_buckets + (uint32_t)(item->key >> 32) % fs->hash_bucket_count);
+        }
+        for (uint32_t w = 0; w < ways; w++) {
+            ErfsOpenItem *item = items + todo[base + w];
+            uint32_t d = fs->hash_buckets[(uint32_t)(item->key >> 32) % fs->hash_bucket_count];
+            slots[w] = fs->hash_slots + erfs_hash_slot(item->key, d, fs->hash_slot_count);
+            ERFS_PREFETCH(slots[w]);
+        }
+        for (uint32_t w = 0; w < ways; w++) {
+            ErfsOpenItem *item = items + todo[base + w];
+            const uint32_t len = item->len - item->pos;
+            if (slots[w]->path_size != len || memcmp(fs->data + slots[w]->path_offset, item->path + item->pos, len) != 0) {
+                item->status = ERFS_NOT_FOUND;
+            } else {
+                item->entry = erfs_entry_at(fs, slots[w]->entry);
+                item->status = ERFS_OK;
+            }
+        }
+    }
+}
+
+/// open many FS entries, the same as erfs_open() on each path.
+/// the paths with the same directory share its walk, and the searches of different
+/// paths are interleaved to overlap their memory loads.
+///@param fs the file system
+///@param paths the paths to open
+///@param lens lengths of paths
+///@param n number of paths
+///@param handles [out] handles, for the paths opened
+///@param sizes [out] file sizes or entries in the directories, for the paths opened
+///@param status [out] result of erfs_open() of each path
+///@return ERFS_OK if the paths are processed, see status for each one
+int erfs_open_many(const ErfsRoot fs, const uint8_t *const *paths, const uint32_t *lens, uint32_t n,
+        ErfsHandle *handles, uint32_t *sizes, int *status) {
+    CHECK_NULL(fs);
+    if (n == 0) {
+        return ERFS_OK;
+    }
+    CHECK_NULL(paths);
+    CHECK_NULL(lens);
+    CHECK_NULL(handles);
+    CHECK_NULL(sizes);
+    CHECK_NULL(status);
+
+    // open addressing table of the directories, 1 + item index
+    uint32_t table_size = 16;
+    while (table_size < 2 * (uint64_t)n) {
+        table_size *= 2;
+    }
+    ErfsOpenItem *items = (ErfsOpenItem *)malloc(n * sizeof(ErfsOpenItem));
+    uint32_t *todo = (uint32_t *)malloc(n * sizeof(uint32_t));
+    uint32_t *walks = (uint32_t *)malloc(n * sizeof(uint32_t));
+    uint32_t *table = (uint32_t *)calloc(table_size, sizeof(uint32_t));
+    if (items == 0 || todo == 0 || walks == 0 || table == 0) {
+        free(items);
+        free(todo);
+        free(walks);
+        free(table);
+        return ERFS_NO_MEMORY;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (paths[i] == 0) {
+            status[i] = ERFS_INVALID_INPUT;
+            continue;
+        }
+        ErfsOpenItem *item = items + count++;
+        item->path = paths[i];
+        item->len = lens[i];
+        item->index = i;
+        // if first character is '/', ignore
+        item->pos = (item->len > 0 && item->path[0] == '/') ? 1 : 0;
+        item->entry = fs->entries;
+        item->status = (item->pos == item->len) ? ERFS_OK : ERFS_OPEN_PENDING;
+    }
+
+    // fast path: full paths are in the perfect hash index, only a trailing '/' needs the walk below
+    if (fs->hash_slot_count > 0) {
+        uint32_t hashed = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (items[i].status == ERFS_OPEN_PENDING && items[i].path[items[i].len - 1] != '/') {
+                todo[hashed++] = i;
+            }
+        }
+        erfs_open_hash(fs, items, todo, hashed);
+    }
+
+    // the directory of a path is before its last '/', one path walks it for all the paths
+    // with the same directory
+    uint32_t walk_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        ErfsOpenItem *item = items + i;
+        item->shared = 0;
+        if (item->status != ERFS_OPEN_PENDING) {
+            continue;
+        }
+        const uint8_t *name = item->path + item->pos;
+        const uint8_t *end = item->path + item->len;
+        const uint8_t *last = 0;
+        for (const uint8_t *sep = name; (sep = (const uint8_t *)memchr(sep, '/', end - sep)) != 0; sep++) {
+            last = sep;
+        }
+        if (last == 0) {
+            // in the root directory
+            item->dir_end = item->pos - 1;
+            continue;
+        }
+        item->dir_end = (uint32_t)(last - item->path);
+        uint32_t len = item->dir_end - item->pos;
+        uint32_t slot = (uint32_t)erfs_hash_path(name, len, 0) & (table_size - 1);
+        for (; table[slot] != 0; slot = (slot + 1) & (table_size - 1)) {
+            const ErfsOpenItem *other = items + table[slot] - 1;
+            if (other->dir_end - other->pos == len && memcmp(other->path + other->pos, name, len) == 0) {
+                item->shared = table[slot];
+                break;
+            }
+        }
+        if (item->shared == 0) {
+            table[slot] = i + 1;
+            walks[walk_count++] = i;
+        }
+    }
+
+    // walk the directories, a component of all of them at a time
+    while (walk_count > 0) {
+        for (uint32_t w = 0; w < walk_count; w++) {
+            ErfsOpenItem *item = items + walks[w];
+            const uint8_t *sep = (const uint8_t *)memchr(item->path + item->pos, '/', item->dir_end - item->pos);
+            item->end = (sep != 0) ? (uint32_t)(sep - item->path) : item->dir_end;
+            erfs_open_start(fs, item);
+        }
+        erfs_open_search(fs, items, walks, walk_count);
+
+        uint32_t walking = 0;
+        for (uint32_t w = 0; w < walk_count; w++) {
+            ErfsOpenItem *item = items + walks[w];
+            if (item->found != ERFS_OK || (item->entry->flags & ERFS_DIRECTORY) == 0) {
+                // a directory of the path isn't found, or is a regular file
+                item->status = ERFS_NOT_FOUND;
+            } else if (item->end != item->dir_end) {
+                item->pos = item->end + 1;
+                walks[walking++] = walks[w];
+            }
+        }
+        walk_count = walking;
+    }
+
+    // the last components, in their directories
+    uint32_t searched = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        ErfsOpenItem *item = items + i;
+        if (item->status != ERFS_OPEN_PENDING) {
+            continue;
+        }
+        if (item->shared != 0) {
+            const ErfsOpenItem *other = items + item->shared - 1;
+            item->entry = other->entry;
+            if (other->status == ERFS_NOT_FOUND) {
+                item->status = ERFS_NOT_FOUND;
+                continue;
+            }
+        }
+        if (item->dir_end + 1 == item->len) {
+            // trailing '/'
+            item->status = ERFS_OK;
+            continue;
+        }
+        item->pos = item->dir_end + 1;
+        item->end = item->len;
+        erfs_open_start(fs, item);
+        todo[searched++] = i;
+    }
+    if (searched > 0) {
+        erfs_open_search(fs, items, todo, searched);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        ErfsOpenItem *item = items + i;
+        if (item->status == ERFS_OPEN_PENDING) {
+            item->status = item->found;
+        }
+        status[item->index] = item->status;
+        if (item->status == ERFS_OK) {
+            handles[item->index] = item->entry;
+            sizes[item->index] = item->entry->data_size;
+        }
+#if defined(ERFS_STATS)
+        erfs_stats_count(fs, ERFS_STATS_OPEN, (item->status == ERFS_OK) ? item->entry : 0);
+#endif
+    }
+    free(items);
+    free(todo);
+    free(walks);
+    free(table);
+    return ERFS_OK;
+}
+
 /// get flags of an entry (directry or file)
 ///@param entry entry (directry or file)
 ///@return ERFS_OK for success
@@ -139,6 +610,17 @@ int erfs_entryflags(const ErfsHandle handle, uint32_t *flags) {
     return ERFS_OK;
 }
 
+/// get codec of a file
+///@param handle entry (directry or file)
+///@param codec [out] ERFS_GZIPPED, ERFS_ZSTD or ERFS_LZ4; 0 if it is stored as it is
+///@return ERFS_OK for success
+int erfs_entrycodec(const ErfsHandle handle, uint32_t *codec) {
+    CHECK_NULL(handle);
+    CHECK_NULL(codec);
+    *codec = handle->flags & ERFS_CODEC_MASK;
+    return ERFS_OK;
+}
+
 /// get flags of an entry (directry or file)
 ///@param handle entry (directry or file)
 ///@param flags [out] size
@@ -149,6 +631,47 @@ int erfs_entrysize(const ErfsHandle handle, uint32_t *size) {
     return ERFS_OK;    
 }
 
+/// get the decoded size and CRC32 of a file without decoding it (erfs_gen --crc)
+///@param fs the file system
+///@param handle the file
+///@param size [out] decoded size
+///@param crc32 [out] CRC32 of the decoded content
+///@return ERFS_OK for success; ERFS_NOT_FILE for a directory; ERFS_NOT_FOUND if the file system has no file info
+int erfs_entryinfo(const ErfsRoot fs, const ErfsHandle handle, uint32_t *size, uint32_t *crc32) {
+    CHECK_NULL(fs);
+    CHECK_NULL(handle);
+    CHECK_NULL(size);
+    CHECK_NULL(crc32);
+    if ((handle->flags & ERFS_DIRECTORY) != 0) {
+        return ERFS_NOT_FILE;
+    }
+    if (fs->file_info == 0) {
+        return ERFS_NOT_FOUND;
+    }
+    const ErfsFileInfo *info = fs->file_info + erfs_entry_ordinal(fs, handle);
+    *size = info->size;
+    *crc32 = info->crc32;
+    return ERFS_OK;
+}
+
+/// get the alignment of the data of a file as given by erfs_readfile() (erfs_gen --align)
+///@param fs the file system
+///@param handle the file
+///@param align [out] largest power of two dividing the address of the data, up to 65536
+///@return ERFS_OK for success; ERFS_NOT_FILE for a directory
+int erfs_entryalign(const ErfsRoot fs, const ErfsHandle handle, uint32_t *align) {
+    CHECK_NULL(fs);
+    CHECK_NULL(handle);
+    CHECK_NULL(align);
+    if ((handle->flags & ERFS_DIRECTORY) != 0) {
+        return ERFS_NOT_FILE;
+    }
+    // the address, not the offset: the data of a mounted image or of a blob have their own alignment
+    uintptr_t address = (uintptr_t)(fs->data + erfs_data_offset(handle)) | ERFS_ALIGN_MAX;
+    *align = (uint32_t)(address & (~address + 1));
+    return ERFS_OK;
+}
+
 /// get name of an entry (directry or file)
 ///@param fs the file system
 ///@param handle entry (directry or file)
@@ -179,7 +702,7 @@ int erfs_readfile(const ErfsRoot fs, const ErfsHandle handle, const uint8_t **ou
     if ((handle->flags & ERFS_DIRECTORY) != 0) {
         return ERFS_NOT_FILE;
     }
-    *out = fs->data + handle->data_offset;
+    *out = fs->data + erfs_data_offset(handle);
     *size = handle->data_size;
     return ERFS_OK;
 }
@@ -200,42 +723,77 @@ int erfs_readdir(const ErfsRoot fs, const ErfsHandle handle, uint32_t index, Erf
     if (index >= handle->data_size) {
         return ERFS_OUTOF_BOUND;
     }
-    *out = fs->entries + handle->data_offset;
+    *out = erfs_entry_at(fs, handle->data_offset + index);
     return ERFS_OK;
 }
 
-
-static int erfs_travel_itr(const ErfsRoot fs, ErfsHandle handle, ErfsVisitFn func, void* ctx) {
-    int result = 0;
-
-    if ((handle->flags & ERFS_DIRECTORY) != 0) {
-        result = (*func)(fs, handle, ERFS_TRAVEL_DIR_ENTER, ctx);
-        if (result) {
-            return result;
-        }
-
-        // directory entries
-        int size = handle->data_size;
-        for (int i = 0; i < size; i++) {
-            result = erfs_travel_itr(fs, fs->entries + (handle->data_offset + i), func, ctx);
-            if (result) {
-                return result;
-            }
+/// index of the first entry of `dir` from `L` whose name, cut to `len` bytes, is not below `prefix`
+/// (above it if `after`): the names cut to a length are in the same order as the names
+static uint32_t erfs_prefix_bound(const ErfsRoot fs, const ErfsHandle dir, uint32_t L,
+        const uint8_t *prefix, uint32_t len, int after) {
+    uint32_t R = dir->data_size;
+    while (L < R) {
+        uint32_t m = L + (R - L) / 2;
+        ErfsHandle mentry = erfs_entry_at(fs, dir->data_offset + m);
+        uint32_t mlen = (mentry->name_size < len) ? mentry->name_size : len;
+        int cmp = erfs_namecmp(fs->data + mentry->name_offset, mlen, prefix, len);
+        if (cmp < 0 || (after && cmp == 0)) {
+            L = m + 1;
+        } else {
+            R = m;
         }
+    }
+    return L;
+}
 
-        result = (*func)(fs, handle, ERFS_TRAVEL_DIR_LEAVE, ctx);
-        if (result) {
-            return result;
-        }
-    } else {
-        result = (*func)(fs, handle, ERFS_TRAVEL_FILE, ctx);
-        if (result) {
-            return result;
+/// find the entries of a directory whose names start with `prefix`
+///@param fs the file system
+///@param dir the directory
+///@param prefix the start of the names, all entries if empty
+///@param first [out] index of the first entry, for erfs_readdir()
+///@param count [out] number of entries, 0 if none
+///@return ERFS_OK for success; ERFS_NOT_DIRECTORY if dir is a file
+int erfs_find_prefix(const ErfsRoot fs, const ErfsHandle dir, const uint8_t *prefix, uint32_t prefix_len,
+        uint32_t *first, uint32_t *count) {
+    CHECK_NULL(fs);
+    CHECK_NULL(dir);
+    CHECK_NULL(first);
+    CHECK_NULL(count);
+    if ((dir->flags & ERFS_DIRECTORY) == 0) {
+        return ERFS_NOT_DIRECTORY;
+    }
+    if (prefix_len == 0) {
+        *first = 0;
+        *count = dir->data_size;
+        return ERFS_OK;
+    }
+    CHECK_NULL(prefix);
+    uint32_t begin = erfs_prefix_bound(fs, dir, 0, prefix, prefix_len, 0);
+    uint32_t end = begin;
+    if (begin < dir->data_size) {
+        // the upper bound is above the lower one, search the rest only
+        ErfsHandle entry = erfs_entry_at(fs, dir->data_offset + begin);
+        if (entry->name_size >= prefix_len && memcmp(fs->data + entry->name_offset, prefix, prefix_len) == 0) {
+            end = erfs_prefix_bound(fs, dir, begin + 1, prefix, prefix_len, 1);
         }
     }
-    return result;
+    *first = begin;
+    *count = end - begin;
+    return ERFS_OK;
 }
 
+
+// depth of the directories traveled without allocating
+#define ERFS_TRAVEL_DEPTH   32
+
+///
+/// a directory being traveled by erfs_travel(), and the index of its next entry
+///
+typedef struct {
+    ErfsHandle dir;
+    uint32_t next;
+} ErfsTravelFrame;
+
 /// travel the resource filesystem
 ///@param fs the file system
 ///@param func callback function
@@ -247,6 +805,55 @@ int erfs_travel(const ErfsRoot fs, ErfsVisitFn func, void* ctx) {
 
     ErfsHandle dir = fs->entries;
     CHECK_NULL(dir);
+    if ((dir->flags & ERFS_DIRECTORY) == 0) {
+        return (*func)(fs, dir, ERFS_TRAVEL_FILE, ctx);
+    }
+
+    // an explicit stack, so a deep tree can't overflow the thread stack
+    ErfsTravelFrame local[ERFS_TRAVEL_DEPTH];
+    ErfsTravelFrame *frames = local;
+    uint32_t capacity = ERFS_TRAVEL_DEPTH;
+    uint32_t depth = 0;
 
-    return erfs_travel_itr(fs, dir, func, ctx);
+    int result = (*func)(fs, dir, ERFS_TRAVEL_DIR_ENTER, ctx);
+    frames[depth].dir = dir;
+    frames[depth++].next = 0;
+    while (result == 0 && depth > 0) {
+        ErfsTravelFrame *top = frames + depth - 1;
+        if (top->next == top->dir->data_size) {
+            depth--;
+            result = (*func)(fs, top->dir, ERFS_TRAVEL_DIR_LEAVE, ctx);
+            continue;
+        }
+
+        ErfsHandle entry = erfs_entry_at(fs, top->dir->data_offset + top->next++);
+        if ((entry->flags & ERFS_DIRECTORY) == 0) {
+            result = (*func)(fs, entry, ERFS_TRAVEL_FILE, ctx);
+            continue;
+        }
+        result = (*func)(fs, entry, ERFS_TRAVEL_DIR_ENTER, ctx);
+        if (result != 0) {
+            break;
+        }
+        if (depth == capacity) {
+            ErfsTravelFrame *grown = (ErfsTravelFrame *)malloc(2 * capacity * sizeof(ErfsTravelFrame));
+            if (grown == 0) {
+                result = ERFS_NO_MEMORY;
+                break;
+            }
+            memcpy(grown, frames, depth * sizeof(ErfsTravelFrame));
+            if (frames != local) {
+                free(frames);
+            }
+            frames = grown;
+            capacity *= 2;
+        }
+        frames[depth].dir = entry;
+        frames[depth++].next = 0;
+    }
+
+    if (frames != local) {
+        free(frames);
+    }
+    return result;
 }
@@ -6,6 +6,23 @@
 extern "C" {
 #endif
 
+#if defined(__cplusplus)
+#define ERFS_ALIGNAS(N)     alignas(N)
+#else
+#define ERFS_ALIGNAS(N)     _Alignas(N)
+#endif
+
+/// hot part of an entry for lookup (erfs_gen --eytzinger), 4 in a cache line.
+/// it has the same ordinal as its entry, but the children of a directory are
+/// in Eytzinger (BFS) order of the sorted names.
+typedef struct {
+    // first 8 bytes of the name, big endian and zero padded, so it compares as the name does
+    ERFS_ALIGNAS(16) uint64_t prefix;
+    uint32_t name_size;
+    // ordinal of the entry
+    uint32_t entry;
+} ErfsLookup;
+
 #pragma pack(1)
 
 /// a directory or file
@@ -19,18 +36,103 @@ typedef struct  {
 
 typedef const ErfsEntry* ErfsHandle;
 
+/// an entry of a wide file system (erfs_gen --wide), with ERFS_WIDE in its flags.
+/// the contents may be beyond 4GB in data, a file is still smaller than 4GB.
+typedef struct {
+    ErfsEntry entry;
+    // high 32 bits of entry.data_offset
+    uint32_t data_offset_hi;
+} ErfsEntry64;
+
+/// a slot of the perfect hash index
+typedef struct {
+    // ordinal of the entry
+    uint32_t entry;
+    // full path of the entry in data, without the leading '/'
+    uint32_t path_offset;
+    uint32_t path_size;
+} ErfsHashSlot;
+
+/// original size and CRC32 of a file (erfs_gen --crc), zeros for a directory
+typedef struct {
+    // decoded size
+    uint32_t size;
+    // CRC32 of the decoded content, as zlib crc32() and the gzip trailer
+    uint32_t crc32;
+} ErfsFileInfo;
+
 /// the whole resource filesystem
 typedef struct {
     // all entries including directories and files
     uint32_t entry_count;
     ErfsEntry *entries;
+    // bytes of an entry, sizeof(ErfsEntry64) for a wide file system; 0 for sizeof(ErfsEntry)
+    uint32_t entry_size;
 
     // buffer to hold all names and contents
-    uint32_t data_size;
+    uint64_t data_size;
     uint8_t  *data;
+
+    // optional minimal perfect hash index on full paths (erfs_gen --hash),
+    // a path hashed to bucket b is in slot pos(hash, hash_buckets[b])
+    uint32_t hash_seed;
+    uint32_t hash_bucket_count;
+    uint32_t *hash_buckets;
+    uint32_t hash_slot_count;
+    ErfsHashSlot *hash_slots;
+
+    // optional lookup array, entry_count records
+    ErfsLookup *lookup;
+
+    // optional file info, entry_count records
+    ErfsFileInfo *file_info;
+
+    // optional dictionary of the ERFS_DICT files, in data
+    uint32_t dict_offset;
+    uint32_t dict_size;
 } ErfsFileSystem;
 
 typedef const ErfsFileSystem * ErfsRoot;
+
+#define ERFS_IMAGE_MAGIC            "ERFS"
+#define ERFS_IMAGE_VERSION          1
+// ErfsEntry64 entries and data_size64
+#define ERFS_IMAGE_VERSION_WIDE     2
+
+/// header of an image file (erfs_gen --image), followed by the sections it points to.
+/// all fields are in the byte order of the host that generated it, as the entries are used in place;
+/// an image of the other byte order is rejected. offsets are from the start of the file.
+typedef struct {
+    uint8_t  magic[4];
+    uint32_t version;
+    // newer fields are appended, an older header is read as if they were 0
+    uint32_t header_size;
+
+    uint32_t entry_count;
+    uint64_t entries_offset;
+
+    uint32_t data_size;
+    uint64_t data_offset;
+
+    uint32_t hash_seed;
+    uint32_t hash_bucket_count;
+    uint64_t hash_buckets_offset;
+    uint32_t hash_slot_count;
+    uint64_t hash_slots_offset;
+
+    // entry_count records, 0 if there is no lookup array
+    uint64_t lookup_offset;
+
+    // ERFS_IMAGE_VERSION_WIDE: data_size is 0, the entries are ErfsEntry64
+    uint64_t data_size64;
+
+    // entry_count records, 0 if there is no file info
+    uint64_t file_info_offset;
+
+    // in data, dict_size is 0 if there is no dictionary
+    uint32_t dict_offset;
+    uint32_t dict_size;
+} ErfsImageHeader;
 #pragma pack()
 
 #if defined(__cplusplus)
@@ -49,6 +151,9 @@ typedef const void* ErfsRoot;
 typedef const void* ErfsHandle;
 #endif // defined(ERFS_IMPL)
 
+// FILE of erfs_fopen()
+#include <stdio.h>
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -59,8 +164,66 @@ extern "C" {
 enum ErfsEntryFlags {
     ERFS_DIRECTORY       = 1,
     ERFS_GZIPPED         = 2, 
+    // a zstd frame with the content size
+    ERFS_ZSTD            = 4,
+    // a lz4 block after the original size (4 bytes, little endian)
+    ERFS_LZ4             = 8,
+    // with a codec bit: blocks compressed independently, after a block index
+    // [original size][block size][block count][count + 1 block offsets] (4 bytes each, little endian)
+    ERFS_CHUNKED         = 16,
+    // the entry is an ErfsEntry64 (erfs_gen --wide)
+    ERFS_WIDE            = 32,
+    // with a codec bit: compressed as if the content followed the dictionary of the file system (erfs_gen --dict);
+    // a zlib stream with the dictionary id for ERFS_GZIPPED. never with ERFS_CHUNKED
+    ERFS_DICT            = 64,
+
+    // codec of a file, at most one of the bits is set
+    ERFS_CODEC_MASK      = ERFS_GZIPPED | ERFS_ZSTD | ERFS_LZ4,
+};
+
+#if defined(__ERFS_IMPL__)
+/// the entry of an ordinal
+static inline ErfsHandle erfs_entry_at(const ErfsFileSystem *fs, uint32_t ordinal) {
+    if (fs->entry_size == 0) {
+        return fs->entries + ordinal;
+    }
+    return (ErfsHandle)((const uint8_t *)fs->entries + (uint64_t)ordinal * fs->entry_size);
+}
+
+/// the ordinal of an entry
+static inline uint32_t erfs_entry_ordinal(const ErfsFileSystem *fs, ErfsHandle entry) {
+    uint64_t size = (fs->entry_size == 0) ? sizeof(ErfsEntry) : fs->entry_size;
+    return (uint32_t)((uint64_t)((const uint8_t *)entry - (const uint8_t *)fs->entries) / size);
+}
+
+/// offset of the content of a file in data
+static inline uint64_t erfs_data_offset(ErfsHandle entry) {
+    uint64_t offset = entry->data_offset;
+    if ((entry->flags & ERFS_WIDE) != 0) {
+        offset |= (uint64_t)((const ErfsEntry64 *)entry)->data_offset_hi << 32;
+    }
+    return offset;
+}
+
+#if defined(ERFS_STATS)
+/// calls counted by resource_stats.c
+enum ErfsStatsOp {
+    ERFS_STATS_OPEN,
+    ERFS_STATS_READ,
+    ERFS_STATS_OPS
 };
 
+/// monotonic time in ns, the start of erfs_stats_record()
+uint64_t erfs_stats_now(void);
+/// count a hit of `entry`, or a miss if it is 0
+void erfs_stats_count(const ErfsFileSystem *fs, int op, ErfsHandle entry);
+/// count a hit or a miss, and the latency since `start`
+void erfs_stats_record(const ErfsFileSystem *fs, int op, ErfsHandle entry, uint64_t start);
+/// free the counters of an unmounted file system
+void erfs_stats_release(const ErfsFileSystem *fs);
+#endif // defined(ERFS_STATS)
+#endif // defined(__ERFS_IMPL__)
+
 ///
 /// return code of access api
 ///
@@ -71,6 +234,13 @@ enum ErfsStatusCode {
     ERFS_NOT_FILE                = -3,
     ERFS_NOT_DIRECTORY           = -4,
     ERFS_OUTOF_BOUND             = -5,
+    ERFS_DECODE_FAIL             = -6,
+    ERFS_NO_MEMORY               = -7,
+    ERFS_IO_ERROR                = -8,
+    ERFS_INVALID_IMAGE           = -9,
+    ERFS_BUSY                    = -10,
+    ERFS_UNSUPPORTED_CODEC       = -11,
+    ERFS_UNSUPPORTED             = -12,
 };
 
 /// read a regular file
@@ -91,18 +261,55 @@ int erfs_read(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, const u
 ///@return 0 for success; other for notfound
 int erfs_open(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, ErfsHandle *out, uint32_t *size);
 
+/// open many FS entries, the same as erfs_open() on each path.
+/// the directories shared by the paths are searched once, and the searches
+/// of different paths are interleaved to overlap their memory loads.
+///@param fs the file system
+///@param paths the paths to open
+///@param lens lengths of paths
+///@param n number of paths
+///@param handles [out] handles, for the paths opened
+///@param sizes [out] file sizes or entries in the directories, for the paths opened
+///@param status [out] result of erfs_open() of each path
+///@return 0 if the paths are processed, see status for each one
+int erfs_open_many(const ErfsRoot fs, const uint8_t *const *paths, const uint32_t *lens, uint32_t n,
+        ErfsHandle *handles, uint32_t *sizes, int *status);
+
 /// get flags of an entry (directry or file)
 ///@param entry entry (directry or file)
 ///@param flags [out] flags
 ///@return flags
 int erfs_entryflags(const ErfsHandle entry, uint32_t *flags);
 
+/// get codec of a file
+///@param entry entry (directry or file)
+///@param codec [out] ERFS_GZIPPED, ERFS_ZSTD or ERFS_LZ4; 0 if it is stored as it is
+///@return 0 for success
+int erfs_entrycodec(const ErfsHandle entry, uint32_t *codec);
+
 /// get size of an entry (directry or file)
 ///@param entry entry (directry or file)
 ///@param flags [out] size
 ///@return size of file or dirctory
 int erfs_entrysize(const ErfsHandle entry, uint32_t *size);
 
+/// get the decoded size and CRC32 of a file without decoding it (erfs_gen --crc),
+/// e.g. to send a gzipped file as it is, or to allocate the buffer of the decoded content
+///@param fs the file system
+///@param entry the file
+///@param size [out] decoded size
+///@param crc32 [out] CRC32 of the decoded content
+///@return 0 for success; ERFS_NOT_FILE for a directory; ERFS_NOT_FOUND if the file system has no file info
+int erfs_entryinfo(const ErfsRoot fs, const ErfsHandle entry, uint32_t *size, uint32_t *crc32);
+
+/// get the alignment of the data of a file as given by erfs_readfile() (erfs_gen --align),
+/// e.g. to use an uncompressed table in place, or to madvise() a page aligned file
+///@param fs the file system
+///@param entry the file
+///@param align [out] largest power of two dividing the address of the data, up to 65536
+///@return 0 for success; ERFS_NOT_FILE for a directory
+int erfs_entryalign(const ErfsRoot fs, const ErfsHandle entry, uint32_t *align);
+
 /// get name of an entry (directry or file)
 ///@param fs the file system
 ///@param entry entry (directry or file)
@@ -127,6 +334,18 @@ int erfs_readfile(const ErfsRoot fs, const ErfsHandle entry, const uint8_t **out
 ///@return 0 for success; other for notfound
 int erfs_readdir(const ErfsRoot fs, const ErfsHandle dir, uint32_t index, ErfsHandle *out);
 
+/// find the entries of a directory whose names start with `prefix`, by two binary searches:
+/// the entries of a directory are sorted by name (bytes compared as unsigned)
+///@param fs the file system
+///@param dir the directory
+///@param prefix the start of the names, all entries if empty
+///@param prefix_len length of the prefix
+///@param first [out] index of the first entry, for erfs_readdir()
+///@param count [out] number of entries, 0 if none
+///@return 0 for success; ERFS_NOT_DIRECTORY if dir is a file
+int erfs_find_prefix(const ErfsRoot fs, const ErfsHandle dir, const uint8_t *prefix, uint32_t prefix_len,
+        uint32_t *first, uint32_t *count);
+
 
 enum ErfsTravelType {
     ERFS_TRAVEL_DIR_ENTER,
@@ -143,6 +362,155 @@ typedef int (*ErfsVisitFn) (const ErfsRoot fs, const ErfsHandle entry, enum Erfs
 ///@return 0 for success; other for notfound
 int erfs_travel(const ErfsRoot fs, ErfsVisitFn func, void* ctx);
 
+/// travel the resource filesystem with a pool of `nthreads` workers sharing the directories by work stealing.
+/// callbacks run concurrently and in no particular order, except that ERFS_TRAVEL_DIR_ENTER of a directory
+/// comes before its entries; ERFS_TRAVEL_DIR_LEAVE is not called.
+///@param fs the file system
+///@param nthreads number of workers including the calling thread, 0 for one per CPU
+///@param func callback function, must be thread safe
+///@param ctx context
+///@return 0 for success; the first non zero result of func, which stops the travel
+int erfs_travel_parallel(const ErfsRoot fs, uint32_t nthreads, ErfsVisitFn func, void* ctx);
+
+/// called by erfs_glob() for each matching entry
+///@param path the path of the entry from the root, e.g. "/locales/en/a.json", NUL terminated,
+///  valid during the call only
+typedef int (*ErfsGlobFn) (const ErfsRoot fs, const ErfsHandle entry, const uint8_t *path, uint32_t path_len, void* ctx);
+
+/// find the entries matching a pattern, the entries of a directory in name order. the pattern is split by '/',
+/// and each part is matched against the names of a directory like fnmatch(): '*', '?', "[a-z]", "[!a-z]"
+/// and '\' to escape; a part "**" matches any number of directories (none too). A trailing '/' matches
+/// directories only. Only the entries starting with the literal prefix of a part are read, by
+/// erfs_find_prefix(), so "locales/en/*.json" doesn't scan the other directories.
+///@param fs the file system
+///@param pattern e.g. "/templates/**/*.html", the leading '/' is optional
+///@param pattern_len length of the pattern
+///@param func callback function
+///@param ctx context
+///@return 0 for success; the first non zero result of func, which stops the search
+int erfs_glob(const ErfsRoot fs, const uint8_t *pattern, uint32_t pattern_len, ErfsGlobFn func, void* ctx);
+
+/// read a regular file, decompressed if it has a codec (see erfs_entrycodec()).
+/// the content is inflated once and kept in a process-wide cache, later reads of a
+/// cached file are lock free.
+///@param fs the file system
+///@param entry the file
+///@param out pointer to the decoded content, valid until erfs_release_decoded()
+///@param size decoded size
+///@return 0 for success
+int erfs_read_decoded(const ErfsRoot fs, const ErfsHandle entry, const uint8_t **out, uint32_t *size);
+
+/// release the content returned by erfs_read_decoded
+///@param fs the file system
+///@param entry the file
+///@param data the content returned by erfs_read_decoded
+///@return 0 for success
+int erfs_release_decoded(const ErfsRoot fs, const ErfsHandle entry, const uint8_t *data);
+
+/// read a part of a regular file, decoded if it has a codec.
+/// only the blocks covering the range are decoded for ERFS_CHUNKED files,
+/// other compressed files are decoded whole by erfs_read_decoded().
+///@param fs the file system
+///@param entry the file
+///@param offset offset in the decoded content
+///@param buf buffer of the caller
+///@param len bytes to read
+///@param read [out] bytes written to buf, less than len only at the end of the file
+///@return 0 for success
+int erfs_pread(const ErfsRoot fs, const ErfsHandle entry, uint32_t offset, uint8_t *buf, uint32_t len, uint32_t *read);
+
+/// set the memory budget of the decoded content cache (64MB by default),
+/// contents not used recently are evicted when the budget is exceeded.
+///@param budget max bytes of decoded contents, 0 disables the cache
+///@return 0 for success
+int erfs_cache_config(uint32_t budget);
+
+/// drop the decoded contents of a file system from the cache
+///@param fs the file system
+///@return 0 for success; ERFS_BUSY if some contents are still held by erfs_read_decoded() callers
+int erfs_cache_purge(const ErfsRoot fs);
+
+/// mount an image file generated by `erfs_gen --image`.
+/// the file is mapped read-only and paged in on demand.
+///@param path path of the image file
+///@param root [out] the file system, to be released by erfs_unmount()
+///@return 0 for success
+int erfs_mount_file(const char *path, ErfsRoot *root);
+
+/// unmount a file system mounted by erfs_mount_file
+///@param root the file system
+///@return 0 for success; ERFS_BUSY if some decoded contents are not released
+int erfs_unmount(ErfsRoot root);
+
+/// a file being read by pieces
+typedef struct ErfsStream ErfsStream;
+
+/// open a file to be read by pieces, decoded if it has a codec.
+/// the memory used doesn't depend on the file size, except ERFS_LZ4 files which are decoded on open
+/// (unless ERFS_CHUNKED).
+///@param fs the file system
+///@param entry the file
+///@param stream [out] the stream, to be released by erfs_stream_close()
+///@return 0 for success
+int erfs_stream_open(const ErfsRoot fs, const ErfsHandle entry, ErfsStream **stream);
+
+/// read the next piece of the decoded content
+///@param stream the stream
+///@param buf buffer of the caller
+///@param size size of buf
+///@param read [out] bytes written to buf, less than size only at the end of the file; 0 at the end
+///@return 0 for success; ERFS_DECODE_FAIL if the data are corrupted
+int erfs_stream_read(ErfsStream *stream, uint8_t *buf, uint32_t size, uint32_t *read);
+
+/// release a stream opened by erfs_stream_open
+///@param stream the stream
+///@return 0 for success
+int erfs_stream_close(ErfsStream *stream);
+
+/// open a file as a read-only FILE, for the libraries taking a FILE only; nothing is written to disk.
+/// a stored file is read in place (fmemopen), a compressed one is decoded on the fly by pieces;
+/// fseek() backward in a compressed file decodes it again from the start, unless ERFS_CHUNKED.
+/// like a stream, it must be closed by fclose() before erfs_unmount().
+///@param fs the file system
+///@param path the file name
+///@param path_len length of the file name
+///@param file [out] the FILE, to be closed by fclose()
+///@return 0 for success; ERFS_UNSUPPORTED for a compressed file without fopencookie() (glibc)
+int erfs_fopen(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, FILE **file);
+
+/// copy the decoded content of a file to a memfd sealed against any change, for the libraries
+/// taking a file descriptor only, or to pass it to another process; nothing is written to disk.
+///@param fs the file system
+///@param path the file name
+///@param path_len length of the file name
+///@param fd [out] the file descriptor at offset 0, with O_CLOEXEC, to be closed by close()
+///@return 0 for success; ERFS_IO_ERROR if the memfd can't be created; ERFS_UNSUPPORTED if not on Linux
+int erfs_memfd(const ErfsRoot fs, const uint8_t *path, uint32_t path_len, int *fd);
+
+///
+/// formats of erfs_stats_dump()
+///
+enum ErfsStatsFormat {
+    ERFS_STATS_JSON              = 0,
+    // Prometheus text exposition format
+    ERFS_STATS_PROMETHEUS        = 1,
+};
+
+/// write the access statistics of a file system, if the runtime is built with ERFS_STATS:
+/// hits and misses of erfs_open() (with erfs_open_many()) and erfs_read(), their latency histograms
+/// (buckets of powers of two ns), and the accesses of each entry opened at least once.
+/// without ERFS_STATS, nothing is counted and nothing costs.
+///@param fs the file system
+///@param format ERFS_STATS_JSON or ERFS_STATS_PROMETHEUS
+///@param out where to write, e.g. a FILE of open_memstream()
+///@return 0 for success; ERFS_UNSUPPORTED if the runtime is built without ERFS_STATS
+int erfs_stats_dump(const ErfsRoot fs, int format, FILE *out);
+
+/// set the access statistics of a file system to zero
+///@param fs the file system
+///@return 0 for success; ERFS_UNSUPPORTED if the runtime is built without ERFS_STATS
+int erfs_stats_reset(const ErfsRoot fs);
+
 #if defined(__cplusplus)
 }
 #endif
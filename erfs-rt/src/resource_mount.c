@@ -0,0 +1,197 @@
+#define __ERFS_IMPL__
+#include "resource_fs.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHECK_NULL(V)       if(V == 0) {return ERFS_INVALID_INPUT;}
+
+///
+/// a mounted image, `fs` must be the first member
+///
+typedef struct {
+    ErfsFileSystem fs;
+    void *map;
+    size_t map_size;
+} ErfsMount;
+
+/// check [offset, offset + count * size) is inside the image
+static int section_ok(uint64_t offset, uint64_t count, uint64_t size, uint64_t image_size) {
+    if (offset > image_size) {
+        return 0;
+    }
+    return count <= (image_size - offset) / size;
+}
+
+/// check that all offsets of the entries and the hash index stay inside the image,
+/// so a corrupted file can't make the access api read out of the mapping.
+static int erfs_validate(const ErfsFileSystem *fs) {
+    if (fs->entry_count == 0 || (fs->entries[0].flags & ERFS_DIRECTORY) == 0) {
+        return ERFS_INVALID_IMAGE;
+    }
+    const uint32_t wide = (fs->entry_size != 0) ? ERFS_WIDE : 0;
+    for (uint32_t i = 0; i < fs->entry_count; i++) {
+        const ErfsEntry *e = erfs_entry_at(fs, i);
+        // entries of a wide image are all ErfsEntry64
+        if ((e->flags & ERFS_WIDE) != wide) {
+            return ERFS_INVALID_IMAGE;
+        }
+        if (e->name_offset > fs->data_size || e->name_size > fs->data_size - e->name_offset) {
+            return ERFS_INVALID_IMAGE;
+        }
+        if ((e->flags & ERFS_DICT) != 0 && fs->dict_size == 0) {
+            return ERFS_INVALID_IMAGE;
+        }
+        if ((e->flags & ERFS_DIRECTORY) != 0) {
+            // children always follow their parent, so there are no cycles
+            if (e->data_size > 0 && (erfs_data_offset(e) <= i || erfs_data_offset(e) > fs->entry_count
+                    || e->data_size > fs->entry_count - e->data_offset)) {
+                return ERFS_INVALID_IMAGE;
+            }
+        } else if (erfs_data_offset(e) > fs->data_size || e->data_size > fs->data_size - erfs_data_offset(e)) {
+            return ERFS_INVALID_IMAGE;
+        }
+    }
+
+    if (fs->dict_offset > fs->data_size || fs->dict_size > fs->data_size - fs->dict_offset) {
+        return ERFS_INVALID_IMAGE;
+    }
+    if ((fs->hash_slot_count == 0) != (fs->hash_bucket_count == 0)) {
+        return ERFS_INVALID_IMAGE;
+    }
+    for (uint32_t i = 0; fs->lookup != 0 && i < fs->entry_count; i++) {
+        if (fs->lookup[i].entry >= fs->entry_count) {
+            return ERFS_INVALID_IMAGE;
+        }
+    }
+    for (uint32_t i = 0; i < fs->hash_slot_count; i++) {
+        const ErfsHashSlot *slot = fs->hash_slots + i;
+        if (slot->entry >= fs->entry_count || slot->path_offset > fs->data_size
+                || slot->path_size > fs->data_size - slot->path_offset) {
+            return ERFS_INVALID_IMAGE;
+        }
+    }
+    return ERFS_OK;
+}
+
+/// mount an image file generated by `erfs_gen --image`.
+///@param path path of the image file
+///@param root [out] the file system, to be released by erfs_unmount()
+///@return ERFS_OK for success
+int erfs_mount_file(const char *path, ErfsRoot *root) {
+    CHECK_NULL(path);
+    CHECK_NULL(root);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ERFS_NOT_FOUND;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return ERFS_IO_ERROR;
+    }
+    if ((uint64_t)st.st_size < 12) {
+        close(fd);
+        return ERFS_INVALID_IMAGE;
+    }
+    size_t map_size = (size_t)st.st_size;
+    uint8_t *map = (uint8_t *)mmap(0, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return ERFS_IO_ERROR;
+    }
+
+    // an older header is shorter, the missing fields are 0
+    ErfsImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(&header, map, 12);
+    // an image of the other byte order has its version byte swapped, so it's rejected here
+    if (memcmp(header.magic, ERFS_IMAGE_MAGIC, 4) != 0
+            || (header.version != ERFS_IMAGE_VERSION && header.version != ERFS_IMAGE_VERSION_WIDE)
+            || header.header_size < 12 || header.header_size > map_size) {
+        munmap(map, map_size);
+        return ERFS_INVALID_IMAGE;
+    }
+    memcpy(&header, map, (header.header_size < sizeof(header)) ? header.header_size : sizeof(header));
+
+    uint32_t entry_size = sizeof(ErfsEntry);
+    uint64_t data_size = header.data_size;
+    if (header.version == ERFS_IMAGE_VERSION_WIDE) {
+        entry_size = sizeof(ErfsEntry64);
+        data_size = header.data_size64;
+    }
+    if (!section_ok(header.entries_offset, header.entry_count, entry_size, map_size)
+            || !section_ok(header.data_offset, data_size, 1, map_size)
+            || !section_ok(header.hash_buckets_offset, header.hash_bucket_count, sizeof(uint32_t), map_size)
+            || !section_ok(header.hash_slots_offset, header.hash_slot_count, sizeof(ErfsHashSlot), map_size)
+            || !section_ok(header.lookup_offset, (header.lookup_offset != 0) ? header.entry_count : 0, sizeof(ErfsLookup), map_size)
+            || !section_ok(header.file_info_offset, (header.file_info_offset != 0) ? header.entry_count : 0,
+                sizeof(ErfsFileInfo), map_size)) {
+        munmap(map, map_size);
+        return ERFS_INVALID_IMAGE;
+    }
+
+    ErfsMount *mount = (ErfsMount *)calloc(1, sizeof(ErfsMount));
+    if (mount == 0) {
+        munmap(map, map_size);
+        return ERFS_NO_MEMORY;
+    }
+    mount->map = map;
+    mount->map_size = map_size;
+
+    ErfsFileSystem *fs = &mount->fs;
+    fs->entry_count = header.entry_count;
+    fs->entries = (ErfsEntry *)(map + header.entries_offset);
+    fs->entry_size = (entry_size != sizeof(ErfsEntry)) ? entry_size : 0;
+    fs->data_size = data_size;
+    fs->data = map + header.data_offset;
+    fs->hash_seed = header.hash_seed;
+    fs->hash_bucket_count = header.hash_bucket_count;
+    fs->hash_buckets = (uint32_t *)(map + header.hash_buckets_offset);
+    fs->hash_slot_count = header.hash_slot_count;
+    fs->hash_slots = (ErfsHashSlot *)(map + header.hash_slots_offset);
+    if (header.lookup_offset != 0) {
+        fs->lookup = (ErfsLookup *)(map + header.lookup_offset);
+    }
+    if (header.file_info_offset != 0) {
+        fs->file_info = (ErfsFileInfo *)(map + header.file_info_offset);
+    }
+    fs->dict_offset = header.dict_offset;
+    fs->dict_size = header.dict_size;
+
+    int result = erfs_validate(fs);
+    if (result != ERFS_OK) {
+        free(mount);
+        munmap(map, map_size);
+        return result;
+    }
+
+    *root = fs;
+    return ERFS_OK;
+}
+
+/// unmount a file system mounted by erfs_mount_file
+///@param root the file system
+///@return ERFS_OK for success; ERFS_BUSY if some decoded contents are not released
+int erfs_unmount(ErfsRoot root) {
+    CHECK_NULL(root);
+
+    // the cache is keyed by entry address, which may be reused by a later mapping
+    int result = erfs_cache_purge(root);
+    if (result != ERFS_OK) {
+        return result;
+    }
+
+#if defined(ERFS_STATS)
+    erfs_stats_release(root);
+#endif
+    ErfsMount *mount = (ErfsMount *)root;
+    munmap(mount->map, mount->map_size);
+    free(mount);
+    return ERFS_OK;
+}
@@ -0,0 +1,360 @@
+#define __ERFS_IMPL__
+#include "resource_fs.h"
+
+#define CHECK_NULL(V)       if(V == 0) {return ERFS_INVALID_INPUT;}
+
+#if defined(ERFS_STATS)
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// file systems with statistics at the same time, the others are not counted
+#define ERFS_STATS_MAX_FS   64
+// bucket i counts the calls of less than 2^i ns, the last one the slower ones
+#define ERFS_STATS_BUCKETS  32
+
+typedef struct {
+    atomic_uint_fast64_t hits;
+    atomic_uint_fast64_t misses;
+    // latency of the calls timed by erfs_stats_record()
+    atomic_uint_fast64_t nanos;
+    atomic_uint_fast64_t buckets[ERFS_STATS_BUCKETS];
+} ErfsOpStats;
+
+///
+/// counters of a file system, allocated on its first access
+///
+typedef struct {
+    ErfsOpStats ops[ERFS_STATS_OPS];
+    uint32_t entry_count;
+    // accesses by entry ordinal
+    atomic_uint_fast32_t entries[];
+} ErfsStats;
+
+/// stats is set before fs is published, so a slot owned by a file system always has its counters
+typedef struct {
+    _Atomic(const ErfsFileSystem *) fs;
+    _Atomic(ErfsStats *) stats;
+} ErfsStatsSlot;
+
+static ErfsStatsSlot erfs_stats_slots[ERFS_STATS_MAX_FS];
+// serializes the claims and releases of slots, the lookups are lock free
+static pthread_mutex_t erfs_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *const erfs_stats_op_names[ERFS_STATS_OPS] = {"open", "read"};
+
+uint64_t erfs_stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/// the slot owned by fs, 0 if none
+static ErfsStatsSlot *erfs_stats_slot(const ErfsFileSystem *fs) {
+    for (uint32_t i = 0; i < ERFS_STATS_MAX_FS; i++) {
+        if (atomic_load_explicit(&erfs_stats_slots[i].fs, memory_order_acquire) == fs) {
+            return erfs_stats_slots + i;
+        }
+    }
+    return 0;
+}
+
+/// the counters of fs, allocated if `create` and there is a free slot
+static ErfsStats *erfs_stats_of(const ErfsFileSystem *fs, int create) {
+    ErfsStatsSlot *slot = erfs_stats_slot(fs);
+    if (slot != 0 || !create) {
+        return (slot != 0) ? atomic_load_explicit(&slot->stats, memory_order_relaxed) : 0;
+    }
+
+    // check again under the lock, another thread may have claimed a slot for fs since
+    ErfsStats *stats = 0;
+    pthread_mutex_lock(&erfs_stats_lock);
+    slot = erfs_stats_slot(fs);
+    if (slot != 0) {
+        stats = atomic_load_explicit(&slot->stats, memory_order_relaxed);
+    } else {
+        for (uint32_t i = 0; i < ERFS_STATS_MAX_FS; i++) {
+            slot = erfs_stats_slots + i;
+            if (atomic_load_explicit(&slot->fs, memory_order_relaxed) != 0) {
+                continue;
+            }
+            stats = (ErfsStats *)calloc(1, sizeof(ErfsStats) + fs->entry_count * sizeof(atomic_uint_fast32_t));
+            if (stats != 0) {
+                stats->entry_count = fs->entry_count;
+                atomic_store_explicit(&slot->stats, stats, memory_order_relaxed);
+                atomic_store_explicit(&slot->fs, fs, memory_order_release);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&erfs_stats_lock);
+    return stats;
+}
+
+static void stats_count(ErfsStats *stats, const ErfsFileSystem *fs, int op, ErfsHandle entry) {
+    if (entry == 0) {
+        atomic_fetch_add_explicit(&stats->ops[op].misses, 1, memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&stats->ops[op].hits, 1, memory_order_relaxed);
+    uint32_t ordinal = erfs_entry_ordinal(fs, entry);
+    if (ordinal < stats->entry_count) {
+        atomic_fetch_add_explicit(stats->entries + ordinal, 1, memory_order_relaxed);
+    }
+}
+
+void erfs_stats_count(const ErfsFileSystem *fs, int op, ErfsHandle entry) {
+    ErfsStats *stats = erfs_stats_of(fs, 1);
+    if (stats != 0) {
+        stats_count(stats, fs, op, entry);
+    }
+}
+
+void erfs_stats_record(const ErfsFileSystem *fs, int op, ErfsHandle entry, uint64_t start) {
+    uint64_t nanos = erfs_stats_now() - start;
+    ErfsStats *stats = (fs != 0) ? erfs_stats_of(fs, 1) : 0;
+    if (stats == 0) {
+        return;
+    }
+    stats_count(stats, fs, op, entry);
+    uint32_t bucket = (nanos == 0) ? 0 : 64 - (uint32_t)__builtin_clzll(nanos);
+    if (bucket >= ERFS_STATS_BUCKETS) {
+        bucket = ERFS_STATS_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&stats->ops[op].nanos, nanos, memory_order_relaxed);
+    atomic_fetch_add_explicit(stats->ops[op].buckets + bucket, 1, memory_order_relaxed);
+}
+
+void erfs_stats_release(const ErfsFileSystem *fs) {
+    pthread_mutex_lock(&erfs_stats_lock);
+    ErfsStatsSlot *slot = erfs_stats_slot(fs);
+    if (slot != 0) {
+        atomic_store(&slot->fs, 0);
+        free(atomic_exchange(&slot->stats, 0));
+    }
+    pthread_mutex_unlock(&erfs_stats_lock);
+}
+
+/// write a string with the escapes of JSON, or of a Prometheus label value
+static void stats_escape(FILE *out, const char *s, size_t len, int json) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            fputc('\\', out);
+            fputc(c, out);
+        } else if (c == '\n') {
+            fputs("\\n", out);
+        } else if (json && c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+}
+
+///
+/// state of the dump of the entry counters, the path of the current directory is built as the tree is traveled
+///
+typedef struct {
+    ErfsStats *stats;
+    FILE *out;
+    int format;
+    char *path;
+    size_t path_len;
+    size_t capacity;
+    // length of the path of each directory entered, to go back on leave
+    size_t *lens;
+    uint32_t depth;
+    uint32_t max_depth;
+    uint32_t written;
+} ErfsStatsDump;
+
+/// append "/name" to the path, the root being ""
+static int dump_push(ErfsStatsDump *dump, const ErfsFileSystem *fs, ErfsHandle entry) {
+    if (dump->depth == dump->max_depth) {
+        uint32_t max_depth = (dump->max_depth > 0) ? 2 * dump->max_depth : 16;
+        size_t *lens = (size_t *)realloc(dump->lens, max_depth * sizeof(size_t));
+        if (lens == 0) {
+            return ERFS_NO_MEMORY;
+        }
+        dump->lens = lens;
+        dump->max_depth = max_depth;
+    }
+    dump->lens[dump->depth++] = dump->path_len;
+    if (entry == fs->entries) {
+        return ERFS_OK;
+    }
+
+    const uint8_t *name;
+    uint32_t name_size;
+    erfs_entryname(fs, entry, &name, &name_size);
+    if (dump->path_len + name_size + 2 > dump->capacity) {
+        size_t capacity = 2 * (dump->path_len + name_size + 2);
+        char *path = (char *)realloc(dump->path, capacity);
+        if (path == 0) {
+            return ERFS_NO_MEMORY;
+        }
+        dump->path = path;
+        dump->capacity = capacity;
+    }
+    dump->path[dump->path_len++] = '/';
+    memcpy(dump->path + dump->path_len, name, name_size);
+    dump->path_len += name_size;
+    return ERFS_OK;
+}
+
+static int dump_visit(const ErfsRoot fs, const ErfsHandle entry, enum ErfsTravelType type, void *ctx) {
+    ErfsStatsDump *dump = (ErfsStatsDump *)ctx;
+    if (type == ERFS_TRAVEL_DIR_LEAVE) {
+        dump->path_len = dump->lens[--dump->depth];
+        return ERFS_OK;
+    }
+    int result = dump_push(dump, fs, entry);
+    if (result != ERFS_OK) {
+        return result;
+    }
+
+    uint32_t ordinal = erfs_entry_ordinal(fs, entry);
+    uint32_t count = (ordinal < dump->stats->entry_count)
+        ? (uint32_t)atomic_load_explicit(dump->stats->entries + ordinal, memory_order_relaxed) : 0;
+    if (count > 0) {
+        const char *path = (dump->path_len > 0) ? dump->path : "/";
+        size_t len = (dump->path_len > 0) ? dump->path_len : 1;
+        if (dump->format == ERFS_STATS_JSON) {
+            fputs((dump->written++ > 0) ? ",\n    {\"path\": \"" : "\n    {\"path\": \"", dump->out);
+            stats_escape(dump->out, path, len, 1);
+            fprintf(dump->out, "\", \"count\": %u}", count);
+        } else {
+            fputs("erfs_entry_access_total{path=\"", dump->out);
+            stats_escape(dump->out, path, len, 0);
+            fprintf(dump->out, "\"} %u\n", count);
+        }
+    }
+
+    if (type == ERFS_TRAVEL_FILE) {
+        dump->path_len = dump->lens[--dump->depth];
+    }
+    return ERFS_OK;
+}
+
+static void dump_op_json(FILE *out, const ErfsOpStats *op, const char *name) {
+    fprintf(out, "  \"%s\": {\"hits\": %llu, \"misses\": %llu, \"latency_ns\": {\"sum\": %llu, \"buckets\": [", name,
+        (unsigned long long)atomic_load(&op->hits), (unsigned long long)atomic_load(&op->misses),
+        (unsigned long long)atomic_load(&op->nanos));
+    int first = 1;
+    for (uint32_t b = 0; b < ERFS_STATS_BUCKETS; b++) {
+        uint64_t count = atomic_load(op->buckets + b);
+        if (count == 0) {
+            continue;
+        }
+        // upper bound of the bucket, the last one has none
+        if (b + 1 < ERFS_STATS_BUCKETS) {
+            fprintf(out, "%s{\"lt\": %llu, \"count\": %llu}", first ? "" : ", ", 1ULL << b, (unsigned long long)count);
+        } else {
+            fprintf(out, "%s{\"lt\": null, \"count\": %llu}", first ? "" : ", ", (unsigned long long)count);
+        }
+        first = 0;
+    }
+    fputs("]}},\n", out);
+}
+
+static void dump_op_prometheus(FILE *out, const ErfsOpStats *op, const char *name) {
+    fprintf(out, "# TYPE erfs_%s_total counter\n", name);
+    fprintf(out, "erfs_%s_total{result=\"hit\"} %llu\n", name, (unsigned long long)atomic_load(&op->hits));
+    fprintf(out, "erfs_%s_total{result=\"miss\"} %llu\n", name, (unsigned long long)atomic_load(&op->misses));
+
+    fprintf(out, "# TYPE erfs_%s_latency_seconds histogram\n", name);
+    uint64_t cumulative = 0;
+    for (uint32_t b = 0; b + 1 < ERFS_STATS_BUCKETS; b++) {
+        cumulative += atomic_load(op->buckets + b);
+        fprintf(out, "erfs_%s_latency_seconds_bucket{le=\"%.9g\"} %llu\n", name, (double)(1ULL << b) * 1e-9,
+            (unsigned long long)cumulative);
+    }
+    cumulative += atomic_load(op->buckets + ERFS_STATS_BUCKETS - 1);
+    fprintf(out, "erfs_%s_latency_seconds_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+    fprintf(out, "erfs_%s_latency_seconds_sum %.9g\n", name, (double)atomic_load(&op->nanos) * 1e-9);
+    fprintf(out, "erfs_%s_latency_seconds_count %llu\n", name, (unsigned long long)cumulative);
+}
+#endif // defined(ERFS_STATS)
+
+/// write the access statistics of a file system, see resource_fs.h
+///@param fs the file system
+///@param format ERFS_STATS_JSON or ERFS_STATS_PROMETHEUS
+///@param out where to write
+///@return ERFS_OK for success; ERFS_UNSUPPORTED if the runtime is built without ERFS_STATS
+int erfs_stats_dump(const ErfsRoot fs, int format, FILE *out) {
+    CHECK_NULL(fs);
+    CHECK_NULL(out);
+#if defined(ERFS_STATS)
+    if (format != ERFS_STATS_JSON && format != ERFS_STATS_PROMETHEUS) {
+        return ERFS_INVALID_INPUT;
+    }
+    ErfsStats *stats = erfs_stats_of(fs, 1);
+    if (stats == 0) {
+        return ERFS_NO_MEMORY;
+    }
+
+    if (format == ERFS_STATS_JSON) {
+        fputs("{\n", out);
+        for (int op = 0; op < ERFS_STATS_OPS; op++) {
+            dump_op_json(out, stats->ops + op, erfs_stats_op_names[op]);
+        }
+        fputs("  \"entries\": [", out);
+    } else {
+        for (int op = 0; op < ERFS_STATS_OPS; op++) {
+            dump_op_prometheus(out, stats->ops + op, erfs_stats_op_names[op]);
+        }
+        fputs("# TYPE erfs_entry_access_total counter\n", out);
+    }
+
+    ErfsStatsDump dump;
+    memset(&dump, 0, sizeof(dump));
+    dump.stats = stats;
+    dump.out = out;
+    dump.format = format;
+    int result = erfs_travel(fs, dump_visit, &dump);
+    free(dump.path);
+    free(dump.lens);
+
+    if (format == ERFS_STATS_JSON) {
+        fputs((dump.written > 0) ? "\n  ]\n}\n" : "]\n}\n", out);
+    }
+    if (result == ERFS_OK && ferror(out)) {
+        result = ERFS_IO_ERROR;
+    }
+    return result;
+#else
+    (void)format;
+    return ERFS_UNSUPPORTED;
+#endif
+}
+
+/// set the access statistics of a file system to zero
+///@param fs the file system
+///@return ERFS_OK for success; ERFS_UNSUPPORTED if the runtime is built without ERFS_STATS
+int erfs_stats_reset(const ErfsRoot fs) {
+    CHECK_NULL(fs);
+#if defined(ERFS_STATS)
+    ErfsStats *stats = erfs_stats_of(fs, 0);
+    if (stats == 0) {
+        return ERFS_OK;
+    }
+    for (int op = 0; op < ERFS_STATS_OPS; op++) {
+        ErfsOpStats *o = stats->ops + op;
+        atomic_store(&o->hits, 0);
+        atomic_store(&o->misses, 0);
+        atomic_store(&o->nanos, 0);
+        for (uint32_t b = 0; b < ERFS_STATS_BUCKETS; b++) {
+            atomic_store(o->buckets + b, 0);
+        }
+    }
+    for (uint32_t i = 0; i < stats->entry_count; i++) {
+        atomic_store(stats->entries + i, 0);
+    }
+    return ERFS_OK;
+#else
+    return ERFS_UNSUPPORTED;
+#endif
+}
@@ -0,0 +1,278 @@
+#define __ERFS_IMPL__
+#include "resource_fs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "zlib.h"
+#if defined(ERFS_WITH_ZSTD)
+#include <zstd.h>
+#endif
+#if defined(ERFS_WITH_LZ4)
+#include <lz4.h>
+#endif
+
+#define CHECK_NULL(V)       if(V == 0) {return ERFS_INVALID_INPUT;}
+
+///
+/// a file being decoded by pieces.
+/// the input is the mapped/embedded data, so only the decoder state is allocated:
+/// about 40KB for gzip, the window (up to 8MB for -19) for zstd, a block for ERFS_CHUNKED files.
+///
+struct ErfsStream {
+    const ErfsFileSystem *fs;
+    ErfsHandle entry;
+    // the codec, or ERFS_CHUNKED for chunked files of any codec
+    uint32_t codec;
+    // dictionary of an ERFS_DICT file
+    const uint8_t *dict;
+    // stored files: bytes returned; lz4: bytes of `decoded` returned; chunked: offset of `decoded`
+    uint32_t offset;
+    int done;
+
+    z_stream z;
+#if defined(ERFS_WITH_ZSTD)
+    ZSTD_DStream *zstd;
+    ZSTD_inBuffer zstd_in;
+#endif
+    // lz4 blocks can't be decoded by pieces, the whole file is decoded on open.
+    // chunked: the current block
+    uint8_t *decoded;
+    uint32_t decoded_size;
+    uint32_t decoded_pos;
+    uint32_t chunk_size;
+};
+
+/// open a file to be read by pieces, decoded if it has a codec.
+///@param fs the file system
+///@param handle the file
+///@param out [out] the stream, to be released by erfs_stream_close()
+///@return ERFS_OK for success
+int erfs_stream_open(const ErfsRoot fs, const ErfsHandle handle, ErfsStream **out) {
+    CHECK_NULL(fs);
+    CHECK_NULL(handle);
+    CHECK_NULL(out);
+    if ((handle->flags & ERFS_DIRECTORY) != 0) {
+        return ERFS_NOT_FILE;
+    }
+
+    ErfsStream *stream = (ErfsStream *)calloc(1, sizeof(ErfsStream));
+    if (stream == 0) {
+        return ERFS_NO_MEMORY;
+    }
+    stream->fs = fs;
+    stream->entry = handle;
+    stream->codec = ((handle->flags & ERFS_CHUNKED) != 0) ? ERFS_CHUNKED : handle->flags & ERFS_CODEC_MASK;
+
+    const uint8_t *src = fs->data + erfs_data_offset(handle);
+    int result = ERFS_OK;
+    if ((handle->flags & ERFS_DICT) != 0) {
+        if (fs->dict_size == 0) {
+            erfs_stream_close(stream);
+            return ERFS_DECODE_FAIL;
+        }
+        stream->dict = fs->data + fs->dict_offset;
+    }
+    switch (stream->codec) {
+    case 0:
+        break;
+    case ERFS_CHUNKED:
+        // the block index is checked by erfs_pread
+        stream->chunk_size = (handle->data_size >= 12)
+            ? (uint32_t)src[4] | ((uint32_t)src[5] << 8) | ((uint32_t)src[6] << 16) | ((uint32_t)src[7] << 24) : 0;
+        if (stream->chunk_size == 0) {
+            result = ERFS_DECODE_FAIL;
+            break;
+        }
+        stream->decoded = (uint8_t *)malloc(stream->chunk_size);
+        if (stream->decoded == 0) {
+            result = ERFS_NO_MEMORY;
+        }
+        break;
+    case ERFS_GZIPPED:
+        // 32: detect gzip or zlib header automatically
+        if (inflateInit2(&stream->z, 32 + MAX_WBITS) != Z_OK) {
+            result = ERFS_NO_MEMORY;
+            break;
+        }
+        stream->z.next_in = (Bytef *)src;
+        stream->z.avail_in = handle->data_size;
+        break;
+#if defined(ERFS_WITH_ZSTD)
+    case ERFS_ZSTD:
+        stream->zstd = ZSTD_createDStream();
+        if (stream->zstd == 0) {
+            result = ERFS_NO_MEMORY;
+            break;
+        }
+        ZSTD_initDStream(stream->zstd);
+        if (stream->dict != 0 && ZSTD_isError(ZSTD_DCtx_refPrefix(stream->zstd, stream->dict, fs->dict_size))) {
+            result = ERFS_NO_MEMORY;
+            break;
+        }
+        stream->zstd_in.src = src;
+        stream->zstd_in.size = handle->data_size;
+        stream->zstd_in.pos = 0;
+        break;
+#endif
+#if defined(ERFS_WITH_LZ4)
+    case ERFS_LZ4: {
+        uint32_t size = (handle->data_size >= 4)
+            ? (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24) : 0;
+        if (handle->data_size < 4 || size > 0x7FFFFFFF) {
+            result = ERFS_DECODE_FAIL;
+            break;
+        }
+        stream->decoded = (uint8_t *)malloc((size > 0) ? size : 1);
+        if (stream->decoded == 0) {
+            result = ERFS_NO_MEMORY;
+            break;
+        }
+        int n = (stream->dict != 0)
+            ? LZ4_decompress_safe_usingDict((const char *)src + 4, (char *)stream->decoded, (int)(handle->data_size - 4),
+                (int)size, (const char *)stream->dict, (int)fs->dict_size)
+            : LZ4_decompress_safe((const char *)src + 4, (char *)stream->decoded, (int)(handle->data_size - 4), (int)size);
+        if (n != (int)size) {
+            result = ERFS_DECODE_FAIL;
+            break;
+        }
+        stream->decoded_size = size;
+        break;
+    }
+#endif
+    default:
+        result = ERFS_UNSUPPORTED_CODEC;
+        break;
+    }
+
+    if (result != ERFS_OK) {
+        erfs_stream_close(stream);
+        return result;
+    }
+    *out = stream;
+    return ERFS_OK;
+}
+
+/// read the next piece of the decoded content
+///@param stream the stream
+///@param buf buffer of the caller
+///@param size size of buf
+///@param read [out] bytes written to buf, less than size only at the end of the file; 0 at the end
+///@return ERFS_OK for success; ERFS_DECODE_FAIL if the data are corrupted
+int erfs_stream_read(ErfsStream *stream, uint8_t *buf, uint32_t size, uint32_t *read) {
+    CHECK_NULL(stream);
+    CHECK_NULL(buf);
+    CHECK_NULL(read);
+    *read = 0;
+    if (stream->done || size == 0) {
+        return ERFS_OK;
+    }
+
+    ErfsHandle entry = stream->entry;
+    switch (stream->codec) {
+    case 0: {
+        uint32_t n = entry->data_size - stream->offset;
+        n = (n < size) ? n : size;
+        memcpy(buf, stream->fs->data + erfs_data_offset(entry) + stream->offset, n);
+        stream->offset += n;
+        stream->done = stream->offset == entry->data_size;
+        *read = n;
+        return ERFS_OK;
+    }
+    case ERFS_CHUNKED:
+        while (*read < size) {
+            if (stream->decoded_pos == stream->decoded_size) {
+                // next block, read whole so it's decoded in place
+                stream->offset += stream->decoded_size;
+                stream->decoded_pos = 0;
+                int result = erfs_pread(stream->fs, entry, stream->offset, stream->decoded, stream->chunk_size,
+                    &stream->decoded_size);
+                if (result != ERFS_OK) {
+                    stream->decoded_size = 0;
+                    return result;
+                }
+                if (stream->decoded_size == 0) {
+                    stream->done = 1;
+                    break;
+                }
+            }
+            uint32_t n = stream->decoded_size - stream->decoded_pos;
+            n = (n < size - *read) ? n : size - *read;
+            memcpy(buf + *read, stream->decoded + stream->decoded_pos, n);
+            stream->decoded_pos += n;
+            *read += n;
+        }
+        return ERFS_OK;
+    case ERFS_GZIPPED: {
+        z_stream *z = &stream->z;
+        z->next_out = buf;
+        z->avail_out = size;
+        while (z->avail_out > 0) {
+            int ret = inflate(z, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END) {
+                stream->done = 1;
+                break;
+            }
+            if (ret == Z_NEED_DICT && stream->dict != 0) {
+                ret = inflateSetDictionary(z, stream->dict, stream->fs->dict_size);
+            }
+            if (ret != Z_OK) {
+                // Z_BUF_ERROR: the input ended before the stream
+                return ERFS_DECODE_FAIL;
+            }
+        }
+        *read = size - z->avail_out;
+        return ERFS_OK;
+    }
+#if defined(ERFS_WITH_ZSTD)
+    case ERFS_ZSTD: {
+        ZSTD_outBuffer out = {buf, size, 0};
+        while (out.pos < out.size) {
+            size_t ret = ZSTD_decompressStream(stream->zstd, &out, &stream->zstd_in);
+            if (ZSTD_isError(ret)) {
+                return ERFS_DECODE_FAIL;
+            }
+            if (ret == 0) {
+                // end of the frame
+                stream->done = 1;
+                break;
+            }
+            if (stream->zstd_in.pos == stream->zstd_in.size && out.pos < out.size) {
+                // no more input for a frame not ended
+                return ERFS_DECODE_FAIL;
+            }
+        }
+        *read = (uint32_t)out.pos;
+        return ERFS_OK;
+    }
+#endif
+    default: {
+        // decoded on open
+        uint32_t n = stream->decoded_size - stream->offset;
+        n = (n < size) ? n : size;
+        memcpy(buf, stream->decoded + stream->offset, n);
+        stream->offset += n;
+        stream->done = stream->offset == stream->decoded_size;
+        *read = n;
+        return ERFS_OK;
+    }
+    }
+}
+
+/// release a stream opened by erfs_stream_open
+///@param stream the stream
+///@return ERFS_OK for success
+int erfs_stream_close(ErfsStream *stream) {
+    CHECK_NULL(stream);
+    if (stream->codec == ERFS_GZIPPED) {
+        inflateEnd(&stream->z);
+    }
+#if defined(ERFS_WITH_ZSTD)
+    if (stream->zstd != 0) {
+        ZSTD_freeDStream(stream->zstd);
+    }
+#endif
+    free(stream->decoded);
+    free(stream);
+    return ERFS_OK;
+}
@@ -0,0 +1,519 @@
+#define __ERFS_IMPL__
+#include "resource_fs.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECK_NULL(V)       if(V == 0) {return ERFS_INVALID_INPUT;}
+
+// a task visits at most this many entries of a directory, the rest is split to other tasks
+#define ERFS_TRAVEL_GRAIN       1024
+// upper bound of the workers
+#define ERFS_TRAVEL_MAX_THREADS 256
+
+///
+/// entries [begin, end) of a directory, `enter` if the directory itself is visited first
+///
+typedef struct {
+    ErfsHandle dir;
+    uint32_t begin;
+    uint32_t end;
+    int enter;
+} ErfsTravelTask;
+
+///
+/// tasks of a worker: the owner pushes and pops at the bottom, thieves take from the top,
+/// so the owner goes depth first and the others take the largest pending subtrees.
+///
+typedef struct {
+    pthread_mutex_t lock;
+    ErfsTravelTask *tasks;
+    uint32_t top;
+    uint32_t bottom;
+    uint32_t capacity;
+} ErfsTravelDeque;
+
+typedef struct {
+    const ErfsFileSystem *fs;
+    ErfsVisitFn func;
+    void *ctx;
+    uint32_t nthreads;
+    ErfsTravelDeque *deques;
+    // tasks pushed and not finished yet
+    atomic_uint_fast64_t pending;
+    // the first non zero result of a callback, stops all the workers
+    atomic_int result;
+    // a worker without a task sleeps on `idle` until a push bumps `epoch`, the walk ends or stops
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle;
+    atomic_uint_fast64_t epoch;
+    atomic_uint sleepers;
+} ErfsTravelPool;
+
+typedef struct {
+    ErfsTravelPool *pool;
+    uint32_t id;
+} ErfsTravelWorker;
+
+static int deque_push(ErfsTravelPool *pool, ErfsTravelDeque *deque, const ErfsTravelTask *task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom == deque->capacity) {
+        // compact, then grow
+        uint32_t count = deque->bottom - deque->top;
+        if (deque->top > 0) {
+            memmove(deque->tasks, deque->tasks + deque->top, count * sizeof(ErfsTravelTask));
+            deque->top = 0;
+            deque->bottom = count;
+        }
+        if (deque->bottom == deque->capacity) {
+            uint32_t capacity = (deque->capacity > 0) ? 2 * deque->capacity : 64;
+            ErfsTravelTask *tasks = (ErfsTravelTask *)realloc(deque->tasks, capacity * sizeof(ErfsTravelTask));
+            if (tasks == 0) {
+                pthread_mutex_unlock(&deque->lock);
+                return ERFS_NO_MEMORY;
+            }
+            deque->tasks = tasks;
+            deque->capacity = capacity;
+        }
+    }
+    atomic_fetch_add(&pool->pending, 1);
+    deque->tasks[deque->bottom++] = *task;
+    pthread_mutex_unlock(&deque->lock);
+
+    atomic_fetch_add(&pool->epoch, 1);
+    if (atomic_load(&pool->sleepers) > 0) {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_signal(&pool->idle);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+    return ERFS_OK;
+}
+
+/// wake all the sleeping workers, when the walk ends or stops
+static void pool_wake_all(ErfsTravelPool *pool) {
+    pthread_mutex_lock(&pool->idle_lock);
+    pthread_cond_broadcast(&pool->idle);
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+/// sleep until a task is pushed after `epoch`, or the walk ends or stops
+static void pool_wait(ErfsTravelPool *pool, uint64_t epoch) {
+    pthread_mutex_lock(&pool->idle_lock);
+    atomic_fetch_add(&pool->sleepers, 1);
+    while (atomic_load(&pool->epoch) == epoch && atomic_load(&pool->result) == 0 && atomic_load(&pool->pending) > 0) {
+        pthread_cond_wait(&pool->idle, &pool->idle_lock);
+    }
+    atomic_fetch_sub(&pool->sleepers, 1);
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+/// take a task from the bottom (owner) or the top (thief)
+static int deque_take(ErfsTravelDeque *deque, int steal, ErfsTravelTask *task) {
+    pthread_mutex_lock(&deque->lock);
+    int found = deque->bottom > deque->top;
+    if (found) {
+        *task = steal ? deque->tasks[deque->top++] : deque->tasks[--deque->bottom];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static void pool_stop(ErfsTravelPool *pool, int result) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&pool->result, &expected, result)) {
+        pool_wake_all(pool);
+    }
+}
+
+/// visit the entries of a task, subdirectories become new tasks
+static void travel_task(ErfsTravelPool *pool, ErfsTravelDeque *deque, ErfsTravelTask task) {
+    const ErfsFileSystem *fs = pool->fs;
+    int result = 0;
+    if (task.enter) {
+        result = (*pool->func)(fs, task.dir, ERFS_TRAVEL_DIR_ENTER, pool->ctx);
+    }
+
+    // a large directory is split, the other halves may be stolen
+    while (result == 0 && task.end - task.begin > ERFS_TRAVEL_GRAIN) {
+        uint32_t mid = task.begin + (task.end - task.begin) / 2;
+        ErfsTravelTask half = {task.dir, mid, task.end, 0};
+        result = deque_push(pool, deque, &half);
+        task.end = mid;
+    }
+
+    for (uint32_t i = task.begin; result == 0 && i < task.end; i++) {
+        if (atomic_load_explicit(&pool->result, memory_order_relaxed) != 0) {
+            return;
+        }
+        ErfsHandle entry = erfs_entry_at(fs, task.dir->data_offset + i);
+        if ((entry->flags & ERFS_DIRECTORY) != 0) {
+            ErfsTravelTask sub = {entry, 0, entry->data_size, 1};
+            result = deque_push(pool, deque, &sub);
+        } else {
+            result = (*pool->func)(fs, entry, ERFS_TRAVEL_FILE, pool->ctx);
+        }
+    }
+    if (result != 0) {
+        pool_stop(pool, result);
+    }
+}
+
+static void *travel_worker(void *arg) {
+    ErfsTravelWorker *worker = (ErfsTravelWorker *)arg;
+    ErfsTravelPool *pool = worker->pool;
+    ErfsTravelDeque *own = pool->deques + worker->id;
+
+    while (atomic_load(&pool->result) == 0 && atomic_load(&pool->pending) > 0) {
+        // read before looking for a task, so a push during the search isn't missed
+        uint64_t epoch = atomic_load(&pool->epoch);
+        ErfsTravelTask task;
+        int found = deque_take(own, 0, &task);
+        for (uint32_t i = 1; !found && i < pool->nthreads; i++) {
+            found = deque_take(pool->deques + (worker->id + i) % pool->nthreads, 1, &task);
+        }
+        if (!found) {
+            // the pending tasks are running on other workers, and may push more
+            pool_wait(pool, epoch);
+            continue;
+        }
+        travel_task(pool, own, task);
+        if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+            pool_wake_all(pool);
+        }
+    }
+    return 0;
+}
+
+/// travel the resource filesystem with `nthreads` workers, see resource_fs.h
+///@param fs the file system
+///@param nthreads number of workers including the caller, 0 for one per CPU
+///@param func callback function, must be thread safe
+///@param ctx context
+///@return ERFS_OK for success; the first non zero result of func
+int erfs_travel_parallel(const ErfsRoot fs, uint32_t nthreads, ErfsVisitFn func, void* ctx) {
+    CHECK_NULL(fs);
+    CHECK_NULL(func);
+
+    ErfsHandle root = fs->entries;
+    CHECK_NULL(root);
+    if ((root->flags & ERFS_DIRECTORY) == 0) {
+        return (*func)(fs, root, ERFS_TRAVEL_FILE, ctx);
+    }
+    if (nthreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (cpus > 0) ? (uint32_t)cpus : 1;
+    }
+    if (nthreads > ERFS_TRAVEL_MAX_THREADS) {
+        nthreads = ERFS_TRAVEL_MAX_THREADS;
+    }
+
+    ErfsTravelPool pool;
+    pool.fs = fs;
+    pool.func = func;
+    pool.ctx = ctx;
+    pool.nthreads = nthreads;
+    atomic_init(&pool.pending, 0);
+    atomic_init(&pool.result, 0);
+    atomic_init(&pool.epoch, 0);
+    atomic_init(&pool.sleepers, 0);
+    pool.deques = (ErfsTravelDeque *)calloc(nthreads, sizeof(ErfsTravelDeque));
+    ErfsTravelWorker *workers = (ErfsTravelWorker *)calloc(nthreads, sizeof(ErfsTravelWorker));
+    pthread_t *threads = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    if (pool.deques == 0 || workers == 0 || threads == 0) {
+        free(pool.deques);
+        free(workers);
+        free(threads);
+        return ERFS_NO_MEMORY;
+    }
+    pthread_mutex_init(&pool.idle_lock, 0);
+    pthread_cond_init(&pool.idle, 0);
+    for (uint32_t i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, 0);
+        workers[i].pool = &pool;
+        workers[i].id = i;
+    }
+
+    ErfsTravelTask task = {root, 0, root->data_size, 1};
+    int result = deque_push(&pool, pool.deques, &task);
+
+    // the caller is worker 0, fewer workers if a thread can't be created
+    uint32_t started = 1;
+    for (uint32_t i = 1; result == ERFS_OK && i < nthreads; i++) {
+        if (pthread_create(threads + i, 0, travel_worker, workers + i) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (result == ERFS_OK) {
+        travel_worker(workers);
+    }
+    for (uint32_t i = 1; i < started; i++) {
+        pthread_join(threads[i], 0);
+    }
+    if (result == ERFS_OK) {
+        result = atomic_load(&pool.result);
+    }
+
+    for (uint32_t i = 0; i < nthreads; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].tasks);
+    }
+    pthread_cond_destroy(&pool.idle);
+    pthread_mutex_destroy(&pool.idle_lock);
+    free(pool.deques);
+    free(workers);
+    free(threads);
+    return result;
+}
+
+// bytes of the path of erfs_glob() kept on the stack
+#define ERFS_GLOB_PATH      256
+
+///
+/// the state of erfs_glob(): the pattern, and the path of the directory being searched
+///
+typedef struct {
+    const ErfsFileSystem *fs;
+    ErfsGlobFn func;
+    void *ctx;
+    const uint8_t *pattern_end;
+    // a trailing '/' in the pattern
+    int dirs_only;
+    uint8_t *path;
+    uint32_t path_len;
+    uint32_t capacity;
+    uint8_t local[ERFS_GLOB_PATH];
+} ErfsGlob;
+
+/// match the class after a '[' against c, and set *next after its ']'
+///@return 1 if c is in the class; 0 if not; -1 if the class isn't closed, then '[' is a literal
+static int glob_class(const uint8_t *p, const uint8_t *end, uint8_t c, const uint8_t **next) {
+    int negate = 0;
+    if (p < end && (*p == '!' || *p == '^')) {
+        negate = 1;
+        p++;
+    }
+    // a ']' first is in the class
+    const uint8_t *start = p;
+    int matched = 0;
+    while (p < end && (*p != ']' || p == start)) {
+        uint8_t lo = *p++;
+        if (lo == '\\' && p < end) {
+            lo = *p++;
+        }
+        uint8_t hi = lo;
+        if (p + 1 < end && *p == '-' && p[1] != ']') {
+            p++;
+            hi = *p++;
+            if (hi == '\\' && p < end) {
+                hi = *p++;
+            }
+        }
+        if (lo <= c && c <= hi) {
+            matched = 1;
+        }
+    }
+    if (p == end) {
+        return -1;
+    }
+    *next = p + 1;
+    return matched != negate;
+}
+
+/// match a name against a part of the pattern, backtracking to the last '*' only
+static int glob_match(const uint8_t *p, const uint8_t *pend, const uint8_t *s, const uint8_t *send) {
+    const uint8_t *star = 0;
+    const uint8_t *resume = 0;
+    while (s < send) {
+        if (p < pend) {
+            if (*p == '*') {
+                star = ++p;
+                resume = s;
+                continue;
+            }
+            const uint8_t *next = p + 1;
+            int matched;
+            if (*p == '?') {
+                matched = 1;
+            } else if (*p == '[') {
+                matched = glob_class(p + 1, pend, *s, &next);
+                if (matched < 0) {
+                    matched = (*s == '[');
+                }
+            } else if (*p == '\\' && p + 1 < pend) {
+                matched = (p[1] == *s);
+                next = p + 2;
+            } else {
+                matched = (*p == *s);
+            }
+            if (matched) {
+                p = next;
+                s++;
+                continue;
+            }
+        }
+        if (star == 0) {
+            return 0;
+        }
+        // '*' takes one more byte
+        p = star;
+        s = ++resume;
+    }
+    while (p < pend && *p == '*') {
+        p++;
+    }
+    return p == pend;
+}
+
+/// append "/name" to the path
+///@return the length to restore; -1 if out of memory
+static int64_t glob_push(ErfsGlob *glob, ErfsHandle entry) {
+    uint32_t len = glob->path_len;
+    uint32_t size = len + 1 + entry->name_size + 1;
+    if (size > glob->capacity) {
+        uint32_t capacity = (size > 2 * glob->capacity) ? size : 2 * glob->capacity;
+        uint8_t *grown = (uint8_t *)malloc(capacity);
+        if (grown == 0) {
+            return -1;
+        }
+        memcpy(grown, glob->path, len);
+        if (glob->path != glob->local) {
+            free(glob->path);
+        }
+        glob->path = grown;
+        glob->capacity = capacity;
+    }
+    glob->path[len] = '/';
+    memcpy(glob->path + len + 1, glob->fs->data + entry->name_offset, entry->name_size);
+    glob->path_len = size - 1;
+    glob->path[glob->path_len] = 0;
+    return len;
+}
+
+/// report an entry matching the whole pattern
+static int glob_report(ErfsGlob *glob, ErfsHandle entry) {
+    if (glob->dirs_only && (entry->flags & ERFS_DIRECTORY) == 0) {
+        return ERFS_OK;
+    }
+    int64_t len = glob_push(glob, entry);
+    if (len < 0) {
+        return ERFS_NO_MEMORY;
+    }
+    int result = (*glob->func)(glob->fs, entry, glob->path, glob->path_len, glob->ctx);
+    glob->path_len = (uint32_t)len;
+    return result;
+}
+
+/// search the entries of `dir` for the pattern from `part`, which is not empty
+static int glob_dir(ErfsGlob *glob, ErfsHandle dir, const uint8_t *part) {
+    const ErfsFileSystem *fs = glob->fs;
+    const uint8_t *end = (const uint8_t *)memchr(part, '/', glob->pattern_end - part);
+    if (end == 0) {
+        end = glob->pattern_end;
+    }
+    const uint8_t *next = end;
+    while (next < glob->pattern_end && *next == '/') {
+        next++;
+    }
+    int last = (next == glob->pattern_end);
+    int result = ERFS_OK;
+
+    if (end - part == 2 && part[0] == '*' && part[1] == '*') {
+        // "**/**" is "**"
+        if (!last && glob->pattern_end - next >= 2 && next[0] == '*' && next[1] == '*'
+                && (next + 2 == glob->pattern_end || next[2] == '/')) {
+            return glob_dir(glob, dir, next);
+        }
+        // no directory, then each subdirectory; at the end, everything below
+        if (!last) {
+            result = glob_dir(glob, dir, next);
+        }
+        for (uint32_t i = 0; result == ERFS_OK && i < dir->data_size; i++) {
+            ErfsHandle entry = erfs_entry_at(fs, dir->data_offset + i);
+            if (last) {
+                result = glob_report(glob, entry);
+            }
+            if (result != ERFS_OK || (entry->flags & ERFS_DIRECTORY) == 0) {
+                continue;
+            }
+            int64_t len = glob_push(glob, entry);
+            if (len < 0) {
+                return ERFS_NO_MEMORY;
+            }
+            result = glob_dir(glob, entry, part);
+            glob->path_len = (uint32_t)len;
+        }
+        return result;
+    }
+
+    // only the names starting with the literal prefix of the part can match
+    const uint8_t *literal = part;
+    while (literal < end && *literal != '*' && *literal != '?' && *literal != '[' && *literal != '\\') {
+        literal++;
+    }
+    uint32_t first;
+    uint32_t count;
+    result = erfs_find_prefix(fs, dir, part, literal - part, &first, &count);
+    for (uint32_t i = first; result == ERFS_OK && i < first + count; i++) {
+        ErfsHandle entry = erfs_entry_at(fs, dir->data_offset + i);
+        const uint8_t *name = fs->data + entry->name_offset;
+        if (!glob_match(literal, end, name + (literal - part), name + entry->name_size)) {
+            continue;
+        }
+        if (last) {
+            result = glob_report(glob, entry);
+        } else if ((entry->flags & ERFS_DIRECTORY) != 0) {
+            int64_t len = glob_push(glob, entry);
+            if (len < 0) {
+                return ERFS_NO_MEMORY;
+            }
+            result = glob_dir(glob, entry, next);
+            glob->path_len = (uint32_t)len;
+        }
+    }
+    return result;
+}
+
+/// find the entries matching a pattern, see resource_fs.h
+///@param fs the file system
+///@param pattern e.g. "/templates/**/*.html"
+///@param pattern_len length of the pattern
+///@param func callback function
+///@param ctx context
+///@return 0 for success; the first non zero result of func
+int erfs_glob(const ErfsRoot fs, const uint8_t *pattern, uint32_t pattern_len, ErfsGlobFn func, void* ctx) {
+    CHECK_NULL(fs);
+    CHECK_NULL(func);
+    if (pattern_len > 0) {
+        CHECK_NULL(pattern);
+    }
+    ErfsGlob glob;
+    glob.fs = fs;
+    glob.func = func;
+    glob.ctx = ctx;
+    glob.pattern_end = pattern + pattern_len;
+    glob.dirs_only = pattern_len > 0 && pattern[pattern_len - 1] == '/';
+    glob.path = glob.local;
+    glob.path_len = 0;
+    glob.capacity = ERFS_GLOB_PATH;
+
+    const uint8_t *part = pattern;
+    while (part < glob.pattern_end && *part == '/') {
+        part++;
+    }
+    ErfsHandle root = fs->entries;
+    if (part == glob.pattern_end) {
+        // the root itself
+        glob.local[0] = '/';
+        glob.local[1] = 0;
+        return (*func)(fs, root, glob.local, 1, ctx);
+    }
+    int result = glob_dir(&glob, root, part);
+    if (glob.path != glob.local) {
+        free(glob.path);
+    }
+    return result;
+}
@@ -2,6 +2,38 @@
 #include "resource_fs.h"
 
 #include "erfs_rfsrc.h"
+#include "erfs_rfshash.h"
+#include "erfs_rfsblob.h"
+#include "erfs_rfseytz.h"
+#include "erfs_rfsauto.h"
+#include "erfs_rfschunk.h"
+#include "erfs_rfswide.h"
+#include "erfs_rfsdict.h"
+#include "erfs_rfsalign.h"
+#if defined(ERFS_WITH_ZSTD)
+#include "erfs_rfszstd.h"
+#endif
+#if defined(ERFS_WITH_LZ4)
+#include "erfs_rfslz4.h"
+#endif
+#include "zlib.h"
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
 
 
 namespace {
@@ -52,6 +84,31 @@ TEST(RFS, read_ok) {
     EXPECT_EQ(result, ERFS_OK);
 }
 
+TEST(RFS, read_duplicate) {
+    const uint8_t * buff;
+    const uint8_t * copy;
+    uint32_t size;
+    uint32_t copy_size;
+    EXPECT_EQ(erfs_read(fs, (const uint8_t *)"/tests/data/dup.txt", strlen("/tests/data/dup.txt"), &buff, &size), ERFS_OK);
+    EXPECT_EQ(erfs_read(fs, (const uint8_t *)"/tests/data/copy/dup.txt", strlen("/tests/data/copy/dup.txt"), &copy, &copy_size), ERFS_OK);
+
+    // identical files share the data
+    EXPECT_EQ(buff, copy);
+    EXPECT_EQ(size, copy_size);
+}
+
+TEST(RFS, read_non_ascii) {
+    // "\xc3\xa9" is sorted after ASCII names, as unsigned bytes
+    const char* paths[] = {"/tests/data/\xc3\xa9t\xc3\xa9.txt", "/tests/data/dup.txt", "/tests/data/copy"};
+    for (auto root : {fs, erfs_gen_rfseytz()}) {
+        for (auto path : paths) {
+            ErfsHandle handle;
+            uint32_t size;
+            EXPECT_EQ(erfs_open(root, (const uint8_t *)path, strlen(path), &handle, &size), ERFS_OK) << path;
+        }
+    }
+}
+
 TEST(RFS, read_fail) {
     const uint8_t * buff;
     uint32_t size;
@@ -109,4 +166,1169 @@ TEST(RFS, read_open_file) {
 }
 
 
+TEST(RFS, readdir) {
+    ErfsHandle dir;
+    uint32_t count;
+    EXPECT_EQ(erfs_open(fs, (const uint8_t *)"/src", strlen("/src"), &dir, &count), ERFS_OK);
+    EXPECT_GT(count, 1u);
+
+    // sorted by name
+    std::string last;
+    for (uint32_t i = 0; i < count; i++) {
+        ErfsHandle entry;
+        const uint8_t *name;
+        uint32_t name_len;
+        EXPECT_EQ(erfs_readdir(fs, dir, i, &entry), ERFS_OK);
+        EXPECT_EQ(erfs_entryname(fs, entry, &name, &name_len), ERFS_OK);
+        std::string s((const char *)name, name_len);
+        EXPECT_LT(last, s);
+        last = s;
+    }
+    ErfsHandle entry;
+    EXPECT_EQ(erfs_readdir(fs, dir, count, &entry), ERFS_OUTOF_BOUND);
+}
+
+TEST(RFS, read_decoded) {
+    const uint8_t * buff;
+    const uint8_t * buff2;
+    uint32_t size;
+    uint32_t size2;
+    ErfsHandle handle;
+    int result;
+
+    result = erfs_open(fs, (const uint8_t *)"/src/resource_fs.c", strlen("/src/resource_fs.c"), &handle, &size);
+    EXPECT_EQ(result, ERFS_OK);
+
+    result = erfs_read_decoded(fs, handle, &buff, &size2);
+    EXPECT_EQ(result, ERFS_OK);
+    EXPECT_GT(size2, size);
+    std::string prefix = "#define __ERFS_IMPL__";
+    EXPECT_EQ(std::string((const char*)buff, prefix.length()), prefix);
+
+    // served from the cache
+    result = erfs_read_decoded(fs, handle, &buff2, &size);
+    EXPECT_EQ(result, ERFS_OK);
+    EXPECT_EQ(buff, buff2);
+    EXPECT_EQ(size, size2);
+    EXPECT_EQ(erfs_release_decoded(fs, handle, buff), ERFS_OK);
+    EXPECT_EQ(erfs_release_decoded(fs, handle, buff2), ERFS_OK);
+
+    // not compressed, the raw content
+    const uint8_t * raw;
+    result = erfs_read(fs, (const uint8_t *)"/tests/erfs_it.rs", strlen("/tests/erfs_it.rs"), &raw, &size);
+    EXPECT_EQ(result, ERFS_OK);
+    result = erfs_open(fs, (const uint8_t *)"/tests/erfs_it.rs", strlen("/tests/erfs_it.rs"), &handle, &size);
+    EXPECT_EQ(result, ERFS_OK);
+    result = erfs_read_decoded(fs, handle, &buff, &size2);
+    EXPECT_EQ(result, ERFS_OK);
+    EXPECT_EQ(buff, raw);
+    EXPECT_EQ(size, size2);
+    EXPECT_EQ(erfs_release_decoded(fs, handle, buff), ERFS_OK);
+
+    result = erfs_open(fs, (const uint8_t *)"/src", strlen("/src"), &handle, &size);
+    EXPECT_EQ(result, ERFS_OK);
+    result = erfs_read_decoded(fs, handle, &buff, &size);
+    EXPECT_EQ(result, ERFS_NOT_FILE);
+}
+
+TEST(RFS, read_decoded_uncached) {
+    const uint8_t * buff;
+    const uint8_t * buff2;
+    uint32_t size;
+    ErfsHandle handle;
+    int result;
+
+    // nothing fits into the cache, each read gets a private copy
+    EXPECT_EQ(erfs_cache_config(0), ERFS_OK);
+    result = erfs_open(fs, (const uint8_t *)"/src/resource_fs.h", strlen("/src/resource_fs.h"), &handle, &size);
+    EXPECT_EQ(result, ERFS_OK);
+    result = erfs_read_decoded(fs, handle, &buff, &size);
+    EXPECT_EQ(result, ERFS_OK);
+    result = erfs_read_decoded(fs, handle, &buff2, &size);
+    EXPECT_EQ(result, ERFS_OK);
+    EXPECT_NE(buff, buff2);
+    EXPECT_EQ(std::string((const char*)buff, size), std::string((const char*)buff2, size));
+    EXPECT_EQ(erfs_release_decoded(fs, handle, buff), ERFS_OK);
+    EXPECT_EQ(erfs_release_decoded(fs, handle, buff2), ERFS_OK);
+    EXPECT_EQ(erfs_cache_config(1024 * 1024 * 64), ERFS_OK);
+}
+
+TEST(RFS, read_decoded_threads) {
+    const char* files[] = {"/src/resource_fs.c", "/src/resource_fs.h", "/src/lib.rs", "/build.rs"};
+    std::vector<std::thread> threads;
+    std::vector<int> failures(8, 0);
+
+    // a small budget, so reads race with evictions
+    EXPECT_EQ(erfs_cache_config(8 * 1024), ERFS_OK);
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 2000; i++) {
+                const char* file = files[(i + t) % 4];
+                ErfsHandle handle;
+                const uint8_t * buff;
+                uint32_t size;
+                if (erfs_open(fs, (const uint8_t *)file, strlen(file), &handle, &size) != ERFS_OK
+                        || erfs_read_decoded(fs, handle, &buff, &size) != ERFS_OK) {
+                    failures[t]++;
+                    continue;
+                }
+                // every decoded file is text
+                if (size == 0 || memchr(buff, 0, size) != NULL) {
+                    failures[t]++;
+                }
+                erfs_release_decoded(fs, handle, buff);
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    for (int t = 0; t < 8; t++) {
+        EXPECT_EQ(failures[t], 0);
+    }
+    EXPECT_EQ(erfs_cache_config(1024 * 1024 * 64), ERFS_OK);
+}
+
+struct PathCollector {
+    std::vector<std::string> dirs;
+    std::vector<std::string> paths;
+};
+
+extern "C" int path_callback (const ErfsRoot fs, const ErfsHandle entry, enum ErfsTravelType type, void* ctx) {
+    PathCollector* c = reinterpret_cast<PathCollector*>(ctx);
+    const uint8_t* name;
+    uint32_t name_len;
+    erfs_entryname(fs, entry, &name, &name_len);
+
+    std::string parent = c->dirs.empty() ? "" : c->dirs.back();
+    if (type == ERFS_TRAVEL_DIR_ENTER) {
+        std::string path = c->dirs.empty() ? "" : parent + "/" + std::string((char*)name, name_len);
+        c->dirs.push_back(path);
+        if (!path.empty()) {
+            c->paths.push_back(path);
+        }
+    } else if (type == ERFS_TRAVEL_DIR_LEAVE) {
+        c->dirs.pop_back();
+    } else {
+        c->paths.push_back(parent + "/" + std::string((char*)name, name_len));
+    }
+    return 0;
+}
+
+TEST(RFS, hash_open) {
+    const ErfsRoot hfs = erfs_gen_rfshash();
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(fs, path_callback, &collector), ERFS_OK);
+    EXPECT_GT(collector.paths.size(), 5u);
+
+    // same results as the tree walk
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        ErfsHandle hhandle;
+        uint32_t size;
+        uint32_t hsize;
+        uint32_t flags;
+        uint32_t hflags;
+        EXPECT_EQ(erfs_open(fs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        EXPECT_EQ(erfs_open(hfs, (const uint8_t *)path.data(), path.length(), &hhandle, &hsize), ERFS_OK) << path;
+        EXPECT_EQ(size, hsize) << path;
+        erfs_entryflags(handle, &flags);
+        erfs_entryflags(hhandle, &hflags);
+        EXPECT_EQ(flags, hflags) << path;
+
+        // without the leading '/'
+        EXPECT_EQ(erfs_open(hfs, (const uint8_t *)path.data() + 1, path.length() - 1, &hhandle, &hsize), ERFS_OK) << path;
+    }
+
+    ErfsHandle handle;
+    uint32_t size;
+    const char* missing[] = {"/hello.h", "/src/resource_fs", "/src/resource_fs.cc", "/src/resource_fs.c/x", "/src//lib.rs"};
+    for (auto path : missing) {
+        EXPECT_EQ(erfs_open(hfs, (const uint8_t *)path, strlen(path), &handle, &size), ERFS_NOT_FOUND) << path;
+    }
+
+    // a trailing '/' falls back to the tree walk
+    EXPECT_EQ(erfs_open(hfs, (const uint8_t *)"/src/", strlen("/src/"), &handle, &size), ERFS_OK);
+    EXPECT_EQ(erfs_open(hfs, (const uint8_t *)"/", strlen("/"), &handle, &size), ERFS_OK);
+}
+
+/// erfs_open_many() gives the same results as erfs_open() on each path
+static void expect_same_open_many(const ErfsRoot mfs) {
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(fs, path_callback, &collector), ERFS_OK);
+
+    std::vector<std::string> paths;
+    for (auto& path : collector.paths) {
+        paths.push_back(path);
+        paths.push_back(path.substr(1));
+        paths.push_back(path + "/");
+        paths.push_back(path + "x");
+    }
+    for (auto path : {"", "/", "//", "/src//lib.rs", "/src/resource_fs.c/x", "/src/", "/src/resource_fs.c", "/~"}) {
+        paths.push_back(path);
+    }
+
+    std::vector<const uint8_t *> ptrs;
+    std::vector<uint32_t> lens;
+    for (auto& path : paths) {
+        ptrs.push_back((const uint8_t *)path.data());
+        lens.push_back(path.length());
+    }
+    ptrs.push_back(nullptr);
+    lens.push_back(0);
+    size_t n = ptrs.size();
+    std::vector<ErfsHandle> handles(n);
+    std::vector<uint32_t> sizes(n);
+    std::vector<int> status(n);
+    ASSERT_EQ(erfs_open_many(mfs, ptrs.data(), lens.data(), n, handles.data(), sizes.data(), status.data()), ERFS_OK);
+
+    int found = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        ErfsHandle handle;
+        uint32_t size;
+        int result = erfs_open(mfs, ptrs[i], lens[i], &handle, &size);
+        EXPECT_EQ(status[i], result) << paths[i];
+        if (result == ERFS_OK) {
+            EXPECT_EQ(handles[i], handle) << paths[i];
+            EXPECT_EQ(sizes[i], size) << paths[i];
+            found++;
+        }
+    }
+    EXPECT_EQ(status[n - 1], ERFS_INVALID_INPUT);
+    EXPECT_GT(found, (int)collector.paths.size());
+}
+
+TEST(RFS, open_many) {
+    expect_same_open_many(fs);
+    expect_same_open_many(erfs_gen_rfshash());
+    expect_same_open_many(erfs_gen_rfseytz());
+    EXPECT_EQ(erfs_open_many(fs, nullptr, nullptr, 0, nullptr, nullptr, nullptr), ERFS_OK);
+    EXPECT_EQ(erfs_open_many(nullptr, nullptr, nullptr, 0, nullptr, nullptr, nullptr), ERFS_INVALID_INPUT);
+}
+
+struct VisitCollector {
+    std::mutex lock;
+    // entry, type in the order of the callbacks
+    std::vector<std::pair<ErfsHandle, int> > visits;
+    int stop_at = -1;
+};
+
+extern "C" int visit_callback (const ErfsRoot, const ErfsHandle entry, enum ErfsTravelType type, void* ctx) {
+    VisitCollector* c = reinterpret_cast<VisitCollector*>(ctx);
+    std::lock_guard<std::mutex> guard(c->lock);
+    c->visits.push_back({entry, type});
+    return ((int)c->visits.size() == c->stop_at) ? 42 : 0;
+}
+
+TEST(RFS, travel_parallel) {
+    VisitCollector expected;
+    EXPECT_EQ(erfs_travel(fs, visit_callback, &expected), ERFS_OK);
+    std::set<std::pair<ErfsHandle, int> > expected_set(expected.visits.begin(), expected.visits.end());
+    for (auto it = expected_set.begin(); it != expected_set.end();) {
+        it = (it->second == ERFS_TRAVEL_DIR_LEAVE) ? expected_set.erase(it) : std::next(it);
+    }
+
+    for (uint32_t nthreads : {1u, 4u, 0u}) {
+        VisitCollector collector;
+        EXPECT_EQ(erfs_travel_parallel(fs, nthreads, visit_callback, &collector), ERFS_OK);
+        std::set<std::pair<ErfsHandle, int> > visited(collector.visits.begin(), collector.visits.end());
+        EXPECT_EQ(visited.size(), collector.visits.size()) << nthreads;
+        EXPECT_TRUE(visited == expected_set) << nthreads;
+
+        // a directory is entered before its entries
+        std::map<ErfsHandle, size_t> order;
+        for (size_t i = 0; i < collector.visits.size(); i++) {
+            order[collector.visits[i].first] = i;
+        }
+        for (auto& visit : collector.visits) {
+            if (visit.second != ERFS_TRAVEL_DIR_ENTER) {
+                continue;
+            }
+            ErfsHandle child;
+            for (uint32_t i = 0; erfs_readdir(fs, visit.first, i, &child) == ERFS_OK; i++) {
+                EXPECT_LT(order[visit.first], order[child]);
+            }
+        }
+    }
+
+    // the first non zero result stops the travel
+    VisitCollector stopped;
+    stopped.stop_at = 3;
+    EXPECT_EQ(erfs_travel_parallel(fs, 4, visit_callback, &stopped), 42);
+    EXPECT_LT(stopped.visits.size(), expected_set.size());
+    EXPECT_EQ(erfs_travel_parallel(nullptr, 4, visit_callback, &stopped), ERFS_INVALID_INPUT);
+    EXPECT_EQ(erfs_travel_parallel(fs, 4, nullptr, &stopped), ERFS_INVALID_INPUT);
+}
+
+TEST(RFS, eytzinger_open) {
+    const ErfsRoot efs = erfs_gen_rfseytz();
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(fs, path_callback, &collector), ERFS_OK);
+    EXPECT_GT(collector.paths.size(), 5u);
+
+    // same results as the binary search
+    for (auto& path : collector.paths) {
+        for (auto& p : {path, path + "/"}) {
+            ErfsHandle handle;
+            ErfsHandle ehandle;
+            uint32_t size;
+            uint32_t esize;
+            int result = erfs_open(fs, (const uint8_t *)p.data(), p.length(), &handle, &size);
+            EXPECT_EQ(erfs_open(efs, (const uint8_t *)p.data(), p.length(), &ehandle, &esize), result) << p;
+            if (result == ERFS_OK) {
+                EXPECT_EQ(size, esize) << p;
+            }
+        }
+    }
+
+    ErfsHandle handle;
+    uint32_t size;
+    const char* missing[] = {"/hello.h", "/src/resource_fs", "/src/resource_fs.cc", "/src/resource_fs.c/x",
+        "/src/resource_fs.b", "/src/", "/src/\xff", "/0", "/~"};
+    for (auto path : missing) {
+        int result = erfs_open(fs, (const uint8_t *)path, strlen(path), &handle, &size);
+        EXPECT_EQ(erfs_open(efs, (const uint8_t *)path, strlen(path), &handle, &size), result) << path;
+    }
+}
+
+/// all files of `cfs` decode to the same contents as the gzipped ones
+static void expect_same_contents(const ErfsRoot cfs, uint32_t codecs) {
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(fs, path_callback, &collector), ERFS_OK);
+
+    int packed = 0;
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        ErfsHandle chandle;
+        uint32_t size;
+        uint32_t flags;
+        EXPECT_EQ(erfs_open(fs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        EXPECT_EQ(erfs_open(cfs, (const uint8_t *)path.data(), path.length(), &chandle, &size), ERFS_OK) << path;
+        erfs_entryflags(handle, &flags);
+        if ((flags & ERFS_DIRECTORY) != 0) {
+            continue;
+        }
+
+        uint32_t codec;
+        EXPECT_EQ(erfs_entrycodec(chandle, &codec), ERFS_OK);
+        EXPECT_EQ(codec & ~codecs, 0u) << path;
+        packed += (codec != 0);
+
+        const uint8_t *data;
+        const uint8_t *cdata;
+        uint32_t csize;
+        ASSERT_EQ(erfs_read_decoded(fs, handle, &data, &size), ERFS_OK) << path;
+        ASSERT_EQ(erfs_read_decoded(cfs, chandle, &cdata, &csize), ERFS_OK) << path;
+        EXPECT_EQ(std::string((const char *)data, size), std::string((const char *)cdata, csize)) << path;
+        erfs_release_decoded(fs, handle, data);
+        erfs_release_decoded(cfs, chandle, cdata);
+    }
+    EXPECT_GT(packed, 0);
+}
+
+TEST(RFS, codec_auto) {
+    expect_same_contents(erfs_gen_rfsauto(), ERFS_CODEC_MASK);
+}
+
+/// read all files of `sfs` by pieces of `piece` bytes, the same as erfs_read_decoded()
+static void expect_same_stream(const ErfsRoot sfs, uint32_t piece) {
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(sfs, path_callback, &collector), ERFS_OK);
+
+    std::vector<uint8_t> buf(piece);
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        uint32_t size;
+        uint32_t flags;
+        EXPECT_EQ(erfs_open(sfs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        erfs_entryflags(handle, &flags);
+        ErfsStream *stream;
+        if ((flags & ERFS_DIRECTORY) != 0) {
+            EXPECT_EQ(erfs_stream_open(sfs, handle, &stream), ERFS_NOT_FILE) << path;
+            continue;
+        }
+
+        ASSERT_EQ(erfs_stream_open(sfs, handle, &stream), ERFS_OK) << path;
+        std::string content;
+        uint32_t read;
+        do {
+            ASSERT_EQ(erfs_stream_read(stream, buf.data(), piece, &read), ERFS_OK) << path;
+            content.append((const char *)buf.data(), read);
+        } while (read == piece);
+        EXPECT_EQ(erfs_stream_read(stream, buf.data(), piece, &read), ERFS_OK);
+        EXPECT_EQ(read, 0u);
+        EXPECT_EQ(erfs_stream_close(stream), ERFS_OK);
+
+        const uint8_t *data;
+        ASSERT_EQ(erfs_read_decoded(sfs, handle, &data, &size), ERFS_OK) << path;
+        EXPECT_EQ(content, std::string((const char *)data, size)) << path;
+        erfs_release_decoded(sfs, handle, data);
+    }
+}
+
+TEST(RFS, stream_read) {
+    expect_same_stream(fs, 7);
+    expect_same_stream(fs, 4096);
+    expect_same_stream(erfs_gen_rfsauto(), 100);
+}
+
+TEST(RFS, stream_corrupted) {
+    // truncated gzip data
+    ErfsHandle handle;
+    uint32_t size;
+    EXPECT_EQ(erfs_open(fs, (const uint8_t *)"/src/resource_fs.c", strlen("/src/resource_fs.c"), &handle, &size), ERFS_OK);
+    // {name_offset, name_size, data_offset, data_size, flags}
+    uint32_t truncated[5];
+    memcpy(truncated, handle, sizeof(truncated));
+    truncated[3] /= 2;
+    ErfsStream *stream;
+    ASSERT_EQ(erfs_stream_open(fs, truncated, &stream), ERFS_OK);
+    uint8_t buf[256];
+    uint32_t read;
+    int result;
+    do {
+        result = erfs_stream_read(stream, buf, sizeof(buf), &read);
+    } while (result == ERFS_OK && read == sizeof(buf));
+    EXPECT_EQ(result, ERFS_DECODE_FAIL);
+    erfs_stream_close(stream);
+}
+
+/// read all files of `pfs` by erfs_pread() at some offsets, the same as the files of `fs`
+static void expect_same_pread(const ErfsRoot pfs) {
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(fs, path_callback, &collector), ERFS_OK);
+
+    int chunked = 0;
+    std::vector<uint8_t> buf;
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        ErfsHandle phandle;
+        uint32_t size;
+        uint32_t flags;
+        EXPECT_EQ(erfs_open(fs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        EXPECT_EQ(erfs_open(pfs, (const uint8_t *)path.data(), path.length(), &phandle, &size), ERFS_OK) << path;
+        erfs_entryflags(phandle, &flags);
+        uint32_t read;
+        if ((flags & ERFS_DIRECTORY) != 0) {
+            EXPECT_EQ(erfs_pread(pfs, phandle, 0, buf.data(), 0, &read), ERFS_NOT_FILE) << path;
+            continue;
+        }
+        chunked += (flags & ERFS_CHUNKED) != 0;
+
+        const uint8_t *data;
+        ASSERT_EQ(erfs_read_decoded(fs, handle, &data, &size), ERFS_OK) << path;
+        std::string content((const char *)data, size);
+        erfs_release_decoded(fs, handle, data);
+
+        // whole file, block boundaries, partial blocks, past the end
+        std::vector<std::pair<uint32_t, uint32_t> > ranges = {{0, size}, {0, 1024}, {1024, 1024}, {1000, 2100},
+            {1, 1}, {size / 2, 3000}, {size - 1, 10}, {size, 10}, {size + 5, 10}};
+        for (auto& r : ranges) {
+            buf.assign(r.second + 1, 0);
+            ASSERT_EQ(erfs_pread(pfs, phandle, r.first, buf.data(), r.second, &read), ERFS_OK) << path;
+            std::string expected = (r.first < size) ? content.substr(r.first, r.second) : std::string();
+            EXPECT_EQ(std::string((const char *)buf.data(), read), expected) << path << " @" << r.first;
+        }
+    }
+    EXPECT_GT(chunked, 0);
+}
+
+TEST(RFS, chunked_pread) {
+    const ErfsRoot pfs = erfs_gen_rfschunk();
+    expect_same_contents(pfs, ERFS_CODEC_MASK);
+    expect_same_pread(pfs);
+    expect_same_stream(pfs, 100);
+    expect_same_stream(pfs, 3000);
+}
+
+#if defined(ERFS_WITH_ZSTD)
+TEST(RFS, codec_zstd) {
+    expect_same_contents(erfs_gen_rfszstd(), ERFS_ZSTD);
+    expect_same_stream(erfs_gen_rfszstd(), 100);
+}
+#endif
+
+#if defined(ERFS_WITH_LZ4)
+TEST(RFS, codec_lz4) {
+    expect_same_contents(erfs_gen_rfslz4(), ERFS_LZ4);
+    expect_same_stream(erfs_gen_rfslz4(), 100);
+}
+#endif
+
+TEST(RFS, blob_read) {
+    const ErfsRoot bfs = erfs_gen_rfsblob();
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(fs, path_callback, &collector), ERFS_OK);
+
+    // same contents as the string literals
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        ErfsHandle bhandle;
+        uint32_t size;
+        uint32_t bsize;
+        EXPECT_EQ(erfs_open(fs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        EXPECT_EQ(erfs_open(bfs, (const uint8_t *)path.data(), path.length(), &bhandle, &bsize), ERFS_OK) << path;
+
+        const uint8_t* name;
+        const uint8_t* bname;
+        EXPECT_EQ(erfs_entryname(fs, handle, &name, &size), ERFS_OK);
+        EXPECT_EQ(erfs_entryname(bfs, bhandle, &bname, &bsize), ERFS_OK);
+        EXPECT_EQ(std::string((const char*)name, size), std::string((const char*)bname, bsize)) << path;
+
+        const uint8_t* data;
+        const uint8_t* bdata;
+        if (erfs_readfile(fs, handle, &data, &size) == ERFS_OK) {
+            EXPECT_EQ(erfs_readfile(bfs, bhandle, &bdata, &bsize), ERFS_OK) << path;
+            EXPECT_EQ(std::string((const char*)data, size), std::string((const char*)bdata, bsize)) << path;
+        }
+    }
+}
+
+TEST(RFS, mount_file) {
+    ErfsRoot mfs;
+    EXPECT_EQ(erfs_mount_file(ERFS_TEST_IMAGE, &mfs), ERFS_OK);
+
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(fs, path_callback, &collector), ERFS_OK);
+    PathCollector mcollector;
+    EXPECT_EQ(erfs_travel(mfs, path_callback, &mcollector), ERFS_OK);
+    EXPECT_EQ(collector.paths, mcollector.paths);
+
+    // same contents as the embedded FS
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        ErfsHandle mhandle;
+        uint32_t size;
+        uint32_t msize;
+        EXPECT_EQ(erfs_open(fs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        EXPECT_EQ(erfs_open(mfs, (const uint8_t *)path.data(), path.length(), &mhandle, &msize), ERFS_OK) << path;
+        EXPECT_EQ(size, msize) << path;
+
+        const uint8_t* data;
+        const uint8_t* mdata;
+        if (erfs_readfile(fs, handle, &data, &size) == ERFS_OK) {
+            EXPECT_EQ(erfs_readfile(mfs, mhandle, &mdata, &msize), ERFS_OK) << path;
+            EXPECT_EQ(std::string((const char*)data, size), std::string((const char*)mdata, msize)) << path;
+        }
+    }
+
+    // decoded contents must be released before unmount
+    ErfsHandle handle;
+    const uint8_t* data;
+    uint32_t size;
+    EXPECT_EQ(erfs_open(mfs, (const uint8_t *)"/src/resource_fs.c", strlen("/src/resource_fs.c"), &handle, &size), ERFS_OK);
+    EXPECT_EQ(erfs_read_decoded(mfs, handle, &data, &size), ERFS_OK);
+    EXPECT_EQ(erfs_unmount(mfs), ERFS_BUSY);
+    EXPECT_EQ(erfs_release_decoded(mfs, handle, data), ERFS_OK);
+    EXPECT_EQ(erfs_unmount(mfs), ERFS_OK);
+}
+
+TEST(RFS, wide) {
+    const ErfsRoot wfs = erfs_gen_rfswide();
+    ErfsHandle handle;
+    uint32_t size;
+    uint32_t flags;
+    EXPECT_EQ(erfs_open(wfs, (const uint8_t *)"/src/resource_fs.c", strlen("/src/resource_fs.c"), &handle, &size), ERFS_OK);
+    EXPECT_EQ(erfs_entryflags(handle, &flags), ERFS_OK);
+    EXPECT_EQ(flags & (ERFS_WIDE | ERFS_CODEC_MASK), ERFS_WIDE | ERFS_GZIPPED);
+
+    expect_same_contents(wfs, ERFS_GZIPPED);
+    expect_same_open_many(wfs);
+    expect_same_pread(wfs);
+    expect_same_stream(wfs, 1000);
+
+    ErfsRoot mfs;
+    ASSERT_EQ(erfs_mount_file(ERFS_TEST_WIDE_IMAGE, &mfs), ERFS_OK);
+    expect_same_contents(mfs, ERFS_GZIPPED);
+    expect_same_open_many(mfs);
+    EXPECT_EQ(erfs_unmount(mfs), ERFS_OK);
+}
+
+/// erfs_entryinfo() of all files of `ifs` matches their decoded contents
+static void expect_file_info(const ErfsRoot ifs) {
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(fs, path_callback, &collector), ERFS_OK);
+
+    int compressed = 0;
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        uint32_t size;
+        uint32_t crc;
+        EXPECT_EQ(erfs_open(ifs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        uint32_t flags;
+        erfs_entryflags(handle, &flags);
+        if ((flags & ERFS_DIRECTORY) != 0) {
+            EXPECT_EQ(erfs_entryinfo(ifs, handle, &size, &crc), ERFS_NOT_FILE) << path;
+            continue;
+        }
+        compressed += (flags & ERFS_CODEC_MASK) != 0;
+
+        ASSERT_EQ(erfs_entryinfo(ifs, handle, &size, &crc), ERFS_OK) << path;
+        const uint8_t *data;
+        uint32_t dsize;
+        ASSERT_EQ(erfs_read_decoded(ifs, handle, &data, &dsize), ERFS_OK) << path;
+        EXPECT_EQ(size, dsize) << path;
+        EXPECT_EQ(crc, (uint32_t)crc32(0, data, dsize)) << path;
+        erfs_release_decoded(ifs, handle, data);
+    }
+    EXPECT_GT(compressed, 0);
+}
+
+TEST(RFS, file_info) {
+    expect_file_info(erfs_gen_rfschunk());
+    expect_file_info(erfs_gen_rfswide());
+
+    ErfsRoot mfs;
+    ASSERT_EQ(erfs_mount_file(ERFS_TEST_IMAGE, &mfs), ERFS_OK);
+    expect_file_info(mfs);
+    EXPECT_EQ(erfs_unmount(mfs), ERFS_OK);
+
+    // generated without --crc
+    ErfsHandle handle;
+    uint32_t size;
+    uint32_t crc;
+    EXPECT_EQ(erfs_open(fs, (const uint8_t *)"/src/resource_fs.c", strlen("/src/resource_fs.c"), &handle, &size), ERFS_OK);
+    EXPECT_EQ(erfs_entryinfo(fs, handle, &size, &crc), ERFS_NOT_FOUND);
+}
+
+/// number of files of `dfs` compressed with the dictionary
+static int dict_files(const ErfsRoot dfs) {
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(dfs, path_callback, &collector), ERFS_OK);
+
+    int count = 0;
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        uint32_t size;
+        uint32_t flags;
+        EXPECT_EQ(erfs_open(dfs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        erfs_entryflags(handle, &flags);
+        count += (flags & ERFS_DICT) != 0;
+    }
+    return count;
+}
+
+TEST(RFS, dict) {
+    const ErfsRoot dfs = erfs_gen_rfsdict();
+    EXPECT_GT(dict_files(dfs), 0);
+    expect_same_contents(dfs, ERFS_CODEC_MASK);
+    expect_same_stream(dfs, 100);
+    expect_same_pread(dfs);
+    expect_file_info(dfs);
+
+    ErfsRoot mfs;
+    ASSERT_EQ(erfs_mount_file(ERFS_TEST_DICT_IMAGE, &mfs), ERFS_OK);
+    EXPECT_GT(dict_files(mfs), 0);
+    expect_same_contents(mfs, ERFS_GZIPPED);
+    expect_same_stream(mfs, 1000);
+    EXPECT_EQ(erfs_unmount(mfs), ERFS_OK);
+}
+
+/// the non empty files of `afs` are aligned to `align`, or to `in_place` and uncompressed if their path ends with `suffix`
+static void expect_aligned(const ErfsRoot afs, uint32_t align, const std::string& suffix, uint32_t in_place) {
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(afs, path_callback, &collector), ERFS_OK);
+
+    int matched = 0;
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        uint32_t size;
+        uint32_t flags;
+        uint32_t entry_align;
+        EXPECT_EQ(erfs_open(afs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        erfs_entryflags(handle, &flags);
+        if ((flags & ERFS_DIRECTORY) != 0) {
+            EXPECT_EQ(erfs_entryalign(afs, handle, &entry_align), ERFS_NOT_FILE) << path;
+            continue;
+        }
+        ASSERT_EQ(erfs_entryalign(afs, handle, &entry_align), ERFS_OK) << path;
+        const uint8_t *data;
+        ASSERT_EQ(erfs_readfile(afs, handle, &data, &size), ERFS_OK) << path;
+        EXPECT_EQ((uintptr_t)data % entry_align, 0u) << path;
+        if (size == 0) {
+            continue;
+        }
+        bool match = path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+        if (match) {
+            matched++;
+            EXPECT_GE(entry_align, in_place) << path;
+            EXPECT_EQ(flags & ERFS_CODEC_MASK, 0u) << path;
+        } else {
+            EXPECT_GE(entry_align, align) << path;
+        }
+    }
+    EXPECT_GT(matched, 0);
+}
+
+TEST(RFS, align) {
+    const ErfsRoot afs = erfs_gen_rfsalign();
+    expect_aligned(afs, 64, ".h", 4096);
+    expect_same_contents(afs, ERFS_GZIPPED);
+
+    ErfsRoot mfs;
+    ASSERT_EQ(erfs_mount_file(ERFS_TEST_ALIGN_IMAGE, &mfs), ERFS_OK);
+    expect_aligned(mfs, 1, ".c", 4096);
+    expect_same_contents(mfs, ERFS_GZIPPED);
+    EXPECT_EQ(erfs_unmount(mfs), ERFS_OK);
+}
+
+TEST(RFS, profile) {
+    ErfsRoot mfs;
+    ASSERT_EQ(erfs_mount_file(ERFS_TEST_PROFILE_IMAGE, &mfs), ERFS_OK);
+    expect_same_contents(mfs, ERFS_GZIPPED);
+
+    // the files of tests/profile.txt, contiguous in access order; copy/dup.txt and dup.txt share the data
+    const char *profiled[] = {"/src/resource_fs.h", "/tests/data/copy/dup.txt", "/tests/data/dup.txt",
+        "/tests/data/été.txt", "/build.rs"};
+    const uint8_t *end = 0;
+    for (auto path : profiled) {
+        ErfsHandle handle;
+        uint32_t size;
+        const uint8_t *data;
+        ASSERT_EQ(erfs_open(mfs, (const uint8_t *)path, strlen(path), &handle, &size), ERFS_OK) << path;
+        ASSERT_EQ(erfs_readfile(mfs, handle, &data, &size), ERFS_OK) << path;
+        if (strcmp(path, "/tests/data/dup.txt") == 0) {
+            EXPECT_EQ(data + size, end) << path;
+            continue;
+        }
+        if (end != 0) {
+            EXPECT_EQ(data, end) << path;
+        }
+        end = data + size;
+    }
+
+    // the others follow
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(mfs, path_callback, &collector), ERFS_OK);
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        uint32_t size;
+        uint32_t flags;
+        const uint8_t *data;
+        EXPECT_EQ(erfs_open(mfs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        erfs_entryflags(handle, &flags);
+        if ((flags & ERFS_DIRECTORY) != 0 || std::find(std::begin(profiled), std::end(profiled), path) != std::end(profiled)) {
+            continue;
+        }
+        ASSERT_EQ(erfs_readfile(mfs, handle, &data, &size), ERFS_OK) << path;
+        EXPECT_GE(data, end) << path;
+    }
+    EXPECT_EQ(erfs_unmount(mfs), ERFS_OK);
+}
+
+/// erfs_find_prefix() of `pfs` gives the same ranges as a scan, for the prefixes of the names and a few others
+static void expect_same_prefix_ranges(const ErfsRoot pfs) {
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(pfs, path_callback, &collector), ERFS_OK);
+    collector.paths.push_back("/");
+    for (auto& path : collector.paths) {
+        ErfsHandle dir;
+        uint32_t size;
+        EXPECT_EQ(erfs_open(pfs, (const uint8_t *)path.data(), path.length(), &dir, &size), ERFS_OK) << path;
+        uint32_t first;
+        uint32_t count;
+        uint32_t flags;
+        erfs_entryflags(dir, &flags);
+        if ((flags & ERFS_DIRECTORY) == 0) {
+            EXPECT_EQ(erfs_find_prefix(pfs, dir, (const uint8_t *)"a", 1, &first, &count), ERFS_NOT_DIRECTORY) << path;
+            continue;
+        }
+        std::vector<std::string> names;
+        for (uint32_t i = 0; i < size; i++) {
+            ErfsHandle entry;
+            const uint8_t *name;
+            uint32_t name_size;
+            erfs_readdir(pfs, dir, i, &entry);
+            erfs_entryname(pfs, entry, &name, &name_size);
+            names.emplace_back((const char *)name, name_size);
+        }
+        std::set<std::string> prefixes = {"", "0", "zzz", "\xff", "resource_", "resource_fs.h.x", "dup"};
+        for (auto& name : names) {
+            for (size_t len = 1; len <= name.length(); len++) {
+                prefixes.insert(name.substr(0, len));
+            }
+        }
+        for (auto& prefix : prefixes) {
+            uint32_t expected_first = size;
+            uint32_t expected_count = 0;
+            for (uint32_t i = 0; i < size; i++) {
+                if (names[i].compare(0, prefix.length(), prefix) == 0) {
+                    expected_first = std::min(expected_first, i);
+                    expected_count++;
+                }
+            }
+            ASSERT_EQ(erfs_find_prefix(pfs, dir, (const uint8_t *)prefix.data(), prefix.length(), &first, &count), ERFS_OK);
+            EXPECT_EQ(count, expected_count) << path << " " << prefix;
+            if (expected_count > 0) {
+                EXPECT_EQ(first, expected_first) << path << " " << prefix;
+            }
+        }
+    }
+}
+
+TEST(RFS, find_prefix) {
+    expect_same_prefix_ranges(fs);
+    expect_same_prefix_ranges(erfs_gen_rfseytz());
+    expect_same_prefix_ranges(erfs_gen_rfswide());
+}
+
+extern "C" int glob_callback(const ErfsRoot fs, const ErfsHandle entry, const uint8_t *path, uint32_t path_len, void* ctx) {
+    std::vector<std::string>* paths = reinterpret_cast<std::vector<std::string>*>(ctx);
+    EXPECT_EQ(path[path_len], 0);
+    ErfsHandle opened;
+    uint32_t size;
+    EXPECT_EQ(erfs_open(fs, path, path_len, &opened, &size), ERFS_OK);
+    EXPECT_EQ(opened, entry);
+    paths->emplace_back((const char *)path, path_len);
+    return 0;
+}
+
+/// the paths matching a pattern by erfs_glob(), sorted
+static std::vector<std::string> glob(const ErfsRoot gfs, const std::string& pattern) {
+    std::vector<std::string> paths;
+    EXPECT_EQ(erfs_glob(gfs, (const uint8_t *)pattern.data(), pattern.length(), glob_callback, &paths), ERFS_OK) << pattern;
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+TEST(RFS, glob) {
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(fs, path_callback, &collector), ERFS_OK);
+    auto expected = [&](std::function<bool(const std::string&)> match) {
+        std::vector<std::string> paths;
+        for (auto& path : collector.paths) {
+            if (match(path)) {
+                paths.push_back(path);
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    };
+
+    // one directory per part, like fnmatch() with FNM_PATHNAME
+    for (std::string pattern : {"/src/*.c", "src/resource_?s.*", "/*/resource_[f-s]*.c", "/src/resource_[!f]*",
+            "/tests/data/*", "/*", "/*/*/*", "/src/resource_fs.h", "/src/missing", "/src/[rl]*", "/src/[]r]*", "/src/[*",
+            "/tests/*/*.txt", "/src/resource_\\fs.h"}) {
+        std::string absolute = (pattern[0] == '/') ? pattern : "/" + pattern;
+        EXPECT_EQ(glob(fs, pattern), expected([&](const std::string& path) {
+            return fnmatch(absolute.c_str(), path.c_str(), FNM_PATHNAME) == 0;
+        })) << pattern;
+    }
+    EXPECT_EQ(glob(fs, "/src/resource_fs.h"), std::vector<std::string>{"/src/resource_fs.h"});
+
+    // "**" for any number of directories
+    auto ends_with = [](const std::string& s, const std::string& end) {
+        return s.length() >= end.length() && s.compare(s.length() - end.length(), end.length(), end) == 0;
+    };
+    EXPECT_EQ(glob(fs, "**/*.txt"), expected([&](const std::string& path) {return ends_with(path, ".txt");}));
+    EXPECT_EQ(glob(fs, "/tests/**/dup.txt"), expected([&](const std::string& path) {
+        return path.compare(0, 7, "/tests/") == 0 && ends_with(path, "/dup.txt");
+    }));
+    EXPECT_EQ(glob(fs, "/tests/**/**"), expected([&](const std::string& path) {return path.compare(0, 7, "/tests/") == 0;}));
+    EXPECT_EQ(glob(fs, "/tests/**").size(), glob(fs, "/tests/**/**").size());
+
+    // a trailing '/' for directories
+    std::vector<std::string> dirs = expected([&](const std::string& path) {
+        ErfsHandle handle;
+        uint32_t size;
+        uint32_t flags;
+        erfs_open(fs, (const uint8_t *)path.data(), path.length(), &handle, &size);
+        erfs_entryflags(handle, &flags);
+        return (flags & ERFS_DIRECTORY) != 0;
+    });
+    EXPECT_EQ(glob(fs, "**/"), dirs);
+    EXPECT_EQ(glob(fs, "/"), std::vector<std::string>{"/"});
+
+    // the same on the other layouts
+    EXPECT_EQ(glob(erfs_gen_rfseytz(), "**/*.c"), glob(fs, "**/*.c"));
+    EXPECT_EQ(glob(erfs_gen_rfswide(), "/src/resource_*"), glob(fs, "/src/resource_*"));
+}
+
+/// erfs_fopen() of all files of `ffs` reads, seeks and ends like the decoded contents
+static void expect_same_fopen(const ErfsRoot ffs) {
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(ffs, path_callback, &collector), ERFS_OK);
+
+    std::vector<char> buf(1000);
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        uint32_t size;
+        uint32_t flags;
+        FILE *file;
+        EXPECT_EQ(erfs_open(ffs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        erfs_entryflags(handle, &flags);
+        if ((flags & ERFS_DIRECTORY) != 0) {
+            EXPECT_EQ(erfs_fopen(ffs, (const uint8_t *)path.data(), path.length(), &file), ERFS_NOT_FILE) << path;
+            continue;
+        }
+        const uint8_t *data;
+        ASSERT_EQ(erfs_read_decoded(ffs, handle, &data, &size), ERFS_OK) << path;
+        std::string expected((const char *)data, size);
+        erfs_release_decoded(ffs, handle, data);
+
+        ASSERT_EQ(erfs_fopen(ffs, (const uint8_t *)path.data(), path.length(), &file), ERFS_OK) << path;
+        std::string content;
+        size_t n;
+        while ((n = fread(buf.data(), 1, buf.size(), file)) > 0) {
+            content.append(buf.data(), n);
+        }
+        EXPECT_TRUE(feof(file)) << path;
+        EXPECT_EQ(content, expected) << path;
+
+        // backward, then forward from the end
+        ASSERT_EQ(fseek(file, size / 3, SEEK_SET), 0) << path;
+        n = fread(buf.data(), 1, buf.size(), file);
+        EXPECT_EQ(std::string(buf.data(), n), expected.substr(size / 3, buf.size())) << path;
+        ASSERT_EQ(fseek(file, 0, SEEK_END), 0) << path;
+        EXPECT_EQ(ftell(file), (long)size) << path;
+        ASSERT_EQ(fseek(file, -(long)(size / 2), SEEK_END), 0) << path;
+        n = fread(buf.data(), 1, buf.size(), file);
+        EXPECT_EQ(std::string(buf.data(), n), expected.substr(size - size / 2, buf.size())) << path;
+        EXPECT_EQ(fclose(file), 0);
+    }
+
+    FILE *file;
+    EXPECT_EQ(erfs_fopen(ffs, (const uint8_t *)"/nonexistent", strlen("/nonexistent"), &file), ERFS_NOT_FOUND);
+}
+
+TEST(RFS, fopen) {
+    expect_same_fopen(fs);
+    expect_same_fopen(erfs_gen_rfsauto());
+    expect_same_fopen(erfs_gen_rfschunk());
+    expect_same_fopen(erfs_gen_rfsdict());
+}
+
+TEST(RFS, memfd) {
+    const ErfsRoot mfs = erfs_gen_rfsauto();
+    PathCollector collector;
+    EXPECT_EQ(erfs_travel(mfs, path_callback, &collector), ERFS_OK);
+
+    for (auto& path : collector.paths) {
+        ErfsHandle handle;
+        uint32_t size;
+        uint32_t flags;
+        int fd;
+        EXPECT_EQ(erfs_open(mfs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        erfs_entryflags(handle, &flags);
+        if ((flags & ERFS_DIRECTORY) != 0) {
+            EXPECT_EQ(erfs_memfd(mfs, (const uint8_t *)path.data(), path.length(), &fd), ERFS_NOT_FILE) << path;
+            continue;
+        }
+        ASSERT_EQ(erfs_memfd(mfs, (const uint8_t *)path.data(), path.length(), &fd), ERFS_OK) << path;
+        const uint8_t *data;
+        ASSERT_EQ(erfs_read_decoded(mfs, handle, &data, &size), ERFS_OK) << path;
+        std::string expected((const char *)data, size);
+        erfs_release_decoded(mfs, handle, data);
+
+        struct stat st;
+        ASSERT_EQ(fstat(fd, &st), 0);
+        EXPECT_EQ(st.st_size, (off_t)size) << path;
+        std::string content(size, 0);
+        EXPECT_EQ(read(fd, &content[0], size), (ssize_t)size) << path;
+        EXPECT_EQ(content, expected) << path;
+
+        // sealed
+        EXPECT_EQ(write(fd, "x", 1), -1);
+        EXPECT_NE(ftruncate(fd, 0), 0);
+        int seals = fcntl(fd, F_GET_SEALS);
+        EXPECT_EQ(seals & (F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL),
+            F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+        close(fd);
+    }
+}
+
+/// output of erfs_stats_dump()
+static std::string stats_dump(ErfsRoot fs, int format) {
+    char *buf = 0;
+    size_t size = 0;
+    FILE *out = open_memstream(&buf, &size);
+    EXPECT_EQ(erfs_stats_dump(fs, format, out), ERFS_OK);
+    fclose(out);
+    std::string text(buf, size);
+    free(buf);
+    return text;
+}
+
+TEST(RFS, stats) {
+    ErfsRoot mfs;
+    ASSERT_EQ(erfs_mount_file(ERFS_TEST_IMAGE, &mfs), ERFS_OK);
+#if defined(ERFS_STATS)
+    const char *dup = "/tests/data/dup.txt";
+    const char *copy = "/tests/data/copy/dup.txt";
+    const char *missing = "/tests/data/missing.txt";
+    ErfsHandle handle;
+    uint32_t size;
+    const uint8_t *data;
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(erfs_open(mfs, (const uint8_t *)dup, strlen(dup), &handle, &size), ERFS_OK);
+    }
+    EXPECT_EQ(erfs_read(mfs, (const uint8_t *)copy, strlen(copy), &data, &size), ERFS_OK);
+    EXPECT_EQ(erfs_open(mfs, (const uint8_t *)missing, strlen(missing), &handle, &size), ERFS_NOT_FOUND);
+    const uint8_t *paths[] = {(const uint8_t *)dup, (const uint8_t *)missing};
+    uint32_t lens[] = {(uint32_t)strlen(dup), (uint32_t)strlen(missing)};
+    ErfsHandle handles[2];
+    uint32_t sizes[2];
+    int status[2];
+    EXPECT_EQ(erfs_open_many(mfs, paths, lens, 2, handles, sizes, status), ERFS_OK);
+
+    std::string json = stats_dump(mfs, ERFS_STATS_JSON);
+    EXPECT_NE(json.find("\"open\": {\"hits\": 4, \"misses\": 2"), std::string::npos) << json;
+    EXPECT_NE(json.find("\"read\": {\"hits\": 1, \"misses\": 0"), std::string::npos) << json;
+    EXPECT_NE(json.find("{\"path\": \"/tests/data/dup.txt\", \"count\": 4}"), std::string::npos) << json;
+    EXPECT_NE(json.find("{\"path\": \"/tests/data/copy/dup.txt\", \"count\": 1}"), std::string::npos) << json;
+
+    std::string prom = stats_dump(mfs, ERFS_STATS_PROMETHEUS);
+    EXPECT_NE(prom.find("erfs_open_total{result=\"miss\"} 2\n"), std::string::npos) << prom;
+    EXPECT_NE(prom.find("erfs_open_latency_seconds_count 4\n"), std::string::npos) << prom;
+    EXPECT_NE(prom.find("erfs_entry_access_total{path=\"/tests/data/dup.txt\"} 4\n"), std::string::npos) << prom;
+
+    EXPECT_EQ(erfs_stats_reset(mfs), ERFS_OK);
+    prom = stats_dump(mfs, ERFS_STATS_PROMETHEUS);
+    EXPECT_NE(prom.find("erfs_open_total{result=\"hit\"} 0\n"), std::string::npos) << prom;
+    EXPECT_EQ(prom.find("erfs_entry_access_total{"), std::string::npos) << prom;
+#else
+    EXPECT_EQ(erfs_stats_dump(mfs, ERFS_STATS_JSON, stdout), ERFS_UNSUPPORTED);
+    EXPECT_EQ(erfs_stats_reset(mfs), ERFS_UNSUPPORTED);
+#endif
+    EXPECT_EQ(erfs_unmount(mfs), ERFS_OK);
+}
+
+#if defined(ERFS_STATS)
+TEST(RFS, stats_slots) {
+    // B keeps its counters when A frees the slot before it
+    ErfsRoot a, b;
+    ASSERT_EQ(erfs_mount_file(ERFS_TEST_IMAGE, &a), ERFS_OK);
+    ASSERT_EQ(erfs_mount_file(ERFS_TEST_JOBS_IMAGE, &b), ERFS_OK);
+    const char *dup = "/tests/data/dup.txt";
+    ErfsHandle handle;
+    uint32_t size;
+    EXPECT_EQ(erfs_open(a, (const uint8_t *)dup, strlen(dup), &handle, &size), ERFS_OK);
+    EXPECT_EQ(erfs_open(b, (const uint8_t *)dup, strlen(dup), &handle, &size), ERFS_OK);
+    EXPECT_EQ(erfs_unmount(a), ERFS_OK);
+    EXPECT_EQ(erfs_open(b, (const uint8_t *)dup, strlen(dup), &handle, &size), ERFS_OK);
+
+    std::string json = stats_dump(b, ERFS_STATS_JSON);
+    EXPECT_NE(json.find("\"open\": {\"hits\": 2, \"misses\": 0"), std::string::npos) << json;
+    EXPECT_NE(json.find("{\"path\": \"/tests/data/dup.txt\", \"count\": 2}"), std::string::npos) << json;
+    EXPECT_EQ(erfs_stats_reset(b), ERFS_OK);
+    json = stats_dump(b, ERFS_STATS_JSON);
+    EXPECT_NE(json.find("\"open\": {\"hits\": 0, \"misses\": 0"), std::string::npos) << json;
+    EXPECT_EQ(erfs_unmount(b), ERFS_OK);
+}
+#endif
+
+/// the whole content of a file
+static std::string file_content(const char *path) {
+    std::ifstream ifs(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+TEST(RFS, jobs) {
+    // compressed by 4 workers, byte for byte the same image as by one
+    std::string serial = file_content(ERFS_TEST_IMAGE);
+    EXPECT_GT(serial.size(), 0u);
+    EXPECT_TRUE(serial == file_content(ERFS_TEST_JOBS_IMAGE));
+}
+
+/// run erfs_gen, and return what it prints
+static std::string run_gen(const std::string& args) {
+    std::string command = std::string(ERFS_GEN_PATH) + " " + args + " 2>&1";
+    FILE *p = popen(command.c_str(), "r");
+    std::string out;
+    char buf[4096];
+    size_t n;
+    while (p != nullptr && (n = fread(buf, 1, sizeof(buf), p)) > 0) {
+        out.append(buf, n);
+    }
+    EXPECT_EQ(p != nullptr ? pclose(p) : -1, 0) << command << "\n" << out;
+    return out;
+}
+
+/// the files of `dir` mounted from `image` have the contents of the source files
+static void expect_image_of(const std::filesystem::path& image, const std::filesystem::path& dir) {
+    ErfsRoot mfs;
+    ASSERT_EQ(erfs_mount_file(image.c_str(), &mfs), ERFS_OK);
+    for (auto& p : std::filesystem::recursive_directory_iterator(dir)) {
+        if (!p.is_regular_file()) {
+            continue;
+        }
+        std::string path = "/" + p.path().lexically_relative(dir).generic_string();
+        ErfsHandle handle;
+        uint32_t size;
+        const uint8_t *data;
+        ASSERT_EQ(erfs_open(mfs, (const uint8_t *)path.data(), path.length(), &handle, &size), ERFS_OK) << path;
+        ASSERT_EQ(erfs_read_decoded(mfs, handle, &data, &size), ERFS_OK) << path;
+        EXPECT_TRUE(std::string((const char *)data, size) == file_content(p.path().c_str())) << path;
+        erfs_release_decoded(mfs, handle, data);
+    }
+    EXPECT_EQ(erfs_unmount(mfs), ERFS_OK);
+}
+
+TEST(RFS, gen_cache) {
+    char tmpl[] = "/tmp/erfs_cache_XXXXXX";
+    ASSERT_NE(mkdtemp(tmpl), nullptr);
+    std::filesystem::path root(tmpl);
+    std::filesystem::path src = root / "src";
+    std::filesystem::path out = root / "out";
+    std::filesystem::create_directories(src / "copy");
+    std::filesystem::create_directories(out);
+    auto write = [](const std::filesystem::path& path, const std::string& line, int count) {
+        std::ofstream ofs(path, std::ios::binary);
+        for (int i = 0; i < count; i++) {
+            ofs << line << " " << i % 37 << "\n";
+        }
+    };
+    // files of the same content, compressed concurrently with --codec=auto
+    for (int i = 0; i < 6; i++) {
+        write(src / ("dup" + std::to_string(i) + ".txt"), "the same line", 2000);
+        write(src / "copy" / ("dup" + std::to_string(i) + ".txt"), "the same line", 2000);
+    }
+    write(src / "a.txt", "another line", 1000);
+    write(src / "b.txt", "the last line", 500);
+    std::string args = "--codec=auto --jobs 4 " + src.string() + " ";
+    std::filesystem::path image = out / "erfs_cache.img";
+    std::filesystem::path source = out / "erfs_cachesrc.c";
+
+    run_gen("--image " + args + "cache " + out.string());
+    run_gen(args + "cachesrc " + out.string());
+    expect_image_of(image, src);
+    auto image_time = std::filesystem::last_write_time(image);
+    auto source_time = std::filesystem::last_write_time(source);
+    usleep(20000);
+
+    // nothing changed: all files reused, the outputs are not rewritten
+    EXPECT_NE(run_gen("--image " + args + "cache " + out.string()).find("Reused 14 compressed files"), std::string::npos);
+    EXPECT_NE(run_gen(args + "cachesrc " + out.string()).find("Reused 14 compressed files"), std::string::npos);
+    EXPECT_TRUE(std::filesystem::last_write_time(image) == image_time);
+    EXPECT_TRUE(std::filesystem::last_write_time(source) == source_time);
+
+    // one file changed: only this one is compressed again
+    write(src / "b.txt", "a changed line", 700);
+    EXPECT_NE(run_gen("--image " + args + "cache " + out.string()).find("Reused 13 compressed files"), std::string::npos);
+    EXPECT_FALSE(std::filesystem::last_write_time(image) == image_time);
+    expect_image_of(image, src);
+
+    std::filesystem::remove_all(root);
+}
+
+TEST(RFS, mount_file_fail) {
+    ErfsRoot mfs;
+    EXPECT_EQ(erfs_mount_file("/nonexistent/erfs.img", &mfs), ERFS_NOT_FOUND);
+    EXPECT_EQ(erfs_mount_file(__FILE__, &mfs), ERFS_INVALID_IMAGE);
+    EXPECT_EQ(erfs_mount_file(NULL, &mfs), ERFS_INVALID_INPUT);
+
+    // the header of an image of the other byte order
+    std::string image = file_content(ERFS_TEST_IMAGE);
+    ASSERT_GT(image.size(), 12u);
+    std::reverse(&image[4], &image[8]);
+    std::reverse(&image[8], &image[12]);
+    char path[] = "/tmp/erfs_swapped_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(write(fd, image.data(), image.size()), (ssize_t)image.size());
+    close(fd);
+    EXPECT_EQ(erfs_mount_file(path, &mfs), ERFS_INVALID_IMAGE);
+    unlink(path);
+}
+
 } // namespace